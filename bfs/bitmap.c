@@ -46,8 +46,8 @@ struct inode *bfs_new_inode(struct super_block *sb)
 	/* get free ino in bitmap */
 	ino = bfs_get_free_bitmap(sbi->s_imap, sbi->s_lasti);
 
-	/* no free inode */
-	if (ino == -1) {
+	/* no free inode (bitmap search may go past last inode) */
+	if (ino == -1 || ino > sbi->s_lasti) {
 		vfs_iput(inode);
 		return NULL;
 	}
@@ -68,6 +68,7 @@ int bfs_read_super(struct super_block *sb, void *data)
 		err = -ENOMEM;
 		goto err_no_map;
 	}
+	memset(sbi->s_imap, 0, imap_len);
 
 	/* mark inodes before root */
 	for (i = 0; i < BFS_ROOT_INO; i++)
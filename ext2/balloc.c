@@ -1,4 +1,9 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "ext2.h"
 
@@ -21,12 +26,12 @@ struct ext2_group_desc *ext2_get_group_desc(struct super_block *sb, uint32_t blo
 	if (!sbi->s_group_desc[group_desc])
 		return NULL;
 
-	/* group block buffer of group descriptor */
-	desc = (struct ext2_group_desc *) sbi->s_group_desc[group_desc]->b_data;
+	/* group block buffer of group descriptor (descriptors are bigger with 64bit feature) */
+	desc = (struct ext2_group_desc *) (sbi->s_group_desc[group_desc]->b_data + offset * sbi->s_desc_size);
 	if (bh)
 		*bh = sbi->s_group_desc[group_desc];
 
-	return desc + offset;
+	return desc;
 }
 
 /*
@@ -46,124 +51,452 @@ static struct buffer_head *ext2_read_block_bitmap(struct super_block *sb, uint32
 }
 
 /*
- * Create a new Ext2 block (try goal block first).
+ * Get length of free run around a range of a block bitmap (range bits may be set or not).
  */
-int ext2_new_block(struct inode *inode, uint32_t goal)
+static uint32_t ext2_free_run_around(const char *map, uint32_t size, uint32_t bit, uint32_t count)
 {
-	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
-	struct buffer_head *gdp_bh, *bitmap_bh;
-	struct ext2_group_desc *gdp;
-	int grp_alloc_block, bgi;
-	uint32_t group_no;
+	return ext2_find_next_set_bit(map, size, bit + count) - (ext2_find_prev_set_bit(map, bit) + 1);
+}
 
-	/* adjust goal block */
-	if (goal < le32toh(sbi->s_es->s_first_data_block) || goal >= le32toh(sbi->s_es->s_blocks_count))
-		goal = sbi->s_es->s_first_data_block;
+/*
+ * Update largest free run summary of a group after blocks allocation (bits are set) or release (bits are cleared).
+ */
+static void ext2_update_max_free_run(struct super_block *sb, uint32_t group_no, const char *map, uint32_t bit, uint32_t count,
+				     int alloc)
+{
+	uint32_t *max_run = &ext2_sb(sb)->s_max_free_runs[group_no], size = ext2_group_nr_blocks(sb, group_no), len;
 
-	/* try to find a group with free blocks (start with goal group) */
-	group_no = (goal - le32toh(sbi->s_es->s_first_data_block)) / sbi->s_blocks_per_group;
-	for (bgi = 0; bgi < sbi->s_groups_count; bgi++, group_no++) {
-		/* rewind to first group if needed */
-		if (group_no >= sbi->s_groups_count)
-			group_no = 0;
+	/* length of free run before allocation or after release */
+	len = ext2_free_run_around(map, size, bit, count);
 
-		/* get group descriptor */
-		gdp = ext2_get_group_desc(inode->i_sb, group_no, &gdp_bh);
-		if (!gdp)
-			return -EIO;
+	/* release : new run may be the largest one */
+	if (!alloc) {
+		if (len > *max_run)
+			*max_run = len;
+		return;
+	}
 
-		/* no free blocks in this group */
-		if (!le16toh(gdp->bg_free_blocks_count))
-			continue;
+	/* allocation in largest run : rescan bitmap */
+	if (len >= *max_run)
+		*max_run = ext2_max_zero_run(map, size);
+}
 
-		/* get group blocks bitmap */
-		bitmap_bh = ext2_read_block_bitmap(inode->i_sb, group_no);
-		if (!bitmap_bh)
-			return -EIO;
+/*
+ * Find reservation window containing a block.
+ */
+static struct ext2_reserve_window *ext2_rsv_find(struct ext2_sb_info *sbi, uint32_t block)
+{
+	struct ext2_reserve_window *rsv;
+	struct list_head *pos;
 
-		/* get first free block from bitmap */
-		grp_alloc_block = ext2_get_free_bitmap(inode->i_sb, bitmap_bh);
-		if (grp_alloc_block != -1 && grp_alloc_block < sbi->s_blocks_per_group)
-			goto allocated;
+	list_for_each(pos, &sbi->s_rsv_windows) {
+		rsv = list_entry(pos, struct ext2_reserve_window, rsv_list);
+		if (block >= rsv->rsv_start && block <= rsv->rsv_end)
+			return rsv;
+	}
 
-		/* release bitmap block */
-		brelse(bitmap_bh);
+	return NULL;
+}
+
+/*
+ * Get start of first reservation window after a block (or limit).
+ */
+static uint32_t ext2_rsv_next_start(struct ext2_sb_info *sbi, uint32_t block, uint32_t limit)
+{
+	struct ext2_reserve_window *rsv;
+	struct list_head *pos;
+
+	list_for_each(pos, &sbi->s_rsv_windows) {
+		rsv = list_entry(pos, struct ext2_reserve_window, rsv_list);
+		if (rsv->rsv_start > block && rsv->rsv_start < limit)
+			limit = rsv->rsv_start;
+	}
+
+	return limit;
+}
+
+/*
+ * Discard reservation window of an inode.
+ */
+void ext2_discard_reservation(struct inode *inode)
+{
+	struct ext2_reserve_window *rsv = &ext2_i(inode)->i_rsv_window;
+
+	if (!rsv->rsv_end)
+		return;
+
+	list_del(&rsv->rsv_list);
+	rsv->rsv_start = 0;
+	rsv->rsv_end = 0;
+}
+
+/*
+ * Allocate a run of blocks in a group (returns first bit or -1).
+ * With a reservation window, blocks are taken in the window, or a new window is opened outside other windows.
+ */
+static int ext2_alloc_in_group(struct inode *inode, struct ext2_reserve_window *rsv, uint32_t group_no,
+			       struct buffer_head *bitmap_bh, uint32_t start_bit, uint32_t *count)
+{
+	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
+	uint32_t first_block, size, end, bit, n, *hint;
+	struct ext2_reserve_window *other;
+
+	/* compute group size (last group may be smaller) */
+	first_block = ext2_group_first_block_no(inode->i_sb, group_no);
+	size = ext2_group_nr_blocks(inode->i_sb, group_no);
+
+	/* move next free hint (all blocks before it are used) */
+	hint = &sbi->s_free_hints[group_no];
+	*hint = ext2_find_next_zero_bit(bitmap_bh->b_data, size, *hint);
+	if (*hint >= size)
+		return -1;
+
+	/* don't search before hint */
+	if (start_bit < *hint)
+		start_bit = *hint;
+
+	/* no reservation : take first run of wanted size after goal, else first free block */
+	if (!rsv) {
+		bit = ext2_find_zero_run(bitmap_bh->b_data, size, start_bit, *count);
+		if (bit >= size)
+			bit = ext2_find_next_zero_bit(bitmap_bh->b_data, size, start_bit);
+		if (bit >= size)
+			return -1;
+
+		end = size;
+		goto alloc;
+	}
+
+	/* try to allocate in current window */
+	if (rsv->rsv_end && rsv->rsv_start >= first_block && rsv->rsv_end < first_block + size
+	    && first_block + start_bit <= rsv->rsv_end) {
+		bit = first_block + start_bit > rsv->rsv_start ? start_bit : rsv->rsv_start - first_block;
+		end = rsv->rsv_end - first_block + 1;
+		bit = ext2_find_next_zero_bit(bitmap_bh->b_data, end, bit);
+		if (bit < end)
+			goto alloc;
+	}
+
+	/* window used up by sequential writes : next one is twice bigger */
+	if (rsv->rsv_end && first_block + start_bit >= rsv->rsv_start && rsv->rsv_goal_size < EXT2_MAX_RESERVE_BLOCKS)
+		rsv->rsv_goal_size *= 2;
+
+	/* discard current window */
+	ext2_discard_reservation(inode);
+
+	/* find free blocks outside other windows (try to get a run of wanted size first) */
+	n = *count < rsv->rsv_goal_size ? *count : rsv->rsv_goal_size;
+	for (bit = start_bit;; bit = other->rsv_end - first_block + 1) {
+		end = ext2_find_zero_run(bitmap_bh->b_data, size, bit, n);
+		if (end >= size)
+			end = ext2_find_next_zero_bit(bitmap_bh->b_data, size, bit);
+		if (end >= size)
+			return -1;
+
+		bit = end;
+		other = ext2_rsv_find(sbi, first_block + bit);
+		if (!other)
+			break;
+	}
+
+	/* open a new window (stop at next window or at group end) */
+	n = rsv->rsv_goal_size > *count ? rsv->rsv_goal_size : *count;
+	end = ext2_rsv_next_start(sbi, first_block + bit, first_block + size) - first_block;
+	if (end > bit + n)
+		end = bit + n;
+	rsv->rsv_start = first_block + bit;
+	rsv->rsv_end = first_block + end - 1;
+	list_add(&rsv->rsv_list, &sbi->s_rsv_windows);
+
+alloc:
+	/* take contiguous free blocks */
+	if (end > bit + *count)
+		end = bit + *count;
+	*count = ext2_find_next_set_bit(bitmap_bh->b_data, end, bit) - bit;
+
+	/* set blocks in bitmap */
+	for (n = 0; n < *count; n++)
+		EXT2_BITMAP_SET(bitmap_bh, bit + n);
+
+	/* update next free hint */
+	if (bit == *hint)
+		*hint += *count;
+
+	return bit;
+}
+
+/*
+ * Create new contiguous Ext2 blocks (try goal block first).
+ * On input count is the number of wanted blocks, on output the number of allocated blocks. Returns first block or 0.
+ */
+uint32_t ext2_new_blocks(struct inode *inode, uint32_t goal, uint32_t *count)
+{
+	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
+	struct ext2_reserve_window *rsv = NULL;
+	struct buffer_head *gdp_bh, *bitmap_bh;
+	uint32_t group_no, start_bit, bgi;
+	struct ext2_group_desc *gdp;
+	int bit, pass;
+
+	/* adjust goal block */
+	if (goal < le32toh(sbi->s_es->s_first_data_block) || goal >= le32toh(sbi->s_es->s_blocks_count))
+		goal = le32toh(sbi->s_es->s_first_data_block);
+
+	/* only regular files use reservation windows */
+	if (S_ISREG(inode->i_mode))
+		rsv = &ext2_i(inode)->i_rsv_window;
+
+	/* first pass respects reservation windows and skips groups without a free run of wanted size, second pass ignores them */
+	for (pass = rsv || sbi->s_max_free_runs ? 0 : 1; pass < 2; pass++) {
+		group_no = (goal - le32toh(sbi->s_es->s_first_data_block)) / sbi->s_blocks_per_group;
+		start_bit = (goal - le32toh(sbi->s_es->s_first_data_block)) % sbi->s_blocks_per_group;
+
+		/* try to find a group with free blocks (start with goal group, come back to its beginning at the end) */
+		for (bgi = 0; bgi <= sbi->s_groups_count; bgi++, group_no++, start_bit = 0) {
+			/* rewind to first group if needed */
+			if (group_no >= sbi->s_groups_count)
+				group_no = 0;
+
+			/* get group descriptor */
+			gdp = ext2_get_group_desc(inode->i_sb, group_no, &gdp_bh);
+			if (!gdp)
+				return 0;
+
+			/* no free blocks in this group */
+			if (!le16toh(gdp->bg_free_blocks_count))
+				continue;
+
+			/* groups without a free run of wanted size are left to second pass (their bitmap is not read) */
+			if (!pass && sbi->s_max_free_runs
+			    && sbi->s_max_free_runs[group_no] < (*count < EXT2_MAX_RESERVE_BLOCKS ? *count : EXT2_MAX_RESERVE_BLOCKS))
+				continue;
+
+			/* get group blocks bitmap */
+			bitmap_bh = ext2_read_block_bitmap(inode->i_sb, group_no);
+			if (!bitmap_bh)
+				return 0;
+
+			/* allocate blocks */
+			bit = ext2_alloc_in_group(inode, pass ? NULL : rsv, group_no, bitmap_bh, start_bit, count);
+			if (bit >= 0)
+				goto allocated;
+
+			/* release bitmap block */
+			brelse(bitmap_bh);
+		}
 	}
 
 	return 0;
 allocated:
-	/* set block in bitmap */
-	EXT2_BITMAP_SET(bitmap_bh, grp_alloc_block);
+	/* update group summary */
+	if (sbi->s_max_free_runs)
+		ext2_update_max_free_run(inode->i_sb, group_no, bitmap_bh->b_data, bit, *count, 1);
 
 	/* release block bitmap */
 	bitmap_bh->b_dirt = 1;
 	brelse(bitmap_bh);
 
-	/* update group descriptor */
-	gdp->bg_free_blocks_count = htole16(le16toh(gdp->bg_free_blocks_count) - 1);
+	/* update group descriptor (written at sync) */
+	gdp->bg_free_blocks_count = htole16(le16toh(gdp->bg_free_blocks_count) - *count);
 	gdp_bh->b_dirt = 1;
-	bwrite(gdp_bh);
 
-	/* update super block */
-	sbi->s_es->s_free_blocks_count = htole32(le32toh(sbi->s_es->s_free_blocks_count) - 1);
-	sbi->s_sbh->b_dirt = 1;
-	bwrite(sbi->s_sbh);
+	/* update free blocks counter */
+	sbi->s_free_blocks_count -= *count;
 
-	/* mark inode dirty */
+	/* update inode blocks count (in 512 bytes sectors) and mark it dirty */
+	inode->i_blocks += *count << (inode->i_sb->s_blocksize_bits - 9);
 	inode->i_dirt = 1;
 
 	/* compute global position of block */
-	return grp_alloc_block + ext2_group_first_block_no(inode->i_sb, group_no);
+	return bit + ext2_group_first_block_no(inode->i_sb, group_no);
 }
 
 /*
- * Free a Ext2 block.
+ * Clear a range of bits in a bitmap (whole bytes at once).
  */
-int ext2_free_block(struct inode *inode, uint32_t block)
+static void ext2_clear_bits(char *map, uint32_t start, uint32_t len)
 {
-	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
-	struct buffer_head *bitmap_bh, *gdp_bh, *bh;
+	uint32_t end = start + len;
+
+	/* clear leading bits */
+	for (; start < end && start % 8; start++)
+		map[start / 8] &= ~(0x1 << (start % 8));
+
+	/* clear whole bytes */
+	if (end - start >= 8) {
+		memset(map + start / 8, 0, (end - start) / 8);
+		start += (end - start) & ~7;
+	}
+
+	/* clear trailing bits */
+	for (; start < end; start++)
+		map[start / 8] &= ~(0x1 << (start % 8));
+}
+
+/*
+ * Punch freed blocks out of image (if mounted with discard).
+ */
+void ext2_discard_blocks(struct super_block *sb, uint32_t block, uint32_t count)
+{
+	if (ext2_sb(sb)->s_mount_opt & EXT2_MOUNT_DISCARD)
+		fallocate(sb->s_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) block * sb->s_blocksize, (off_t) count * sb->s_blocksize);
+}
+
+/*
+ * Release a range of Ext2 blocks : clear bitmap group by group and update free hints and counters.
+ */
+int ext2_release_blocks(struct super_block *sb, uint32_t block, uint32_t count)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct buffer_head *bitmap_bh, *gdp_bh;
 	struct ext2_group_desc *gdp;
-	uint32_t block_group, bit;
+	uint32_t block_group, bit, n;
+
+	while (count > 0) {
+		/* get block group and number of blocks to free in this group */
+		block_group = (block - le32toh(sbi->s_es->s_first_data_block)) / sbi->s_blocks_per_group;
+		bit = (block - le32toh(sbi->s_es->s_first_data_block)) % sbi->s_blocks_per_group;
+		n = sbi->s_blocks_per_group - bit < count ? sbi->s_blocks_per_group - bit : count;
+
+		/* get block bitmap */
+		bitmap_bh = ext2_read_block_bitmap(sb, block_group);
+		if (!bitmap_bh)
+			return -EIO;
+
+		/* clear blocks in bitmap and update group summary */
+		ext2_clear_bits(bitmap_bh->b_data, bit, n);
+		if (sbi->s_max_free_runs)
+			ext2_update_max_free_run(sb, block_group, bitmap_bh->b_data, bit, n, 0);
+		bitmap_bh->b_dirt = 1;
+		brelse(bitmap_bh);
+
+		/* update next free hint */
+		if (bit < sbi->s_free_hints[block_group])
+			sbi->s_free_hints[block_group] = bit;
+
+		/* update group descriptor (written at sync) */
+		gdp = ext2_get_group_desc(sb, block_group, &gdp_bh);
+		gdp->bg_free_blocks_count = htole16(le16toh(gdp->bg_free_blocks_count) + n);
+		gdp_bh->b_dirt = 1;
+
+		/* update free blocks counter */
+		sbi->s_free_blocks_count += n;
+
+		/* next group */
+		block += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Free a range of Ext2 blocks (freed blocks are neither read nor zeroed).
+ * On a journaled file system, blocks stay allocated until the freeing transaction is committed :
+ * reusing them before would overwrite blocks still referenced by the last committed state.
+ */
+int ext2_free_blocks(struct inode *inode, uint32_t block, uint32_t count)
+{
+	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
+	uint32_t nr_sectors;
 
-	/* check block number */
-	if (block < le32toh(sbi->s_es->s_first_data_block) || block >= le32toh(sbi->s_es->s_blocks_count)) {
-		fprintf(stderr, "Ext2 : trying to free block %d not in data zone\n", block);
+	/* check blocks range */
+	if (block < le32toh(sbi->s_es->s_first_data_block) || block >= le32toh(sbi->s_es->s_blocks_count)
+	    || count > le32toh(sbi->s_es->s_blocks_count) - block) {
+		fprintf(stderr, "Ext2 : trying to free blocks %d-%d not in data zone\n", block, block + count - 1);
 		return -EINVAL;
 	}
 
-	/* clear block buffer */
-	bh = sb_bread(inode->i_sb, block);
-	if (bh) {
-		memset(bh->b_data, 0, bh->b_size);
-		bh->b_dirt = 1;
-		brelse(bh);
+	/* update inode blocks count (in 512 bytes sectors) and mark it dirty */
+	nr_sectors = count << (inode->i_sb->s_blocksize_bits - 9);
+	inode->i_blocks = inode->i_blocks >= nr_sectors ? inode->i_blocks - nr_sectors : 0;
+	inode->i_dirt = 1;
+
+	/* journaled : logged copies of freed blocks must not be replayed and blocks are released at commit */
+	if (sbi->s_journal) {
+		ext2_journal_revoke(inode->i_sb, block, count);
+		return ext2_journal_free_blocks(inode->i_sb, block, count);
 	}
 
-	/* get block group */
-	block_group = (block - le32toh(sbi->s_es->s_first_data_block)) / sbi->s_blocks_per_group;
-	bit = (block - le32toh(sbi->s_es->s_first_data_block)) % sbi->s_blocks_per_group;
+	/* punch freed blocks out of image and release them */
+	ext2_discard_blocks(inode->i_sb, block, count);
+	return ext2_release_blocks(inode->i_sb, block, count);
+}
 
-	/* get block bitmap */
-	bitmap_bh = ext2_read_block_bitmap(inode->i_sb, block_group);
-	if (!bitmap_bh)
-		return -EIO;
+/*
+ * Ask the kernel to read bitmaps of a chunk of groups in background (while previous chunk is scanned).
+ */
+static void ext2_preload_advise(struct super_block *sb, uint32_t first, uint32_t nr)
+{
+	struct ext2_group_desc *gdp;
+	uint32_t group;
 
-	/* clear block in bitmap */
-	EXT2_BITMAP_CLR(bitmap_bh, bit);
-	bitmap_bh->b_dirt = 1;
-	brelse(bitmap_bh);
+	for (group = first; group < first + nr && group < ext2_sb(sb)->s_groups_count; group++) {
+		gdp = ext2_get_group_desc(sb, group, NULL);
+		if (!gdp)
+			return;
 
-	/* update group descriptor */
-	gdp = ext2_get_group_desc(inode->i_sb, block_group, &gdp_bh);
-	gdp->bg_free_blocks_count = htole16(le16toh(gdp->bg_free_blocks_count) + 1);
-	gdp_bh->b_dirt = 1;
-	bwrite(gdp_bh);
+		posix_fadvise(sb->s_fd, (off_t) le32toh(gdp->bg_block_bitmap) * sb->s_blocksize, sb->s_blocksize, POSIX_FADV_WILLNEED);
+		posix_fadvise(sb->s_fd, (off_t) le32toh(gdp->bg_inode_bitmap) * sb->s_blocksize, sb->s_blocksize, POSIX_FADV_WILLNEED);
+	}
+}
+
+/*
+ * Preload blocks and inodes bitmaps of all groups and build their largest free run summary (preload mount option).
+ * Bitmaps are read chunk by chunk with sorted contiguous reads, last chunks stay in buffer cache.
+ */
+int ext2_preload_bitmaps(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	uint32_t first, group, nr, *blocks;
+	struct ext2_group_desc *gdp;
+	struct buffer_head *bh;
+	int nr_blocks, err = 0;
+
+	/* allocate summaries and bitmap blocks array */
+	sbi->s_max_free_runs = (uint32_t *) malloc(sizeof(uint32_t) * sbi->s_groups_count);
+	blocks = (uint32_t *) malloc(sizeof(uint32_t) * 2 * EXT2_PRELOAD_CHUNK);
+	if (!sbi->s_max_free_runs || !blocks) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-	/* update super block */
-	sbi->s_es->s_free_blocks_count = htole32(le32toh(sbi->s_es->s_free_blocks_count) + 1);
-	sbi->s_sbh->b_dirt = 1;
-	bwrite(sbi->s_sbh);
+	/* announce first chunk */
+	ext2_preload_advise(sb, 0, EXT2_PRELOAD_CHUNK);
+
+	for (first = 0; first < sbi->s_groups_count; first += nr) {
+		nr = sbi->s_groups_count - first < EXT2_PRELOAD_CHUNK ? sbi->s_groups_count - first : EXT2_PRELOAD_CHUNK;
+
+		/* announce next chunk */
+		ext2_preload_advise(sb, first + nr, EXT2_PRELOAD_CHUNK);
+
+		/* read bitmaps of this chunk */
+		for (group = first, nr_blocks = 0; group < first + nr; group++) {
+			gdp = ext2_get_group_desc(sb, group, NULL);
+			blocks[nr_blocks++] = le32toh(gdp->bg_block_bitmap);
+			blocks[nr_blocks++] = le32toh(gdp->bg_inode_bitmap);
+		}
+		sb_breadahead(sb, blocks, nr_blocks);
+
+		/* build summaries (and next free hints) */
+		for (group = first; group < first + nr; group++) {
+			bh = ext2_read_block_bitmap(sb, group);
+			if (!bh) {
+				err = -EIO;
+				goto out;
+			}
+
+			sbi->s_max_free_runs[group] = ext2_max_zero_run(bh->b_data, ext2_group_nr_blocks(sb, group));
+			sbi->s_free_hints[group] = ext2_find_next_zero_bit(bh->b_data, ext2_group_nr_blocks(sb, group), 0);
+			brelse(bh);
+		}
+	}
 
-	return 0;
+out:
+	if (err) {
+		free(sbi->s_max_free_runs);
+		sbi->s_max_free_runs = NULL;
+	}
+	free(blocks);
+	return err;
 }
@@ -0,0 +1,162 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ext2.h"
+
+#define EXT2_DEFRAG_THROTTLE_BLOCKS	64		/* blocks copied between two throttle checks */
+
+/*
+ * Count contiguous runs of physical blocks of a Ext2 inode (holes are skipped).
+ */
+static uint32_t ext2_defrag_count_extents(struct inode *inode, uint32_t nr_blocks, uint32_t *nr_data_blocks)
+{
+	uint32_t block, phys, last = 0, nr_extents = 0;
+
+	for (block = 0, *nr_data_blocks = 0; block < nr_blocks; block++) {
+		phys = ext2_bmap(inode, block);
+		if (!phys)
+			continue;
+
+		if (phys != last + 1)
+			nr_extents++;
+
+		last = phys;
+		(*nr_data_blocks)++;
+	}
+
+	return nr_extents;
+}
+
+/*
+ * Sleep to keep copy throughput under rate (bytes per second).
+ */
+static void ext2_defrag_throttle(struct timespec *start, uint64_t copied, uint64_t rate)
+{
+	struct timespec now, delay;
+	int64_t elapsed_ns, expected_ns;
+
+	if (!rate)
+		return;
+
+	/* compare elapsed time with time copy should have taken */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ns = (now.tv_sec - start->tv_sec) * 1000000000LL + (now.tv_nsec - start->tv_nsec);
+	expected_ns = copied * 1000000000ULL / rate;
+	if (expected_ns <= elapsed_ns)
+		return;
+
+	delay.tv_sec = (expected_ns - elapsed_ns) / 1000000000LL;
+	delay.tv_nsec = (expected_ns - elapsed_ns) % 1000000000LL;
+	nanosleep(&delay, NULL);
+}
+
+/*
+ * Defragment a Ext2 file : data is copied through buffer cache to blocks allocated by runs in a donor inode,
+ * then block maps are swapped and donor (holding old blocks) is deleted.
+ */
+int ext2_defrag(struct inode *inode, struct vfs_defrag *defrag)
+{
+	uint32_t blocksize = inode->i_sb->s_blocksize, nr_blocks, nr_meta, block, len, i, data[EXT2_N_BLOCKS];
+	struct ext2_inode_info *ext2_inode = ext2_i(inode), *ext2_donor;
+	struct buffer_head *bh, *new_bh;
+	struct timespec start;
+	struct inode *donor;
+	uint64_t copied = 0;
+	uint32_t i_blocks;
+	int new, err = 0;
+
+	/* read only file system or extent mapped file */
+	if (ext2_rdonly(inode->i_sb))
+		return -EROFS;
+	if (ext2_inode_has_extents(inode))
+		return -EOPNOTSUPP;
+
+	/* count contiguous runs */
+	nr_blocks = (inode->i_size + blocksize - 1) / blocksize;
+	defrag->nr_extents = ext2_defrag_count_extents(inode, nr_blocks, &defrag->nr_blocks);
+	defrag->nr_extents_new = defrag->nr_extents;
+
+	/* check only or file is contiguous (each indirect block stored between data blocks breaks a run once) */
+	nr_meta = (inode->i_blocks >> (inode->i_sb->s_blocksize_bits - 9)) - defrag->nr_blocks;
+	if (defrag->check || defrag->nr_extents <= 1 + nr_meta)
+		return 0;
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(inode->i_sb);
+
+	/* create donor inode near file (never linked : a crash leaves an orphan inode, not a second copy) */
+	donor = ext2_new_inode(inode, S_IFREG | (inode->i_mode & 07777));
+	if (!donor)
+		return -ENOSPC;
+	donor->i_op = &ext2_file_iops;
+	donor->i_nlinks = 0;
+	ext2_donor = ext2_i(donor);
+
+	/* copy data runs (a run is allocated at once in donor) */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (block = 0; block < nr_blocks; block += len) {
+		/* each run is an operation (donor is never linked, so a commit between runs only logs an orphan copy) */
+		ext2_journal_start(inode->i_sb);
+
+		/* skip holes */
+		for (len = 0; block + len < nr_blocks && ext2_bmap(inode, block + len); len++);
+		if (!len) {
+			len = 1;
+			continue;
+		}
+
+		for (i = 0; i < len; i++) {
+			/* read old block and get new one */
+			bh = ext2_bread(inode, block + i, 0);
+			new_bh = bh ? ext2_getblk(donor, block + i, len - i, &new) : NULL;
+			if (!new_bh) {
+				err = bh ? -ENOSPC : -EIO;
+				brelse(bh);
+				goto out;
+			}
+
+			/* copy data and write it in place (before the transaction referencing it is committed) */
+			memcpy(new_bh->b_data, bh->b_data, blocksize);
+			new_bh->b_uptodate = 1;
+			new_bh->b_dirt = 1;
+			bwrite(new_bh);
+			brelse(new_bh);
+			brelse(bh);
+
+			/* throttle copy */
+			copied += blocksize;
+			if ((copied / blocksize) % EXT2_DEFRAG_THROTTLE_BLOCKS == 0)
+				ext2_defrag_throttle(&start, copied, defrag->rate);
+		}
+	}
+
+	/* keep file if it is not less fragmented */
+	defrag->nr_extents_new = ext2_defrag_count_extents(donor, nr_blocks, &len);
+	if (defrag->nr_extents_new >= defrag->nr_extents) {
+		defrag->nr_extents_new = defrag->nr_extents;
+		goto out;
+	}
+
+	/* swap block maps and blocks counts (file gets new blocks, donor gets old ones) in one transaction */
+	ext2_journal_start(inode->i_sb);
+	memcpy(data, ext2_inode->i_data, sizeof(data));
+	memcpy(ext2_inode->i_data, ext2_donor->i_data, sizeof(data));
+	memcpy(ext2_donor->i_data, data, sizeof(data));
+	i_blocks = inode->i_blocks;
+	inode->i_blocks = donor->i_blocks;
+	donor->i_blocks = i_blocks;
+
+	/* invalidate cached mappings and pinned indirect blocks */
+	ext2_extent_truncate(inode, 0);
+	ext2_extent_truncate(donor, 0);
+	ext2_discard_reservation(inode);
+	ext2_pin_reload(inode);
+	inode->i_dirt = 1;
+
+out:
+	/* delete donor (and blocks it holds) */
+	donor->i_dirt = 1;
+	vfs_iput(donor);
+	return err;
+}
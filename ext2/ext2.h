@@ -27,12 +27,96 @@
 #define EXT2_TIND_BLOCK				(EXT2_DIND_BLOCK + 1)
 #define EXT2_N_BLOCKS				(EXT2_TIND_BLOCK + 1)
 
+#define EXT2_EXTENT_CACHE_SIZE			32
+
+#define EXT2_FEATURE_COMPAT_HAS_JOURNAL		0x0004
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
+#define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
+#define EXT2_FEATURE_INCOMPAT_RECOVER		0x0004
+#define EXT2_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
+#define EXT4_FEATURE_INCOMPAT_EXTENTS		0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT		0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP		0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG		0x0200
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED		0x2000
+
+/* supported features (ext4 features and unknown read only compatible features are only supported read only) */
+#define EXT2_FEATURE_RO_COMPAT_SUPP		(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+#define EXT2_FEATURE_INCOMPAT_SUPP		(EXT2_FEATURE_INCOMPAT_FILETYPE | EXT2_FEATURE_INCOMPAT_RECOVER)
+#define EXT2_FEATURE_INCOMPAT_RO_SUPP		(EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_MMP \
+						 | EXT4_FEATURE_INCOMPAT_FLEX_BG | EXT4_FEATURE_INCOMPAT_CSUM_SEED)
+
+#define EXT2_MIN_DESC_SIZE			32
+#define EXT2_MAX_DESC_SIZE			1024
+
+#define EXT2_FT_UNKNOWN				0
+#define EXT2_FT_REG_FILE			1
+#define EXT2_FT_DIR				2
+#define EXT2_FT_CHRDEV				3
+#define EXT2_FT_BLKDEV				4
+#define EXT2_FT_FIFO				5
+#define EXT2_FT_SOCK				6
+#define EXT2_FT_SYMLINK				7
+#define EXT2_FT_MAX				8
+
+#define EXT2_INDEX_FL				0x00001000	/* hash indexed directory */
+#define EXT2_TOPDIR_FL				0x00020000	/* top of directory hierarchies (spread sub directories) */
+#define EXT4_EXTENTS_FL				0x00080000	/* blocks mapped by an extent tree */
+
+#define EXT4_EXT_MAGIC				0xF30A
+#define EXT4_EXT_MAX_DEPTH			5
+#define EXT4_EXT_INIT_MAX_LEN			32768		/* longer extents are uninitialized (read as zeros) */
+
+#define EXT2_FLAGS_SIGNED_HASH			0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH		0x0002
+
+#define EXT2_HASH_LEGACY			0
+#define EXT2_HASH_HALF_MD4			1
+#define EXT2_HASH_TEA				2
+#define EXT2_HASH_LEGACY_UNSIGNED		3
+#define EXT2_HASH_HALF_MD4_UNSIGNED		4
+#define EXT2_HASH_TEA_UNSIGNED			5
+
+#define EXT2_HTREE_EOF				0x7FFFFFFF
+#define EXT2_HTREE_MAX_LEVELS			2
+
+#define EXT2_MOUNT_DISCARD			0x0001		/* punch freed blocks out of image */
+#define EXT2_MOUNT_RDONLY			0x0002		/* read only (asked or ext4 features) */
+#define EXT2_MOUNT_PRELOAD			0x0004		/* preload bitmaps and build free runs summaries at mount */
+#define EXT2_MOUNT_PIN_INDIRECT			0x0008		/* pin indirect blocks of opened files */
+
+#define EXT2_JOURNAL_MAGIC			0xC03B3998
+#define EXT2_JOURNAL_DESCRIPTOR_BLOCK		1
+#define EXT2_JOURNAL_COMMIT_BLOCK		2
+#define EXT2_JOURNAL_SUPERBLOCK_V1		3
+#define EXT2_JOURNAL_SUPERBLOCK_V2		4
+#define EXT2_JOURNAL_REVOKE_BLOCK		5
+
+#define EXT2_JOURNAL_FLAG_ESCAPE		0x0001		/* block data starts with journal magic (cleared in log) */
+#define EXT2_JOURNAL_FLAG_SAME_UUID		0x0002		/* no uuid after this tag */
+#define EXT2_JOURNAL_FLAG_LAST_TAG		0x0008		/* last tag of descriptor block */
+
+#define EXT2_JOURNAL_FEATURE_INCOMPAT_REVOKE	0x0001
+#define EXT2_JOURNAL_KNOWN_INCOMPAT		EXT2_JOURNAL_FEATURE_INCOMPAT_REVOKE
+
+#define EXT2_JOURNAL_COMMIT_INTERVAL		5		/* default commit interval in seconds */
+
+#define EXT2_DEFAULT_RESERVE_BLOCKS		8
+#define EXT2_MAX_RESERVE_BLOCKS			1024
+
+#define EXT2_PRELOAD_CHUNK			(VFS_NR_BUFFER / 8)	/* groups whose bitmaps are read at once by preload */
+#define EXT2_PIN_CHUNK				(VFS_NR_BUFFER / 8)	/* indirect blocks read at once when pinning a file */
+#define EXT2_PIN_MAX_BLOCKS			65536			/* maximum number of pinned indirect blocks per file */
+
 #define EXT2_DIR_PAD				4
 #define EXT2_DIR_ROUND				(EXT2_DIR_PAD - 1)
 #define EXT2_DIR_REC_LEN(name_len)		(((name_len) + 8 + EXT2_DIR_ROUND) & ~EXT2_DIR_ROUND)
 
 #define EXT2_BITMAP_SET(bh, i)			((bh)->b_data[(i) / 8] |= (0x1 << ((i) % 8)))
 #define EXT2_BITMAP_CLR(bh, i)			((bh)->b_data[(i) / 8] &= ~(0x1 << ((i) % 8)))
+#define EXT2_BITMAP_TEST(bh, i)			((bh)->b_data[(i) / 8] & (0x1 << ((i) % 8)))
 
 
 /*
@@ -93,11 +177,19 @@ struct ext2_super_block {
 	uint32_t 	s_last_orphan;					/* Start of list of inodes to delete */
 	uint32_t 	s_hash_seed[4];					/* HTREE hash seed */
 	uint8_t		s_def_hash_version;				/* Default hash version to use */
-	uint8_t		s_reserved_char_pad;
-	uint16_t 	s_reserved_word_pad;
+	uint8_t		s_jnl_backup_type;				/* Journal backup type */
+	uint16_t 	s_desc_size;					/* Group descriptor size (64bit feature) */
 	uint32_t 	s_default_mount_opts;
 	uint32_t 	s_first_meta_bg;				/* First metablock block group */
-	uint32_t 	s_reserved[190];				/* Padding to the end of the block */
+	uint32_t	s_mkfs_time;					/* When the filesystem was created */
+	uint32_t	s_jnl_blocks[17];				/* Backup of the journal inode */
+	uint32_t	s_blocks_count_hi;				/* Blocks count high 32 bits */
+	uint32_t	s_r_blocks_count_hi;				/* Reserved blocks count high 32 bits */
+	uint32_t	s_free_blocks_hi;				/* Free blocks count high 32 bits */
+	uint16_t	s_min_extra_isize;				/* All inodes have at least # bytes */
+	uint16_t	s_want_extra_isize;				/* New inodes should reserve # bytes */
+	uint32_t	s_flags;					/* Miscellaneous flags */
+	uint32_t 	s_reserved[167];				/* Padding to the end of the block */
 };
 
 /*
@@ -134,7 +226,7 @@ struct ext2_inode {
 	uint32_t	i_block[EXT2_N_BLOCKS];	 			/* Pointers to blocks */
 	uint32_t	i_generation;					/* File version (for NFS) */
 	uint32_t	i_file_acl;					/* File ACL */
-	uint32_t	i_dir_acl;					/* Directory ACL */
+	uint32_t	i_dir_acl;					/* Directory ACL (high 32 bits of size for regular files) */
 	uint32_t	i_faddr;					/* Fragment address */
 	uint8_t	 	i_frag;						/* Fragment number */
 	uint8_t	 	i_fsize;					/* Fragment size */
@@ -144,6 +236,37 @@ struct ext2_inode {
 	uint32_t	i_reserved2;
 };
 
+/*
+ * Ext4 extent tree node header (root node is stored in inode block pointers).
+ */
+struct ext4_extent_header {
+	uint16_t	eh_magic;					/* Extent tree magic */
+	uint16_t	eh_entries;					/* Number of valid entries */
+	uint16_t	eh_max;						/* Capacity of node */
+	uint16_t	eh_depth;					/* Depth of tree below this node (0 = leaf) */
+	uint32_t	eh_generation;
+};
+
+/*
+ * Ext4 extent (leaf entry).
+ */
+struct ext4_extent {
+	uint32_t	ee_block;					/* First logical block */
+	uint16_t	ee_len;						/* Number of blocks */
+	uint16_t	ee_start_hi;					/* High 16 bits of physical block */
+	uint32_t	ee_start_lo;					/* Low 32 bits of physical block */
+};
+
+/*
+ * Ext4 extent index (index node entry).
+ */
+struct ext4_extent_idx {
+	uint32_t	ei_block;					/* First logical block covered */
+	uint32_t	ei_leaf_lo;					/* Low 32 bits of child node block */
+	uint16_t	ei_leaf_hi;					/* High 16 bits of child node block */
+	uint16_t	ei_unused;
+};
+
 /*
  * Ext2 directory entry.
  */
@@ -155,6 +278,113 @@ struct ext2_dir_entry {
 	char		d_name[EXT2_NAME_LEN];				/* File name */
 };
 
+/*
+ * Ext2 directory index root info (follows '.' and '..' entries in first block).
+ */
+struct ext2_dx_root_info {
+	uint32_t	reserved_zero;
+	uint8_t		hash_version;					/* Hash version */
+	uint8_t		info_length;					/* Length of this structure (8) */
+	uint8_t		indirect_levels;				/* Number of index nodes levels */
+	uint8_t		unused_flags;
+};
+
+/*
+ * Ext2 directory index entry (first entry holds limit and count instead of hash).
+ */
+struct ext2_dx_entry {
+	uint32_t	hash;						/* Lowest hash of block */
+	uint32_t	block;						/* Directory block */
+};
+
+/*
+ * Ext2 directory index limit and count (overlays hash of first entry).
+ */
+struct ext2_dx_countlimit {
+	uint16_t	limit;						/* Max number of entries */
+	uint16_t	count;						/* Number of entries */
+};
+
+/*
+ * Ext2 journal block header (journal structures are big endian).
+ */
+struct ext2_journal_header {
+	uint32_t	h_magic;					/* Journal magic */
+	uint32_t	h_blocktype;					/* Block type */
+	uint32_t	h_sequence;					/* Transaction id */
+};
+
+/*
+ * Ext2 journal super block.
+ */
+struct ext2_journal_super_block {
+	struct ext2_journal_header	s_header;
+	uint32_t	s_blocksize;					/* Journal block size */
+	uint32_t	s_maxlen;					/* Number of blocks in journal */
+	uint32_t	s_first;					/* First log block */
+	uint32_t	s_sequence;					/* First transaction id expected in log */
+	uint32_t	s_start;					/* First log block of log (0 = clean journal) */
+	uint32_t	s_errno;					/* Error value */
+	uint32_t	s_feature_compat;				/* Compatible feature set (V2 only) */
+	uint32_t	s_feature_incompat;				/* Incompatible feature set (V2 only) */
+	uint32_t	s_feature_ro_compat;				/* Readonly-compatible feature set (V2 only) */
+	uint8_t		s_uuid[16];					/* 128-bit uuid for journal */
+};
+
+/*
+ * Ext2 journal descriptor block tag (followed by a 16 bytes uuid if SAME_UUID flag is not set).
+ */
+struct ext2_journal_block_tag {
+	uint32_t	t_blocknr;					/* Home block number */
+	uint16_t	t_checksum;
+	uint16_t	t_flags;					/* Tag flags */
+};
+
+/*
+ * Ext2 journal revoke block header (followed by revoked block numbers).
+ */
+struct ext2_journal_revoke_header {
+	struct ext2_journal_header	r_header;
+	uint32_t	r_count;					/* Number of bytes used in block */
+};
+
+/*
+ * Range of contiguous blocks to free.
+ */
+struct ext2_free_range {
+	uint32_t			start;				/* first block */
+	uint32_t			count;				/* number of blocks */
+};
+
+/*
+ * Ext2 in memory journal (one running transaction, checkpointed as soon as it is committed).
+ */
+struct ext2_journal {
+	struct inode *			j_inode;			/* Journal inode */
+	uint32_t *			j_map;				/* Journal block to device block */
+	char *				j_sb_data;			/* Journal super block copy */
+	uint32_t			j_first;			/* First log block */
+	uint32_t			j_last;				/* Number of journal blocks */
+	uint32_t			j_head;				/* Next log block to write */
+	int				j_tail_set;			/* Is journal super block pointing to log ? */
+	uint32_t			j_sequence;			/* Running transaction id */
+	time_t				j_start_time;			/* Running transaction start time */
+	int				j_committing;			/* Commit in progress */
+	uint32_t			j_max_buffers;			/* Transaction size limit */
+	struct buffer_head **		j_buffers;			/* Running transaction buffers (pinned) */
+	uint32_t			j_nr_buffers;			/* Number of running transaction buffers */
+	uint32_t			j_size_buffers;			/* Size of buffers array */
+	uint32_t *			j_revokes;			/* Running transaction revoked blocks */
+	uint32_t			j_nr_revokes;			/* Number of revoked blocks */
+	uint32_t			j_size_revokes;			/* Size of revoked blocks array */
+	struct ext2_free_range *	j_frees;			/* Blocks freed by running transaction (released at commit) */
+	uint32_t			j_nr_frees;			/* Number of freed ranges */
+	uint32_t			j_size_frees;			/* Size of freed ranges array */
+	uint8_t *			j_in_trans;			/* Blocks of running transaction bitmap */
+	uint8_t *			j_revoked;			/* Blocks revoked by running transaction bitmap */
+	uint8_t *			j_logged;			/* Blocks logged since journal start bitmap */
+};
+
 /*
  * Ext2 in memory super block.
  */
@@ -167,10 +397,52 @@ struct ext2_sb_info {
 	uint32_t			s_desc_per_block;		/* Number of group descriptors per block */
 	uint32_t			s_groups_count;			/* Number of groups in the fs */
 	uint16_t			s_inode_size;			/* Size of inode structure */
+	uint16_t			s_desc_size;			/* Size of group descriptor */
 	uint32_t			s_first_ino;			/* First non-reserved inode */
+	uint32_t			s_mount_opt;			/* Mount options */
+	uint32_t			s_hash_seed[4];			/* Directory index hash seed */
+	int				s_def_hash_version;		/* Default directory index hash version */
+	int				s_hash_unsigned;		/* 3 if hash uses unsigned chars, 0 otherwise */
 	struct buffer_head *		s_sbh;				/* Super block buffer */
 	struct buffer_head **		s_group_desc;			/* Group descriptors buffers */
 	struct ext2_super_block *	s_es;				/* Pointer to the super block */
+	struct list_head		s_rsv_windows;			/* Blocks reservation windows */
+	uint32_t *			s_free_hints;			/* First possibly free block of each group */
+	uint32_t *			s_max_free_runs;		/* Largest free blocks run of each group (preload only) */
+	uint32_t			s_free_blocks_count;		/* Free blocks count (folded in super block at sync) */
+	uint32_t			s_free_inodes_count;		/* Free inodes count (folded in super block at sync) */
+	uint32_t			s_dirs_count;			/* Directories count */
+	uint32_t			s_commit_interval;		/* Journal commit interval in seconds */
+	struct ext2_journal *		s_journal;			/* Journal (NULL if not journaled) */
+};
+
+/*
+ * Ext2 blocks reservation window (in memory only, 0 = no window).
+ */
+struct ext2_reserve_window {
+	uint32_t			rsv_start;			/* first reserved block */
+	uint32_t			rsv_end;			/* last reserved block */
+	uint32_t			rsv_goal_size;			/* wanted window size */
+	struct list_head		rsv_list;			/* super block windows list */
+};
+
+/*
+ * Ext2 cached extent (contiguous logical to physical blocks mapping).
+ */
+struct ext2_extent {
+	uint32_t			e_block;			/* first logical block */
+	uint32_t			e_start;			/* first physical block */
+	uint32_t			e_len;				/* number of blocks */
+};
+
+/*
+ * Ext2 pinned indirect blocks (copies kept while the file is opened).
+ */
+struct ext2_pin {
+	int				p_count;			/* number of opened files */
+	uint32_t			p_nr_blocks;			/* number of pinned blocks */
+	uint32_t *			p_blocks;			/* pinned block numbers (sorted) */
+	char *				p_data;				/* arena holding pinned blocks copies */
 };
 
 /*
@@ -187,6 +459,13 @@ struct ext2_inode_info {
 	uint32_t			i_dir_acl;			/* Directory ACL */
 	uint32_t			i_dtime;			/* Deletion time */
 	uint32_t			i_generation;			/* File version (for NFS) */
+	struct ext2_extent		i_extents[EXT2_EXTENT_CACHE_SIZE];	/* Extents cache */
+	int				i_extent_next;			/* Next extent to replace */
+	int				i_extent_last;			/* Last used extent */
+	struct ext2_reserve_window	i_rsv_window;			/* Blocks reservation window */
+	uint32_t			i_ra_block;			/* last directory block whose inodes were prefetched */
+	uint32_t			i_lookup_block;			/* directory block of last lookup */
+	struct ext2_pin			i_pin;				/* pinned indirect blocks */
 	struct inode			vfs_inode;			/* VFS inode */
 };
 
@@ -202,14 +481,35 @@ extern struct file_operations ext2_dir_fops;
 int ext2_read_super(struct super_block *sb, void *data);
 void ext2_put_super(struct super_block *sb);
 int ext2_statfs(struct super_block *sb, struct statfs *buf);
+int ext2_sync_fs(struct super_block *sb);
+int ext2_commit_fs(struct super_block *sb);
+int ext2_write_buffer(struct buffer_head *bh);
+
+/* Ext2 journal prototypes */
+int ext2_journal_load(struct super_block *sb);
+void ext2_journal_release(struct super_block *sb);
+void ext2_journal_start(struct super_block *sb);
+int ext2_journal_dirty(struct buffer_head *bh);
+void ext2_journal_revoke(struct super_block *sb, uint32_t block, uint32_t count);
+int ext2_journal_free_blocks(struct super_block *sb, uint32_t block, uint32_t count);
+int ext2_journal_commit(struct super_block *sb);
 
 /* Ext2 inode prototypes */
 struct buffer_head *ext2_bread(struct inode *inode, uint32_t block, int create);
+struct buffer_head *ext2_getblk(struct inode *inode, uint32_t block, int create, int *new);
+uint32_t ext2_bmap(struct inode *inode, uint32_t block);
+uint32_t ext2_find_data_block(struct inode *inode, uint32_t block);
+void ext2_prefetch_inodes(struct inode *dir, struct buffer_head *bh);
 struct inode *ext2_alloc_inode(struct super_block *sb);
 void ext2_put_inode(struct inode *inode);
 void ext2_delete_inode(struct inode *inode);
 int ext2_read_inode(struct inode *inode);
 int ext2_write_inode(struct inode *inode);
+void ext2_extent_truncate(struct inode *inode, uint32_t block);
+
+/* Ext4 extent tree prototypes */
+uint32_t ext2_ext_get_block(struct inode *inode, uint32_t block, struct ext2_extent *run);
+uint32_t ext2_ext_find_data_block(struct inode *inode, uint32_t block);
 
 /* Ext2 inode alloc prototypes */
 struct inode *ext2_new_inode(struct inode *dir, mode_t mode);
@@ -217,12 +517,26 @@ int ext2_free_inode(struct inode *inode);
 
 /* Ext2 block alloc prototypes */
 struct ext2_group_desc *ext2_get_group_desc(struct super_block *sb, uint32_t block_group, struct buffer_head **bh);
-int ext2_new_block(struct inode *inode, uint32_t goal);
-int ext2_free_block(struct inode *inode, uint32_t block);
+uint32_t ext2_new_blocks(struct inode *inode, uint32_t goal, uint32_t *count);
+int ext2_free_blocks(struct inode *inode, uint32_t block, uint32_t count);
+int ext2_release_blocks(struct super_block *sb, uint32_t block, uint32_t count);
+void ext2_discard_blocks(struct super_block *sb, uint32_t block, uint32_t count);
+int ext2_preload_bitmaps(struct super_block *sb);
+void ext2_discard_reservation(struct inode *inode);
 
 /* Ext2 truncate prototypes */
 void ext2_truncate(struct inode *inode);
 
+/* Ext2 pinned indirect blocks prototypes */
+void ext2_pin_indirect(struct inode *inode);
+void ext2_unpin_indirect(struct inode *inode);
+void ext2_pin_reload(struct inode *inode);
+uint32_t *ext2_pin_lookup(struct inode *inode, uint32_t block);
+void ext2_pin_update(struct inode *inode, struct buffer_head *bh);
+
+/* Ext2 defragmentation prototypes */
+int ext2_defrag(struct inode *inode, struct vfs_defrag *defrag);
+
 /* Ext2 symlink prototypes */
 int ext2_follow_link(struct inode *dir, struct inode *inode, struct inode **res_inode);
 ssize_t ext2_readlink(struct inode *inode, char *buf, size_t bufsize);
@@ -237,9 +551,15 @@ int ext2_unlink(struct inode *dir, const char *name, size_t name_len);
 int ext2_symlink(struct inode *dir, const char *name, size_t name_len, const char *target);
 int ext2_rename(struct inode *old_dir, const char *old_name, size_t old_name_len, struct inode *new_dir, const char *new_name, size_t new_name_len);
 
+/* Ext2 directory index hash prototypes */
+int ext2_dirhash(const char *name, int len, int hash_version, const uint32_t *seed, uint32_t *res);
+
 /* Ext2 file prototypes */
+int ext2_file_open(struct file *filp);
+int ext2_file_close(struct file *filp);
 int ext2_file_read(struct file *filp, char *buf, int count);
 int ext2_file_write(struct file *filp, const char *buf, int count);
+off_t ext2_file_lseek(struct file *filp, off_t offset, int whence);
 int ext2_getdents64(struct file *filp, void *dirp, size_t count);
 
 /*
@@ -258,6 +578,73 @@ static inline struct ext2_inode_info *ext2_i(struct inode *inode)
 	return container_of(inode, struct ext2_inode_info, vfs_inode);
 }
 
+/*
+ * Is a Ext2 file system mounted read only ?
+ */
+static inline int ext2_rdonly(struct super_block *sb)
+{
+	return ext2_sb(sb)->s_mount_opt & EXT2_MOUNT_RDONLY;
+}
+
+/*
+ * Are inode blocks mapped by an extent tree ?
+ */
+static inline int ext2_inode_has_extents(struct inode *inode)
+{
+	return ext2_i(inode)->i_flags & EXT4_EXTENTS_FL;
+}
+
+/*
+ * Is an inode a fast symbolic link (target stored in block pointers) ?
+ */
+static inline int ext2_inode_is_fast_symlink(struct inode *inode)
+{
+	uint32_t ea_blocks = ext2_i(inode)->i_file_acl ? inode->i_sb->s_blocksize >> 9 : 0;
+
+	return S_ISLNK(inode->i_mode) && inode->i_blocks == ea_blocks;
+}
+
+/*
+ * Does file system store file types in directory entries ?
+ */
+static inline int ext2_has_filetype(struct super_block *sb)
+{
+	return le32toh(ext2_sb(sb)->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_FILETYPE;
+}
+
+/*
+ * Get directory entry file type of a mode.
+ */
+static inline uint8_t ext2_filetype(mode_t mode)
+{
+	switch (mode & S_IFMT) {
+		case S_IFREG:
+			return EXT2_FT_REG_FILE;
+		case S_IFDIR:
+			return EXT2_FT_DIR;
+		case S_IFCHR:
+			return EXT2_FT_CHRDEV;
+		case S_IFBLK:
+			return EXT2_FT_BLKDEV;
+		case S_IFIFO:
+			return EXT2_FT_FIFO;
+		case S_IFSOCK:
+			return EXT2_FT_SOCK;
+		case S_IFLNK:
+			return EXT2_FT_SYMLINK;
+		default:
+			return EXT2_FT_UNKNOWN;
+	}
+}
+
+/*
+ * Set file type of a directory entry (if file system supports it).
+ */
+static inline void ext2_set_de_type(struct super_block *sb, struct ext2_dir_entry *de, mode_t mode)
+{
+	de->d_fileype = ext2_has_filetype(sb) ? ext2_filetype(mode) : EXT2_FT_UNKNOWN;
+}
+
 /*
  * Get first block of a group descriptor.
  */
@@ -266,21 +653,143 @@ static inline uint32_t ext2_group_first_block_no(struct super_block *sb, uint32_
 	return group_no * ext2_sb(sb)->s_blocks_per_group + le32toh(ext2_sb(sb)->s_es->s_first_data_block);
 }
 
+/*
+ * Get number of blocks of a group (last group may be smaller).
+ */
+static inline uint32_t ext2_group_nr_blocks(struct super_block *sb, uint32_t group_no)
+{
+	uint32_t size = le32toh(ext2_sb(sb)->s_es->s_blocks_count) - ext2_group_first_block_no(sb, group_no);
+
+	return size < ext2_sb(sb)->s_blocks_per_group ? size : ext2_sb(sb)->s_blocks_per_group;
+}
+
+/*
+ * Find next zero bit in a bitmap, starting at offset (returns size if none).
+ */
+static inline uint32_t ext2_find_next_zero_bit(const char *map, uint32_t size, uint32_t offset)
+{
+	const uint64_t *words = (const uint64_t *) map;
+	uint64_t word;
+	uint32_t i;
+
+	if (offset >= size)
+		return size;
+
+	/* first word : ignore bits before offset */
+	i = offset / 64;
+	word = ~le64toh(words[i]) & (~0ULL << (offset % 64));
+
+	/* skip full words */
+	while (!word) {
+		if (++i * 64 >= size)
+			return size;
+		word = ~le64toh(words[i]);
+	}
+
+	offset = i * 64 + __builtin_ctzll(word);
+	return offset < size ? offset : size;
+}
+
+/*
+ * Find next set bit in a bitmap, starting at offset (returns size if none).
+ */
+static inline uint32_t ext2_find_next_set_bit(const char *map, uint32_t size, uint32_t offset)
+{
+	const uint64_t *words = (const uint64_t *) map;
+	uint64_t word;
+	uint32_t i;
+
+	if (offset >= size)
+		return size;
+
+	/* first word : ignore bits before offset */
+	i = offset / 64;
+	word = le64toh(words[i]) & (~0ULL << (offset % 64));
+
+	/* skip empty words */
+	while (!word) {
+		if (++i * 64 >= size)
+			return size;
+		word = le64toh(words[i]);
+	}
+
+	offset = i * 64 + __builtin_ctzll(word);
+	return offset < size ? offset : size;
+}
+
+/*
+ * Find last set bit in a bitmap before offset (returns -1 if none).
+ */
+static inline int64_t ext2_find_prev_set_bit(const char *map, uint32_t offset)
+{
+	const uint64_t *words = (const uint64_t *) map;
+	uint64_t word;
+	int64_t i;
+
+	if (!offset)
+		return -1;
+
+	/* last word : ignore bits at and after offset */
+	i = (offset - 1) / 64;
+	word = le64toh(words[i]) & (~0ULL >> (63 - (offset - 1) % 64));
+
+	/* skip empty words */
+	while (!word) {
+		if (--i < 0)
+			return -1;
+		word = le64toh(words[i]);
+	}
+
+	return i * 64 + 63 - __builtin_clzll(word);
+}
+
+/*
+ * Find first run of len zero bits in a bitmap, starting at offset (returns size if none).
+ */
+static inline uint32_t ext2_find_zero_run(const char *map, uint32_t size, uint32_t offset, uint32_t len)
+{
+	uint32_t start, end;
+
+	for (;;) {
+		start = ext2_find_next_zero_bit(map, size, offset);
+		if (start >= size)
+			return size;
+
+		end = ext2_find_next_set_bit(map, size, start);
+		if (end - start >= len)
+			return start;
+
+		offset = end;
+	}
+}
+
+/*
+ * Get length of longest run of zero bits in a bitmap.
+ */
+static inline uint32_t ext2_max_zero_run(const char *map, uint32_t size)
+{
+	uint32_t start, end, max = 0;
+
+	for (end = 0;; ) {
+		start = ext2_find_next_zero_bit(map, size, end);
+		if (start >= size)
+			return max;
+
+		end = ext2_find_next_set_bit(map, size, start);
+		if (end - start > max)
+			max = end - start;
+	}
+}
+
 /*
  * Get first free bit in a bitmap block.
  */
 static inline int ext2_get_free_bitmap(struct super_block *sb, struct buffer_head *bh)
 {
-	uint32_t *bits = (uint32_t *) bh->b_data;
-	register int i, j;
-
-	for (i = 0; i < bh->b_size / 4; i++)
-		if (bits[i] != 0xFFFFFFFF)
-			for (j = 0; j < 32; j++)
-				if (!(bits[i] & (0x1 << j)))
-					return 32 * i + j;
+	uint32_t bit;
 
-	return -1;
+	bit = ext2_find_next_zero_bit(bh->b_data, bh->b_size * 8, 0);
+	return bit < bh->b_size * 8 ? (int) bit : -1;
 }
 
 #endif
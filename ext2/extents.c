@@ -0,0 +1,136 @@
+#include <string.h>
+#include <errno.h>
+
+#include "ext2.h"
+
+/*
+ * Check an extent tree node header (max is the number of entries the node can hold).
+ */
+static int ext2_ext_check(struct ext4_extent_header *eh, int depth, int max)
+{
+	if (le16toh(eh->eh_magic) != EXT4_EXT_MAGIC)
+		return -EIO;
+	if (le16toh(eh->eh_depth) != depth)
+		return -EIO;
+	if (le16toh(eh->eh_max) > max || le16toh(eh->eh_entries) > le16toh(eh->eh_max))
+		return -EIO;
+
+	return 0;
+}
+
+/*
+ * Find first initialized extent ending after block in an extent tree node.
+ * Returns 0 if found, -ENOENT if there is no such extent or -EIO.
+ */
+static int ext2_ext_find(struct super_block *sb, struct ext4_extent_header *eh, int depth, int max, uint32_t block,
+			 struct ext4_extent *res)
+{
+	struct ext4_extent_idx *idx = (struct ext4_extent_idx *) (eh + 1);
+	struct ext4_extent *ext = (struct ext4_extent *) (eh + 1);
+	int entries, lo, hi, mid, i, err;
+	struct buffer_head *bh;
+	uint32_t len;
+
+	/* check node */
+	err = ext2_ext_check(eh, depth, max);
+	if (err)
+		return err;
+
+	/* binary search last entry starting at or before block (extents and indexes both start with first logical block) */
+	entries = le16toh(eh->eh_entries);
+	for (lo = 0, hi = entries - 1; lo <= hi;) {
+		mid = (lo + hi) / 2;
+		if (le32toh(depth ? idx[mid].ei_block : ext[mid].ee_block) <= block)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	i = hi < 0 ? 0 : hi;
+
+	/* leaf : skip extents ending before block and uninitialized extents (read as zeros) */
+	if (!depth) {
+		for (; i < entries; i++) {
+			len = le16toh(ext[i].ee_len);
+			if (len > EXT4_EXT_INIT_MAX_LEN || le32toh(ext[i].ee_block) + len <= block)
+				continue;
+
+			*res = ext[i];
+			return 0;
+		}
+
+		return -ENOENT;
+	}
+
+	/* index : search children (next ones only hold blocks after block) */
+	for (; i < entries; i++) {
+		if (le16toh(idx[i].ei_leaf_hi))
+			return -EIO;
+
+		bh = sb_bread(sb, le32toh(idx[i].ei_leaf_lo));
+		if (!bh)
+			return -EIO;
+
+		err = ext2_ext_find(sb, (struct ext4_extent_header *) bh->b_data, depth - 1,
+				    (bh->b_size - sizeof(struct ext4_extent_header)) / sizeof(struct ext4_extent), block, res);
+		brelse(bh);
+
+		if (err != -ENOENT)
+			return err;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Find first initialized extent ending after block of an inode.
+ */
+static int ext2_ext_find_inode(struct inode *inode, uint32_t block, struct ext4_extent *res)
+{
+	struct ext4_extent_header *eh = (struct ext4_extent_header *) ext2_i(inode)->i_data;
+	int depth = le16toh(eh->eh_depth);
+
+	/* root node is stored in inode block pointers */
+	if (depth > EXT4_EXT_MAX_DEPTH)
+		return -EIO;
+
+	return ext2_ext_find(inode->i_sb, eh, depth,
+			     (sizeof(ext2_i(inode)->i_data) - sizeof(struct ext4_extent_header)) / sizeof(struct ext4_extent),
+			     block, res);
+}
+
+/*
+ * Get physical block of an extent mapped inode block (returns 0 for a hole).
+ * run is filled with the extent containing block.
+ */
+uint32_t ext2_ext_get_block(struct inode *inode, uint32_t block, struct ext2_extent *run)
+{
+	struct ext4_extent ext;
+
+	/* find extent */
+	if (ext2_ext_find_inode(inode, block, &ext) || le32toh(ext.ee_block) > block)
+		return 0;
+
+	/* only 32 bits block numbers are handled */
+	if (le16toh(ext.ee_start_hi))
+		return 0;
+
+	run->e_block = le32toh(ext.ee_block);
+	run->e_start = le32toh(ext.ee_start_lo);
+	run->e_len = le16toh(ext.ee_len);
+
+	return run->e_start + (block - run->e_block);
+}
+
+/*
+ * Find first mapped block of an extent mapped inode at or after block.
+ * Returns (uint32_t) -1 if there is no data after block.
+ */
+uint32_t ext2_ext_find_data_block(struct inode *inode, uint32_t block)
+{
+	struct ext4_extent ext;
+
+	if (ext2_ext_find_inode(inode, block, &ext))
+		return (uint32_t) -1;
+
+	return le32toh(ext.ee_block) > block ? le32toh(ext.ee_block) : block;
+}
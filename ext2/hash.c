@@ -0,0 +1,194 @@
+#include <string.h>
+#include <errno.h>
+
+#include "ext2.h"
+
+#define TEA_DELTA		0x9E3779B9
+
+/* MD4 basic functions : selection, majority, parity */
+#define F(x, y, z)		((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z)		(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z)		((x) ^ (y) ^ (z))
+
+#define ROL32(x, s)		(((x) << (s)) | ((x) >> (32 - (s))))
+#define ROUND(f, a, b, c, d, x, s)	(a += f(b, c, d) + x, a = ROL32(a, s))
+#define K1			0
+#define K2			013240474631UL
+#define K3			015666365641UL
+
+/*
+ * TEA transform.
+ */
+static void ext2_tea_transform(uint32_t buf[4], const uint32_t in[4])
+{
+	uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += TEA_DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/*
+ * Half MD4 transform (3 rounds of 8 steps).
+ */
+static void ext2_half_md4_transform(uint32_t buf[4], const uint32_t in[8])
+{
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	/* round 1 */
+	ROUND(F, a, b, c, d, in[0] + K1,  3);
+	ROUND(F, d, a, b, c, in[1] + K1,  7);
+	ROUND(F, c, d, a, b, in[2] + K1, 11);
+	ROUND(F, b, c, d, a, in[3] + K1, 19);
+	ROUND(F, a, b, c, d, in[4] + K1,  3);
+	ROUND(F, d, a, b, c, in[5] + K1,  7);
+	ROUND(F, c, d, a, b, in[6] + K1, 11);
+	ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	/* round 2 */
+	ROUND(G, a, b, c, d, in[1] + K2,  3);
+	ROUND(G, d, a, b, c, in[3] + K2,  5);
+	ROUND(G, c, d, a, b, in[5] + K2,  9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2,  3);
+	ROUND(G, d, a, b, c, in[2] + K2,  5);
+	ROUND(G, c, d, a, b, in[4] + K2,  9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	/* round 3 */
+	ROUND(H, a, b, c, d, in[3] + K3,  3);
+	ROUND(H, d, a, b, c, in[7] + K3,  9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3,  3);
+	ROUND(H, d, a, b, c, in[5] + K3,  9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+/*
+ * Legacy hash.
+ */
+static uint32_t ext2_legacy_hash(const char *name, int len, int unsigned_chars)
+{
+	uint32_t hash, hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+	int c;
+
+	while (len--) {
+		c = unsigned_chars ? (int) *(const unsigned char *) name : (int) *(const signed char *) name;
+		name++;
+
+		hash = hash1 + (hash0 ^ (c * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7FFFFFFF;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+/*
+ * Pack a name in a hash buffer (num words, padded with length).
+ */
+static void ext2_str2hashbuf(const char *msg, int len, uint32_t *buf, int num, int unsigned_chars)
+{
+	uint32_t pad, val;
+	int i, c;
+
+	pad = (uint32_t) len | ((uint32_t) len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+
+	for (i = 0; i < len; i++) {
+		c = unsigned_chars ? (int) ((const unsigned char *) msg)[i] : (int) ((const signed char *) msg)[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+/*
+ * Compute hash of a directory entry name (used by directories index).
+ */
+int ext2_dirhash(const char *name, int len, int hash_version, const uint32_t *seed, uint32_t *res)
+{
+	uint32_t hash, in[8], buf[4];
+	int unsigned_chars = 0, i;
+
+	/* default seed */
+	buf[0] = 0x67452301;
+	buf[1] = 0xEFCDAB89;
+	buf[2] = 0x98BADCFE;
+	buf[3] = 0x10325476;
+
+	/* use file system seed if set */
+	for (i = 0; seed && i < 4; i++) {
+		if (seed[i]) {
+			memcpy(buf, seed, sizeof(buf));
+			break;
+		}
+	}
+
+	switch (hash_version) {
+		case EXT2_HASH_LEGACY_UNSIGNED:
+			unsigned_chars = 1;
+			/* fall through */
+		case EXT2_HASH_LEGACY:
+			hash = ext2_legacy_hash(name, len, unsigned_chars);
+			break;
+		case EXT2_HASH_HALF_MD4_UNSIGNED:
+			unsigned_chars = 1;
+			/* fall through */
+		case EXT2_HASH_HALF_MD4:
+			for (; len > 0; len -= 32, name += 32) {
+				ext2_str2hashbuf(name, len, in, 8, unsigned_chars);
+				ext2_half_md4_transform(buf, in);
+			}
+			hash = buf[1];
+			break;
+		case EXT2_HASH_TEA_UNSIGNED:
+			unsigned_chars = 1;
+			/* fall through */
+		case EXT2_HASH_TEA:
+			for (; len > 0; len -= 16, name += 16) {
+				ext2_str2hashbuf(name, len, in, 4, unsigned_chars);
+				ext2_tea_transform(buf, in);
+			}
+			hash = buf[0];
+			break;
+		default:
+			return -EINVAL;
+	}
+
+	/* lowest bit is used as collision marker in index, last value is reserved for end of directory */
+	hash &= ~1;
+	if (hash == (EXT2_HTREE_EOF << 1))
+		hash = (EXT2_HTREE_EOF - 1) << 1;
+
+	*res = hash;
+	return 0;
+}
@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -20,6 +21,114 @@ static struct buffer_head *ext2_read_inode_bitmap(struct super_block *sb, uint32
 	return sb_bread(sb, le32toh(gdp->bg_inode_bitmap));
 }
 
+/*
+ * Find a block group for a new directory (Orlov allocator) :
+ * - top level directories are spread in groups with above average free inodes and blocks and fewest directories
+ * - other directories stay near their parent unless its group is full of directories or short of free space
+ * Returns -1 if no group has free inodes.
+ */
+static int ext2_find_group_orlov(struct super_block *sb, struct inode *parent)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	int ngroups = sbi->s_groups_count, parent_group = ext2_i(parent)->i_block_group;
+	int avefreei, avefreeb, min_inodes, min_blocks, max_dirs, best_group = -1, best_ndir, group, i;
+	struct ext2_group_desc *gdp;
+
+	/* compute average free inodes and blocks per group */
+	avefreei = sbi->s_free_inodes_count / ngroups;
+	avefreeb = sbi->s_free_blocks_count / ngroups;
+
+	/* top level directory : spread it, starting from a random group */
+	if (parent->i_ino == EXT2_ROOT_INO || (ext2_i(parent)->i_flags & EXT2_TOPDIR_FL)) {
+		best_ndir = sbi->s_inodes_per_group;
+		for (i = 0, group = random() % ngroups; i < ngroups; i++, group = (group + 1) % ngroups) {
+			gdp = ext2_get_group_desc(sb, group, NULL);
+			if (!gdp || !le16toh(gdp->bg_free_inodes_count))
+				continue;
+			if (le16toh(gdp->bg_free_inodes_count) < avefreei || le16toh(gdp->bg_free_blocks_count) < avefreeb)
+				continue;
+			if (le16toh(gdp->bg_used_dirs_count) >= best_ndir)
+				continue;
+
+			best_ndir = le16toh(gdp->bg_used_dirs_count);
+			best_group = group;
+		}
+
+		if (best_group >= 0)
+			return best_group;
+
+		goto fallback;
+	}
+
+	/* other directory : first group near parent not too full of directories and with enough free space */
+	max_dirs = sbi->s_dirs_count / ngroups + sbi->s_inodes_per_group / 16;
+	min_inodes = avefreei - sbi->s_inodes_per_group / 4;
+	min_blocks = avefreeb - sbi->s_blocks_per_group / 4;
+	if (min_inodes < 1)
+		min_inodes = 1;
+	if (min_blocks < 1)
+		min_blocks = 1;
+
+	for (i = 0, group = parent_group; i < ngroups; i++, group = (group + 1) % ngroups) {
+		gdp = ext2_get_group_desc(sb, group, NULL);
+		if (!gdp)
+			continue;
+		if (le16toh(gdp->bg_used_dirs_count) >= max_dirs)
+			continue;
+		if (le16toh(gdp->bg_free_inodes_count) < min_inodes || le16toh(gdp->bg_free_blocks_count) < min_blocks)
+			continue;
+
+		return group;
+	}
+
+fallback:
+	/* first group near parent with average free inodes (then any free inode) */
+	for (;;) {
+		for (i = 0, group = parent_group; i < ngroups; i++, group = (group + 1) % ngroups) {
+			gdp = ext2_get_group_desc(sb, group, NULL);
+			if (gdp && le16toh(gdp->bg_free_inodes_count) && le16toh(gdp->bg_free_inodes_count) >= avefreei)
+				return group;
+		}
+
+		if (!avefreei)
+			return -1;
+		avefreei = 0;
+	}
+}
+
+/*
+ * Find a block group for a new file : parent group, then quadratic hash of parent inode, then linear search.
+ * Returns -1 if no group has free inodes.
+ */
+static int ext2_find_group_other(struct super_block *sb, struct inode *parent)
+{
+	int ngroups = ext2_sb(sb)->s_groups_count, parent_group = ext2_i(parent)->i_block_group, group, i;
+	struct ext2_group_desc *gdp;
+
+	/* try parent group */
+	gdp = ext2_get_group_desc(sb, parent_group, NULL);
+	if (gdp && le16toh(gdp->bg_free_inodes_count) && le16toh(gdp->bg_free_blocks_count))
+		return parent_group;
+
+	/* quadratic hash : spread files of different directories with full groups */
+	group = (parent_group + parent->i_ino) % ngroups;
+	for (i = 1; i < ngroups; i <<= 1) {
+		group = (group + i) % ngroups;
+		gdp = ext2_get_group_desc(sb, group, NULL);
+		if (gdp && le16toh(gdp->bg_free_inodes_count) && le16toh(gdp->bg_free_blocks_count))
+			return group;
+	}
+
+	/* linear search of a group with free inodes */
+	for (i = 0, group = parent_group; i < ngroups; i++, group = (group + 1) % ngroups) {
+		gdp = ext2_get_group_desc(sb, group, NULL);
+		if (gdp && le16toh(gdp->bg_free_inodes_count))
+			return group;
+	}
+
+	return -1;
+}
+
 /*
  * Create a new Ext2 inode.
  */
@@ -37,8 +146,15 @@ struct inode *ext2_new_inode(struct inode *dir, mode_t mode)
 	if (!inode)
 		return NULL;
 
-	/* try to find a group with free inodes (start with directory block group) */
-	group_no = ext2_i(dir)->i_block_group;
+	/* choose a group (directories are spread, files stay near their parent) */
+	i = S_ISDIR(mode) ? ext2_find_group_orlov(dir->i_sb, dir) : ext2_find_group_other(dir->i_sb, dir);
+	if (i < 0) {
+		vfs_iput(inode);
+		return NULL;
+	}
+
+	/* try to find a group with free inodes (start with chosen group) */
+	group_no = i;
 	for (bgi = 0; bgi < sbi->s_groups_count; bgi++, group_no++) {
 		/* rewind to first group if needed */
 		if (group_no >= sbi->s_groups_count)
@@ -95,7 +211,7 @@ allocated:
 	inode->i_ref = 1;
 	inode->i_dirt = 1;
 	ext2_i(inode)->i_block_group = group_no;
-	ext2_i(inode)->i_flags = ext2_i(dir)->i_flags;
+	ext2_i(inode)->i_flags = ext2_i(dir)->i_flags & ~EXT2_INDEX_FL;
 	ext2_i(inode)->i_faddr = 0;
 	ext2_i(inode)->i_frag_no = 0;
 	ext2_i(inode)->i_frag_size = 0;
@@ -113,15 +229,14 @@ allocated:
 
 	/* update group descriptor */
 	gdp->bg_free_inodes_count = htole16(le16toh(gdp->bg_free_inodes_count) - 1);
-	if (S_ISDIR(inode->i_mode))
+	if (S_ISDIR(inode->i_mode)) {
 		gdp->bg_used_dirs_count = htole16(le16toh(gdp->bg_used_dirs_count) + 1);
+		sbi->s_dirs_count++;
+	}
 	gdp_bh->b_dirt = 1;
-	bwrite(gdp_bh);
 
-	/* update super block */
-	sbi->s_es->s_free_inodes_count = htole32(le32toh(sbi->s_es->s_free_inodes_count) - 1);
-	sbi->s_sbh->b_dirt = 1;
-	bwrite(sbi->s_sbh);
+	/* update free inodes counter */
+	sbi->s_free_inodes_count--;
 
 	/* mark inode dirty */
 	inode->i_dirt = 1;
@@ -175,15 +290,14 @@ int ext2_free_inode(struct inode *inode)
 	/* update group descriptor */
 	gdp = ext2_get_group_desc(inode->i_sb, block_group, &gdp_bh);
 	gdp->bg_free_inodes_count = htole16(le16toh(gdp->bg_free_inodes_count) + 1);
-	if (S_ISDIR(inode->i_mode))
+	if (S_ISDIR(inode->i_mode)) {
 		gdp->bg_used_dirs_count = htole16(le16toh(gdp->bg_used_dirs_count) - 1);
+		sbi->s_dirs_count--;
+	}
 	gdp_bh->b_dirt = 1;
-	bwrite(gdp_bh);
 
-	/* update super block */
-	sbi->s_es->s_free_inodes_count = htole32(le32toh(sbi->s_es->s_free_inodes_count) + 1);
-	sbi->s_sbh->b_dirt = 1;
-	bwrite(sbi->s_sbh);
+	/* update free inodes counter */
+	sbi->s_free_inodes_count++;
 
 	return 0;
 }
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "ext2.h"
@@ -7,8 +8,11 @@
  * Ext2 file operations.
  */
 struct file_operations ext2_file_fops = {
+	.open			= ext2_file_open,
+	.close			= ext2_file_close,
 	.read			= ext2_file_read,
 	.write			= ext2_file_write,
+	.lseek			= ext2_file_lseek,
 };
 
 /*
@@ -24,6 +28,7 @@ struct file_operations ext2_dir_fops = {
 struct inode_operations ext2_file_iops = {
 	.fops			= &ext2_file_fops,
 	.truncate		= ext2_truncate,
+	.defrag			= ext2_defrag,
 };
 
 /*
@@ -67,6 +72,24 @@ struct inode *ext2_alloc_inode(struct super_block *sb)
 	for (i = 0; i < 15; i++)
 		ext2_inode->i_data[i] = 0;
 
+	/* reset extents cache */
+	memset(ext2_inode->i_extents, 0, sizeof(ext2_inode->i_extents));
+	ext2_inode->i_extent_next = 0;
+	ext2_inode->i_extent_last = 0;
+
+	/* reset reservation window */
+	ext2_inode->i_rsv_window.rsv_start = 0;
+	ext2_inode->i_rsv_window.rsv_end = 0;
+	ext2_inode->i_rsv_window.rsv_goal_size = EXT2_DEFAULT_RESERVE_BLOCKS;
+	INIT_LIST_HEAD(&ext2_inode->i_rsv_window.rsv_list);
+
+	/* reset directory scan state */
+	ext2_inode->i_ra_block = 0;
+	ext2_inode->i_lookup_block = 0;
+
+	/* reset pinned indirect blocks */
+	memset(&ext2_inode->i_pin, 0, sizeof(struct ext2_pin));
+
 	return &ext2_inode->vfs_inode;
 }
 
@@ -81,6 +104,9 @@ void ext2_put_inode(struct inode *inode)
 	/* unhash inode */
 	htable_delete(&inode->i_htable);
 
+	/* release reservation window */
+	ext2_discard_reservation(inode);
+
 	/* free inode */
 	free(ext2_i(inode));
 }
@@ -90,8 +116,8 @@ void ext2_put_inode(struct inode *inode)
  */
 void ext2_delete_inode(struct inode *inode)
 {
-	/* check inode */
-	if (!inode)
+	/* check inode (nothing is freed on a read only file system) */
+	if (!inode || ext2_rdonly(inode->i_sb))
 		return;
 
 	/* truncate an free inode */
@@ -115,8 +141,9 @@ int ext2_read_inode(struct inode *inode)
 	struct buffer_head *bh;
 	int i;
 
-	/* check inode number */
-	if ((inode->i_ino != EXT2_ROOT_INO && inode->i_ino < sbi->s_first_ino) || inode->i_ino > le32toh(sbi->s_es->s_inodes_count))
+	/* check inode number (root and journal are the only reserved inodes used) */
+	if ((inode->i_ino != EXT2_ROOT_INO && inode->i_ino != le32toh(sbi->s_es->s_journal_inum) && inode->i_ino < sbi->s_first_ino)
+	    || inode->i_ino > le32toh(sbi->s_es->s_inodes_count))
 		return -EINVAL;
 
 	/* get group descriptor */
@@ -160,8 +187,17 @@ int ext2_read_inode(struct inode *inode)
 	ext2_inode->i_dtime = le32toh(raw_inode->i_dtime);
 	ext2_inode->i_generation = le32toh(raw_inode->i_generation);
 	ext2_inode->i_block_group = block_group;
-	for (i = 0; i < EXT2_N_BLOCKS; i++)
-		ext2_inode->i_data[i] = le32toh(raw_inode->i_block[i]);
+
+	/* regular files : high 32 bits of size */
+	if (S_ISREG(inode->i_mode))
+		inode->i_size |= (off_t) ext2_inode->i_dir_acl << 32;
+
+	/* fast symlink or extent tree : block pointers hold target or extent tree root (keep bytes order) */
+	if (ext2_inode_is_fast_symlink(inode) || ext2_inode_has_extents(inode))
+		memcpy(ext2_inode->i_data, raw_inode->i_block, sizeof(ext2_inode->i_data));
+	else
+		for (i = 0; i < EXT2_N_BLOCKS; i++)
+			ext2_inode->i_data[i] = le32toh(raw_inode->i_block[i]);
 
 	/* set operations */
 	if (S_ISDIR(inode->i_mode))
@@ -190,8 +226,13 @@ int ext2_write_inode(struct inode *inode)
 	struct buffer_head *bh;
 	int i;
 
-	/* check inode number */
-	if ((inode->i_ino != EXT2_ROOT_INO && inode->i_ino < sbi->s_first_ino) || inode->i_ino > le32toh(sbi->s_es->s_inodes_count))
+	/* read only file system */
+	if (ext2_rdonly(inode->i_sb))
+		return -EROFS;
+
+	/* check inode number (root and journal are the only reserved inodes used) */
+	if ((inode->i_ino != EXT2_ROOT_INO && inode->i_ino != le32toh(sbi->s_es->s_journal_inum) && inode->i_ino < sbi->s_first_ino)
+	    || inode->i_ino > le32toh(sbi->s_es->s_inodes_count))
 		return -EINVAL;
 
 	/* get group descriptor */
@@ -213,6 +254,15 @@ int ext2_write_inode(struct inode *inode)
 	offset &= (inode->i_sb->s_blocksize - 1);
 	raw_inode = (struct ext2_inode *) (bh->b_data + offset);
 
+	/* regular files : store high 32 bits of size (and mark file system as holding large files) */
+	if (S_ISREG(inode->i_mode)) {
+		ext2_inode->i_dir_acl = (uint64_t) inode->i_size >> 32;
+		if (inode->i_size > 0x7FFFFFFF && !(sbi->s_es->s_feature_ro_compat & htole32(EXT2_FEATURE_RO_COMPAT_LARGE_FILE))) {
+			sbi->s_es->s_feature_ro_compat |= htole32(EXT2_FEATURE_RO_COMPAT_LARGE_FILE);
+			sbi->s_sbh->b_dirt = 1;
+		}
+	}
+
 	/* set raw inode */
 	raw_inode->i_mode = htole16(inode->i_mode);
 	raw_inode->i_uid = htole16(inode->i_uid & 0xFFFF);
@@ -233,8 +283,11 @@ int ext2_write_inode(struct inode *inode)
 	raw_inode->i_fsize = ext2_inode->i_frag_size;
 	raw_inode->i_uid_high = htole16((inode->i_uid & 0xFFFF0000) >> 16);
 	raw_inode->i_gid_high = htole16((inode->i_gid & 0xFFFF0000) >> 16);
-	for (i = 0; i < EXT2_N_BLOCKS; i++)
-		raw_inode->i_block[i] = htole32(ext2_inode->i_data[i]);
+	if (ext2_inode_is_fast_symlink(inode) || ext2_inode_has_extents(inode))
+		memcpy(raw_inode->i_block, ext2_inode->i_data, sizeof(raw_inode->i_block));
+	else
+		for (i = 0; i < EXT2_N_BLOCKS; i++)
+			raw_inode->i_block[i] = htole32(ext2_inode->i_data[i]);
 
 	/* release block buffer */
 	bh->b_dirt = 1;
@@ -244,9 +297,132 @@ int ext2_write_inode(struct inode *inode)
 }
 
 /*
- * Read a Ext2 inode block.
+ * Look for a block in Ext2 inode extents cache (returns physical block or 0).
+ */
+static uint32_t ext2_extent_lookup(struct ext2_inode_info *ext2_inode, uint32_t block)
+{
+	struct ext2_extent *ext;
+	int i;
+
+	/* try last used extent first (sequential access) */
+	ext = &ext2_inode->i_extents[ext2_inode->i_extent_last];
+	if (block >= ext->e_block && block < ext->e_block + ext->e_len)
+		return ext->e_start + (block - ext->e_block);
+
+	/* search all extents */
+	for (i = 0; i < EXT2_EXTENT_CACHE_SIZE; i++) {
+		ext = &ext2_inode->i_extents[i];
+		if (block >= ext->e_block && block < ext->e_block + ext->e_len) {
+			ext2_inode->i_extent_last = i;
+			return ext->e_start + (block - ext->e_block);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Add an extent to Ext2 inode extents cache (merge it with an overlapping or adjacent extent if possible).
+ */
+static void ext2_extent_add(struct ext2_inode_info *ext2_inode, uint32_t block, uint32_t start, uint32_t len)
+{
+	struct ext2_extent *ext;
+	uint32_t end;
+	int i;
+
+	/* try to merge with an existing extent */
+	for (i = 0; i < EXT2_EXTENT_CACHE_SIZE; i++) {
+		ext = &ext2_inode->i_extents[i];
+
+		/* extents must be mapped with same offset and overlap or touch */
+		if (!ext->e_len || ext->e_start - ext->e_block != start - block)
+			continue;
+		if (block > ext->e_block + ext->e_len || ext->e_block > block + len)
+			continue;
+
+		/* merge */
+		end = block + len > ext->e_block + ext->e_len ? block + len : ext->e_block + ext->e_len;
+		if (block < ext->e_block) {
+			ext->e_block = block;
+			ext->e_start = start;
+		}
+		ext->e_len = end - ext->e_block;
+		ext2_inode->i_extent_last = i;
+		return;
+	}
+
+	/* else replace next extent (round robin) */
+	i = ext2_inode->i_extent_next;
+	ext2_inode->i_extent_next = (i + 1) % EXT2_EXTENT_CACHE_SIZE;
+	ext2_inode->i_extents[i].e_block = block;
+	ext2_inode->i_extents[i].e_start = start;
+	ext2_inode->i_extents[i].e_len = len;
+	ext2_inode->i_extent_last = i;
+}
+
+/*
+ * Invalidate Ext2 inode extents cache from a block (called on truncate).
  */
-static struct buffer_head *ext2_inode_getblk(struct inode *inode, int inode_block, int create)
+void ext2_extent_truncate(struct inode *inode, uint32_t block)
+{
+	struct ext2_inode_info *ext2_inode = ext2_i(inode);
+	struct ext2_extent *ext;
+	int i;
+
+	for (i = 0; i < EXT2_EXTENT_CACHE_SIZE; i++) {
+		ext = &ext2_inode->i_extents[i];
+
+		if (ext->e_block >= block)
+			ext->e_len = 0;
+		else if (ext->e_block + ext->e_len > block)
+			ext->e_len = block - ext->e_block;
+	}
+}
+
+/*
+ * Allocate a contiguous run of blocks in consecutive empty slots (returns first block or 0).
+ * New blocks are cleared if zero is set (else caller will overwrite them).
+ */
+static uint32_t ext2_alloc_blocks(struct inode *inode, uint32_t *slots, int nr_slots, uint32_t goal, int count, int zero)
+{
+	struct vfs_stat_ctx ctx;
+	struct buffer_head *bh;
+	uint32_t block, n, i;
+
+	/* count consecutive empty slots */
+	for (n = 1; n < count && n < nr_slots && !slots[n]; n++);
+
+	/* allocate blocks */
+	vfs_stat_begin(&ctx);
+	block = ext2_new_blocks(inode, goal, &n);
+	vfs_stat_end(&vfs_stats[VFS_STAT_ALLOC], &ctx);
+	if (!block)
+		return 0;
+
+	/* fill slots and clear new blocks (freed blocks are not zeroed) */
+	for (i = 0; i < n; i++) {
+		slots[i] = block + i;
+		if (!zero)
+			continue;
+
+		bh = getblk(inode->i_sb, block + i);
+		if (bh) {
+			memset(bh->b_data, 0, bh->b_size);
+			bh->b_uptodate = 1;
+			bh->b_dirt = 1;
+			brelse(bh);
+		}
+	}
+
+	return block;
+}
+
+/*
+ * Get (or create) a Ext2 inode direct block (returns physical block or 0).
+ * create is the number of blocks the caller is going to write from this one (direct blocks are allocated ahead).
+ * If new is set, this is a data block the caller fills : it is not cleared and new is set if it was allocated.
+ */
+static uint32_t ext2_inode_getblk(struct inode *inode, int inode_block, int create, int *new)
 {
 	struct ext2_inode_info *ext2_inode = ext2_i(inode);
 	struct ext2_sb_info *sbi = ext2_sb(inode->i_sb);
@@ -258,7 +434,7 @@ static struct buffer_head *ext2_inode_getblk(struct inode *inode, int inode_bloc
 		/* try to reuse last block of inode */
 		for (i = inode_block - 1; i >= 0; i--) {
 			if (ext2_inode->i_data[i]) {
-				goal = ext2_inode->i_data[i];
+				goal = ext2_inode->i_data[i] + 1;
 				break;
 			}
 		}
@@ -267,40 +443,56 @@ static struct buffer_head *ext2_inode_getblk(struct inode *inode, int inode_bloc
 		if (!goal)
 			goal = ext2_inode->i_block_group * sbi->s_blocks_per_group + le32toh(sbi->s_es->s_first_data_block);
 
-		/* create new block */
-		ext2_inode->i_data[inode_block] = ext2_new_block(inode, goal);
-		if (ext2_inode->i_data[inode_block]) {
-			inode->i_blocks++;
+		/* create new blocks (indirect blocks one by one) */
+		if (ext2_alloc_blocks(inode, &ext2_inode->i_data[inode_block],
+				      inode_block < EXT2_NDIR_BLOCKS ? EXT2_NDIR_BLOCKS - inode_block : 1, goal, create, !new)) {
 			inode->i_dirt = 1;
+			if (new)
+				*new = 1;
 		}
 	}
 
-	/* check block */
-	if (!ext2_inode->i_data[inode_block])
-		return NULL;
-
-	/* read block on disk */
-	return sb_bread(inode->i_sb, ext2_inode->i_data[inode_block]);
+	return ext2_inode->i_data[inode_block];
 }
 
 /*
- * Read a Ext2 indirect block.
+ * Get (or create) a block pointed by a Ext2 indirect block (returns physical block or 0).
+ * If run is set, this is a data block : it is allocated ahead like direct blocks and run is filled
+ * with the contiguous run of blocks around this entry (e_block = first entry index).
+ * If new is set, data block is not cleared and new is set if it was allocated.
  */
-static struct buffer_head *ext2_block_getblk(struct inode *inode, struct buffer_head *bh, int block_block, int create)
+static uint32_t ext2_block_getblk(struct inode *inode, uint32_t block, int block_block, int create, struct ext2_extent *run,
+				  int *new)
 {
-	uint32_t goal = 0;
-	int i, tmp;
+	int addr_per_block = inode->i_sb->s_blocksize / 4, i, tmp, first, last;
+	struct buffer_head *bh = NULL;
+	uint32_t goal = 0, *blocks;
 
-	if (!bh)
-		return NULL;
+	if (!block)
+		return 0;
+
+	/* use pinned copy of indirect block unless an entry must be created */
+	blocks = ext2_pin_lookup(inode, block);
+	if (blocks && create && !blocks[block_block])
+		blocks = NULL;
+
+	/* else read indirect block */
+	if (!blocks) {
+		bh = sb_bread(inode->i_sb, block);
+		if (!bh)
+			return 0;
+
+		blocks = (uint32_t *) bh->b_data;
+	}
 
 	/* create block if needed */
-	i = ((uint32_t *) bh->b_data)[block_block];
+	i = blocks[block_block];
 	if (create && !i) {
 		/* try to reuse previous blocks */
 		for (tmp = block_block - 1; tmp >= 0; tmp--) {
-			if (((uint32_t *) bh->b_data)[tmp]) {
-				goal = ((uint32_t *) bh->b_data)[tmp];
+			if (blocks[tmp]) {
+				goal = blocks[tmp] + 1;
+				break;
 			}
 		}
 
@@ -308,32 +500,55 @@ static struct buffer_head *ext2_block_getblk(struct inode *inode, struct buffer_
 		if (!goal)
 			goal = bh->b_block;
 
-		/* create new block */
-		i = ext2_new_block(inode, goal);
+		/* create new blocks */
+		i = ext2_alloc_blocks(inode, &blocks[block_block], run ? addr_per_block - block_block : 1, goal, create, !new);
 		if (i) {
-			((uint32_t *) bh->b_data)[block_block] = i;
 			bh->b_dirt = 1;
+			ext2_pin_update(inode, bh);
+			if (new)
+				*new = 1;
 		}
 	}
 
-	/* release parent block */
-	brelse(bh);
+	/* find contiguous run around this entry */
+	if (run && i) {
+		for (first = block_block; first > 0 && blocks[first - 1] && blocks[first - 1] + 1 == blocks[first]; first--);
+		for (last = block_block; last < addr_per_block - 1 && blocks[last + 1] && blocks[last] + 1 == blocks[last + 1]; last++);
+		run->e_block = first;
+		run->e_start = blocks[first];
+		run->e_len = last - first + 1;
+	}
 
-	if (!i)
-		return NULL;
+	/* release indirect block */
+	brelse(bh);
 
-	return sb_bread(inode->i_sb, i);
+	return i;
 }
 
 /*
- * Read a Ext2 inode block.
+ * Get (or create) physical block of a Ext2 inode block (returns 0 if not mapped).
+ * If new is set, a created block is not cleared and new is set (caller must fill it).
  */
-struct buffer_head *ext2_bread(struct inode *inode, uint32_t block, int create)
+static uint32_t ext2_get_block(struct inode *inode, uint32_t block, int create, int *new)
 {
+	struct ext2_inode_info *ext2_inode = ext2_i(inode);
 	struct super_block *sb = inode->i_sb;
-	struct buffer_head *bh;
+	uint32_t phys, ind, index, logical = block;
+	struct ext2_extent run;
 	int addr_per_block;
 
+	/* extent tree (read only) */
+	if (ext2_inode_has_extents(inode)) {
+		phys = ext2_extent_lookup(ext2_inode, block);
+		if (!phys) {
+			phys = ext2_ext_get_block(inode, block, &run);
+			if (phys)
+				ext2_extent_add(ext2_inode, run.e_block, run.e_start, run.e_len);
+		}
+
+		return phys;
+	}
+
 	/* compute number of addresses per block */
 	addr_per_block = sb->s_blocksize / 4;
 
@@ -341,31 +556,201 @@ struct buffer_head *ext2_bread(struct inode *inode, uint32_t block, int create)
 	if (block > EXT2_NDIR_BLOCKS + addr_per_block
 			+ addr_per_block * addr_per_block
 			+ addr_per_block * addr_per_block * addr_per_block)
-		return NULL;
+		return 0;
 
 	/* direct block */
 	if (block < EXT2_NDIR_BLOCKS)
-		return ext2_inode_getblk(inode, block, create);
+		return ext2_inode_getblk(inode, block, create, new);
 
-	/* indirect block */
+	/* look in extents cache */
+	phys = ext2_extent_lookup(ext2_inode, block);
+	if (phys)
+		return phys;
+
+	/* find last level indirect block */
 	block -= EXT2_NDIR_BLOCKS;
 	if (block < addr_per_block) {
-		bh = ext2_inode_getblk(inode, EXT2_IND_BLOCK, create);
-		return ext2_block_getblk(inode, bh, block, create);
+		/* indirect block */
+		ind = ext2_inode_getblk(inode, EXT2_IND_BLOCK, create, NULL);
+		index = block;
+	} else if (block - addr_per_block < addr_per_block * addr_per_block) {
+		/* double indirect block */
+		block -= addr_per_block;
+		ind = ext2_inode_getblk(inode, EXT2_DIND_BLOCK, create, NULL);
+		ind = ext2_block_getblk(inode, ind, block / addr_per_block, create, NULL, NULL);
+		index = block & (addr_per_block - 1);
+	} else {
+		/* triple indirect block */
+		block -= addr_per_block + addr_per_block * addr_per_block;
+		ind = ext2_inode_getblk(inode, EXT2_TIND_BLOCK, create, NULL);
+		ind = ext2_block_getblk(inode, ind, block / (addr_per_block * addr_per_block), create, NULL, NULL);
+		ind = ext2_block_getblk(inode, ind, (block / addr_per_block) & (addr_per_block - 1), create, NULL, NULL);
+		index = block & (addr_per_block - 1);
+	}
+
+	/* get block and cache its contiguous run */
+	phys = ext2_block_getblk(inode, ind, index, create, &run, new);
+	if (phys)
+		ext2_extent_add(ext2_inode, logical - (index - run.e_block), run.e_start, run.e_len);
+
+	return phys;
+}
+
+/*
+ * Read a Ext2 inode block (create = number of blocks to allocate ahead if not mapped).
+ */
+struct buffer_head *ext2_bread(struct inode *inode, uint32_t block, int create)
+{
+	uint32_t phys;
+
+	/* get physical block */
+	phys = ext2_get_block(inode, block, create, NULL);
+	if (!phys)
+		return NULL;
+
+	/* read block on disk */
+	return sb_bread(inode->i_sb, phys);
+}
+
+/*
+ * Get a Ext2 inode block buffer without reading it (create = number of blocks to allocate ahead if not mapped).
+ * Created blocks are not cleared : new is set and caller must fill the buffer.
+ */
+struct buffer_head *ext2_getblk(struct inode *inode, uint32_t block, int create, int *new)
+{
+	uint32_t phys;
+
+	/* get physical block */
+	*new = 0;
+	phys = ext2_get_block(inode, block, create, new);
+	if (!phys)
+		return NULL;
+
+	/* get buffer */
+	return getblk(inode->i_sb, phys);
+}
+
+/*
+ * Get physical block of a Ext2 inode block (returns 0 for a hole).
+ */
+uint32_t ext2_bmap(struct inode *inode, uint32_t block)
+{
+	return ext2_get_block(inode, block, 0, NULL);
+}
+
+/*
+ * Find first mapped block of an indirect tree at or after offset (returns number of blocks addressed by tree if none).
+ */
+static uint32_t ext2_find_data_block_tree(struct super_block *sb, uint32_t ind, int depth, uint32_t offset)
+{
+	uint32_t addr_per_block = sb->s_blocksize / 4, span = 1, res, *blocks, i;
+	struct buffer_head *bh;
+
+	/* compute number of blocks addressed by one entry */
+	for (i = 1; i < depth; i++)
+		span *= addr_per_block;
+
+	/* unmapped tree */
+	if (!ind)
+		return span * addr_per_block;
+
+	/* read indirect block */
+	bh = sb_bread(sb, ind);
+	if (!bh)
+		return span * addr_per_block;
+
+	/* find first mapped entry (and first mapped block in its sub tree) */
+	blocks = (uint32_t *) bh->b_data;
+	for (i = offset / span, offset %= span; i < addr_per_block; i++, offset = 0) {
+		if (!blocks[i])
+			continue;
+
+		res = depth == 1 ? 0 : ext2_find_data_block_tree(sb, blocks[i], depth - 1, offset);
+		if (res < span) {
+			res += i * span;
+			goto out;
+		}
+	}
+
+	res = span * addr_per_block;
+out:
+	brelse(bh);
+	return res;
+}
+
+/*
+ * Find first mapped block of a Ext2 inode at or after block (unmapped indirect trees are skipped).
+ * Returns (uint32_t) -1 if there is no data after block.
+ */
+uint32_t ext2_find_data_block(struct inode *inode, uint32_t block)
+{
+	struct ext2_inode_info *ext2_inode = ext2_i(inode);
+	uint32_t addr_per_block = inode->i_sb->s_blocksize / 4, first = EXT2_NDIR_BLOCKS, nr_blocks, res;
+	int depth;
+
+	/* extent tree */
+	if (ext2_inode_has_extents(inode))
+		return ext2_ext_find_data_block(inode, block);
+
+	/* direct blocks */
+	for (; block < EXT2_NDIR_BLOCKS; block++)
+		if (ext2_inode->i_data[block])
+			return block;
+
+	/* indirect, double indirect and triple indirect trees */
+	for (depth = 1, nr_blocks = addr_per_block; depth <= 3; depth++, first += nr_blocks, nr_blocks *= addr_per_block) {
+		if (block >= first + nr_blocks)
+			continue;
+
+		res = ext2_find_data_block_tree(inode->i_sb, ext2_inode->i_data[EXT2_IND_BLOCK + depth - 1], depth, block - first);
+		if (res < nr_blocks)
+			return first + res;
+
+		block = first + nr_blocks;
 	}
 
-	/* double indirect block */
-	block -= addr_per_block;
-	if (block < addr_per_block * addr_per_block) {
-		bh = ext2_inode_getblk(inode, EXT2_DIND_BLOCK, create);
-		bh = ext2_block_getblk(inode, bh, block / addr_per_block, create);
-		return ext2_block_getblk(inode, bh, block & (addr_per_block - 1), create);
+	return (uint32_t) -1;
+}
+
+/*
+ * Prefetch inode table blocks of all entries of a directory block (used by directory scans).
+ */
+void ext2_prefetch_inodes(struct inode *dir, struct buffer_head *bh)
+{
+	struct ext2_sb_info *sbi = ext2_sb(dir->i_sb);
+	struct ext2_group_desc *gdp;
+	struct ext2_dir_entry *de;
+	uint32_t offset, *blocks;
+	int nr_blocks = 0;
+	ino_t ino;
+
+	/* mark block prefetched */
+	ext2_i(dir)->i_ra_block = bh->b_block;
+
+	/* allocate inode table blocks array */
+	blocks = (uint32_t *) malloc(sizeof(uint32_t) * (bh->b_size / EXT2_DIR_REC_LEN(1)));
+	if (!blocks)
+		return;
+
+	/* get inode table block of each entry (stop on a corrupted entry : array holds entries of minimal size only) */
+	for (offset = 0; offset < bh->b_size; offset += le16toh(de->d_rec_len)) {
+		de = (struct ext2_dir_entry *) (bh->b_data + offset);
+		if (le16toh(de->d_rec_len) < EXT2_DIR_REC_LEN(1) || offset + le16toh(de->d_rec_len) > bh->b_size)
+			break;
+
+		ino = le32toh(de->d_inode);
+		if (!ino || ino > le32toh(sbi->s_es->s_inodes_count))
+			continue;
+
+		gdp = ext2_get_group_desc(dir->i_sb, (ino - 1) / sbi->s_inodes_per_group, NULL);
+		if (!gdp)
+			continue;
+
+		blocks[nr_blocks++] = le32toh(gdp->bg_inodeable)
+			+ ((((ino - 1) % sbi->s_inodes_per_group) * sbi->s_inode_size) >> dir->i_sb->s_blocksize_bits);
 	}
 
-	/* triple indirect block */
-	block -= addr_per_block * addr_per_block;
-	bh = ext2_inode_getblk(inode, EXT2_TIND_BLOCK, create);
-	bh = ext2_block_getblk(inode, bh, block / (addr_per_block * addr_per_block), create);
-	bh = ext2_block_getblk(inode, bh, (block / addr_per_block) & (addr_per_block - 1), create);
-	return ext2_block_getblk(inode, bh, block & (addr_per_block - 1), create);
+	/* read them (sorted, by contiguous runs) */
+	sb_breadahead(dir->i_sb, blocks, nr_blocks);
+	free(blocks);
 }
@@ -0,0 +1,926 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "ext2.h"
+
+/* recovery passes */
+#define EXT2_PASS_SCAN				0
+#define EXT2_PASS_REVOKE			1
+#define EXT2_PASS_REPLAY			2
+
+#define EXT2_JBITMAP_SET(map, i)		((map)[(i) / 8] |= (0x1 << ((i) % 8)))
+#define EXT2_JBITMAP_CLR(map, i)		((map)[(i) / 8] &= ~(0x1 << ((i) % 8)))
+#define EXT2_JBITMAP_TEST(map, i)		((map)[(i) / 8] & (0x1 << ((i) % 8)))
+
+/*
+ * Ext2 journal revoke record (used during recovery).
+ */
+struct ext2_revoke_record {
+	uint32_t			block;				/* revoked block */
+	uint32_t			sequence;			/* last transaction revoking it */
+};
+
+/*
+ * Ext2 journal recovery state.
+ */
+struct ext2_recovery {
+	uint32_t			end_sequence;			/* first transaction not committed */
+	struct ext2_revoke_record *	revokes;			/* revoke records */
+	uint32_t			nr_revokes;			/* number of revoke records */
+	uint32_t			size_revokes;			/* size of revoke records array */
+	uint32_t			nr_replayed;			/* number of replayed blocks */
+};
+
+/*
+ * Get journal super block.
+ */
+static inline struct ext2_journal_super_block *ext2_jsb(struct ext2_journal *journal)
+{
+	return (struct ext2_journal_super_block *) journal->j_sb_data;
+}
+
+/*
+ * Get next log block (log is circular).
+ */
+static inline uint32_t ext2_journal_next(struct ext2_journal *journal, uint32_t block)
+{
+	return ++block >= journal->j_last ? journal->j_first : block;
+}
+
+/*
+ * Read a journal block.
+ */
+static int ext2_journal_read(struct super_block *sb, uint32_t block, char *buf)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct vfs_stat_ctx io_ctx;
+	ssize_t n;
+
+	vfs_stat_begin(&io_ctx);
+	n = pread(sb->s_fd, buf, sb->s_blocksize, (off_t) journal->j_map[block] * sb->s_blocksize);
+	vfs_stat_end(&vfs_stats[VFS_STAT_IO], &io_ctx);
+
+	return n == sb->s_blocksize ? 0 : -EIO;
+}
+
+/*
+ * Write journal blocks (contiguous device blocks are written at once).
+ */
+static int ext2_journal_write(struct super_block *sb, uint32_t block, struct iovec *iov, int nr_iov)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct vfs_stat_ctx io_ctx;
+	int i, nr;
+	ssize_t n;
+
+	for (i = 0; i < nr_iov; i += nr) {
+		/* find run of contiguous device blocks */
+		for (nr = 1; i + nr < nr_iov && nr < IOV_MAX; nr++)
+			if (journal->j_map[block + nr] != journal->j_map[block] + nr)
+				break;
+
+		/* write run */
+		vfs_stat_begin(&io_ctx);
+		n = pwritev(sb->s_fd, iov + i, nr, (off_t) journal->j_map[block] * sb->s_blocksize);
+		vfs_stat_end(&vfs_stats[VFS_STAT_IO], &io_ctx);
+		if (n != (ssize_t) nr * sb->s_blocksize)
+			return -EIO;
+
+		block += nr;
+	}
+
+	return 0;
+}
+
+/*
+ * Write journal super block.
+ */
+static int ext2_journal_write_sb(struct super_block *sb)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct iovec iov = { journal->j_sb_data, sb->s_blocksize };
+
+	return ext2_journal_write(sb, 0, &iov, 1);
+}
+
+/*
+ * Add a revoke record (recovery only).
+ */
+static int ext2_recovery_add_revoke(struct ext2_recovery *rec, uint32_t block, uint32_t sequence)
+{
+	struct ext2_revoke_record *revokes;
+
+	/* grow revoke records array */
+	if (rec->nr_revokes == rec->size_revokes) {
+		revokes = realloc(rec->revokes, sizeof(struct ext2_revoke_record) * (rec->size_revokes ? rec->size_revokes * 2 : 64));
+		if (!revokes)
+			return -ENOMEM;
+
+		rec->revokes = revokes;
+		rec->size_revokes = rec->size_revokes ? rec->size_revokes * 2 : 64;
+	}
+
+	rec->revokes[rec->nr_revokes].block = block;
+	rec->revokes[rec->nr_revokes].sequence = sequence;
+	rec->nr_revokes++;
+
+	return 0;
+}
+
+/*
+ * Compare 2 revoke records (by block, then by sequence).
+ */
+static int ext2_revoke_cmp(const void *a, const void *b)
+{
+	const struct ext2_revoke_record *r1 = a, *r2 = b;
+
+	if (r1->block != r2->block)
+		return r1->block < r2->block ? -1 : 1;
+
+	return (int32_t) (r1->sequence - r2->sequence) < 0 ? -1 : (r1->sequence != r2->sequence);
+}
+
+/*
+ * Is a block revoked for a transaction (recovery only) ?
+ */
+static int ext2_recovery_revoked(struct ext2_recovery *rec, uint32_t block, uint32_t sequence)
+{
+	struct ext2_revoke_record *record = NULL;
+	int lo = 0, hi = rec->nr_revokes - 1, mid;
+
+	/* find revoke record (records are sorted and deduplicated) */
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (rec->revokes[mid].block == block) {
+			record = &rec->revokes[mid];
+			break;
+		}
+
+		if (rec->revokes[mid].block < block)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	/* block revoked by this transaction or a later one */
+	return record && (int32_t) (sequence - record->sequence) <= 0;
+}
+
+/*
+ * Replay a logged block to its home location.
+ */
+static int ext2_recovery_replay_block(struct super_block *sb, uint32_t log_block, uint32_t block, int escaped)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct buffer_head *bh;
+	int err;
+
+	/* check home block */
+	if (block >= le32toh(sbi->s_es->s_blocks_count)) {
+		fprintf(stderr, "Ext2 : journal block %u not in file system\n", block);
+		return -EINVAL;
+	}
+
+	/* get buffer (cached copies of group descriptors or super block must be refreshed too) */
+	bh = getblk(sb, block);
+	if (!bh)
+		return -ENOMEM;
+
+	/* read logged block */
+	err = ext2_journal_read(sb, log_block, bh->b_data);
+	if (err)
+		goto out;
+
+	/* restore escaped magic number */
+	if (escaped)
+		*((uint32_t *) bh->b_data) = htobe32(EXT2_JOURNAL_MAGIC);
+
+	/* write it to its home location */
+	bh->b_uptodate = 1;
+	err = bwrite(bh);
+out:
+	brelse(bh);
+	return err;
+}
+
+/*
+ * Do one recovery pass on the log.
+ */
+static int ext2_recovery_pass(struct super_block *sb, struct ext2_recovery *rec, int pass)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct ext2_journal_revoke_header *rh;
+	struct ext2_journal_block_tag *tag;
+	struct ext2_journal_header *header;
+	uint32_t block, sequence, off, count;
+	int err = 0, flags;
+	char *buf;
+
+	/* allocate block buffer */
+	buf = (char *) malloc(sb->s_blocksize);
+	if (!buf)
+		return -ENOMEM;
+
+	/* log starts at journal super block start */
+	block = be32toh(ext2_jsb(journal)->s_start);
+	sequence = be32toh(ext2_jsb(journal)->s_sequence);
+
+	for (;;) {
+		/* replay and revoke passes stop at first uncommitted transaction */
+		if (pass != EXT2_PASS_SCAN && sequence == rec->end_sequence)
+			break;
+
+		/* read log block */
+		err = ext2_journal_read(sb, block, buf);
+		if (err)
+			goto out;
+
+		/* end of log */
+		header = (struct ext2_journal_header *) buf;
+		if (be32toh(header->h_magic) != EXT2_JOURNAL_MAGIC || be32toh(header->h_sequence) != sequence)
+			break;
+
+		block = ext2_journal_next(journal, block);
+
+		switch (be32toh(header->h_blocktype)) {
+			case EXT2_JOURNAL_DESCRIPTOR_BLOCK:
+				/* walk tags (one logged block per tag) */
+				for (off = sizeof(struct ext2_journal_header); off + sizeof(struct ext2_journal_block_tag) <= sb->s_blocksize;) {
+					tag = (struct ext2_journal_block_tag *) (buf + off);
+					flags = be16toh(tag->t_flags);
+
+					/* replay block unless it is revoked */
+					if (pass == EXT2_PASS_REPLAY && !ext2_recovery_revoked(rec, be32toh(tag->t_blocknr), sequence)) {
+						err = ext2_recovery_replay_block(sb, block, be32toh(tag->t_blocknr), flags & EXT2_JOURNAL_FLAG_ESCAPE);
+						if (err)
+							goto out;
+
+						rec->nr_replayed++;
+					}
+
+					block = ext2_journal_next(journal, block);
+
+					/* next tag */
+					off += sizeof(struct ext2_journal_block_tag);
+					if (!(flags & EXT2_JOURNAL_FLAG_SAME_UUID))
+						off += 16;
+					if (flags & EXT2_JOURNAL_FLAG_LAST_TAG)
+						break;
+				}
+
+				break;
+			case EXT2_JOURNAL_COMMIT_BLOCK:
+				sequence++;
+				break;
+			case EXT2_JOURNAL_REVOKE_BLOCK:
+				if (pass != EXT2_PASS_REVOKE)
+					break;
+
+				/* record revoked blocks */
+				rh = (struct ext2_journal_revoke_header *) buf;
+				count = be32toh(rh->r_count) < sb->s_blocksize ? be32toh(rh->r_count) : sb->s_blocksize;
+				for (off = sizeof(struct ext2_journal_revoke_header); off + 4 <= count; off += 4) {
+					err = ext2_recovery_add_revoke(rec, be32toh(*((uint32_t *) (buf + off))), sequence);
+					if (err)
+						goto out;
+				}
+
+				break;
+			default:
+				goto end;
+		}
+	}
+
+end:
+	/* remember end of committed log */
+	if (pass == EXT2_PASS_SCAN)
+		rec->end_sequence = sequence;
+out:
+	free(buf);
+	return err;
+}
+
+/*
+ * Recover a Ext2 journal (scan log, collect revoked blocks and replay committed transactions).
+ */
+static int ext2_journal_recover(struct super_block *sb)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct ext2_recovery rec = { 0 };
+	uint32_t i, j;
+	int err;
+
+	/* find end of committed log */
+	err = ext2_recovery_pass(sb, &rec, EXT2_PASS_SCAN);
+	if (err)
+		goto out;
+
+	/* collect revoke records and keep last one of each block */
+	err = ext2_recovery_pass(sb, &rec, EXT2_PASS_REVOKE);
+	if (err)
+		goto out;
+
+	qsort(rec.revokes, rec.nr_revokes, sizeof(struct ext2_revoke_record), ext2_revoke_cmp);
+	for (i = 0, j = 0; i < rec.nr_revokes; i++) {
+		if (j && rec.revokes[j - 1].block == rec.revokes[i].block)
+			j--;
+		rec.revokes[j++] = rec.revokes[i];
+	}
+	rec.nr_revokes = j;
+
+	/* replay committed transactions */
+	err = ext2_recovery_pass(sb, &rec, EXT2_PASS_REPLAY);
+	if (err)
+		goto out;
+
+	/* make replayed blocks durable before log is forgotten */
+	fdatasync(sb->s_fd);
+
+	/* next transaction skips the last one (it may be partially written) */
+	journal->j_sequence = rec.end_sequence + 1;
+
+	fprintf(stderr, "Ext2 : journal recovered (%u transactions, %u blocks replayed)\n",
+		rec.end_sequence - be32toh(ext2_jsb(journal)->s_sequence), rec.nr_replayed);
+out:
+	free(rec.revokes);
+	return err;
+}
+
+/*
+ * Release a Ext2 journal structure.
+ */
+static void ext2_journal_free(struct ext2_journal *journal)
+{
+	vfs_iput(journal->j_inode);
+	free(journal->j_map);
+	free(journal->j_sb_data);
+	free(journal->j_buffers);
+	free(journal->j_revokes);
+	free(journal->j_frees);
+	free(journal->j_in_trans);
+	free(journal->j_revoked);
+	free(journal->j_logged);
+	free(journal);
+}
+
+/*
+ * Load a Ext2 journal (recover it if needed).
+ */
+int ext2_journal_load(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct ext2_journal_super_block *jsb;
+	struct ext2_journal *journal;
+	uint32_t i, bitmap_size;
+	int err = -EINVAL;
+
+	/* no journal */
+	if (!(le32toh(sbi->s_es->s_feature_compat) & EXT2_FEATURE_COMPAT_HAS_JOURNAL))
+		return 0;
+
+	/* external journals are not supported */
+	if (le32toh(sbi->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_JOURNAL_DEV || !sbi->s_es->s_journal_inum) {
+		fprintf(stderr, "Ext2 : external journal not supported\n");
+		return -EINVAL;
+	}
+
+	/* allocate journal */
+	sbi->s_journal = journal = (struct ext2_journal *) calloc(1, sizeof(struct ext2_journal));
+	if (!journal)
+		return -ENOMEM;
+
+	/* get journal inode */
+	journal->j_inode = vfs_iget(sb, le32toh(sbi->s_es->s_journal_inum));
+	if (!journal->j_inode)
+		goto err_bad_journal;
+
+	/* read journal super block (journal block 0 is mapped by hand, map is not built yet) */
+	journal->j_sb_data = (char *) malloc(sb->s_blocksize);
+	journal->j_map = (uint32_t *) malloc(sizeof(uint32_t));
+	if (!journal->j_sb_data || !journal->j_map) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	journal->j_map[0] = ext2_bmap(journal->j_inode, 0);
+	if (!journal->j_map[0] || ext2_journal_read(sb, 0, journal->j_sb_data))
+		goto err_bad_journal;
+
+	/* check journal super block */
+	jsb = ext2_jsb(journal);
+	if (be32toh(jsb->s_header.h_magic) != EXT2_JOURNAL_MAGIC
+	    || (be32toh(jsb->s_header.h_blocktype) != EXT2_JOURNAL_SUPERBLOCK_V1
+		&& be32toh(jsb->s_header.h_blocktype) != EXT2_JOURNAL_SUPERBLOCK_V2)
+	    || be32toh(jsb->s_blocksize) != sb->s_blocksize
+	    || be32toh(jsb->s_maxlen) > journal->j_inode->i_size / sb->s_blocksize
+	    || !be32toh(jsb->s_first) || be32toh(jsb->s_first) >= be32toh(jsb->s_maxlen))
+		goto err_bad_journal;
+
+	/* check journal features (checksums and 64 bit block numbers are not supported) */
+	if (be32toh(jsb->s_header.h_blocktype) == EXT2_JOURNAL_SUPERBLOCK_V2
+	    && be32toh(jsb->s_feature_incompat) & ~EXT2_JOURNAL_KNOWN_INCOMPAT) {
+		fprintf(stderr, "Ext2 : unsupported journal features (0x%x)\n", be32toh(jsb->s_feature_incompat));
+		goto err;
+	}
+
+	/* map journal blocks */
+	journal->j_first = be32toh(jsb->s_first);
+	journal->j_last = be32toh(jsb->s_maxlen);
+	free(journal->j_map);
+	journal->j_map = (uint32_t *) malloc(sizeof(uint32_t) * journal->j_last);
+	if (!journal->j_map) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < journal->j_last; i++) {
+		journal->j_map[i] = ext2_bmap(journal->j_inode, i);
+		if (!journal->j_map[i])
+			goto err_bad_journal;
+	}
+
+	/* allocate blocks bitmaps */
+	bitmap_size = (le32toh(sbi->s_es->s_blocks_count) + 7) / 8;
+	journal->j_in_trans = (uint8_t *) calloc(bitmap_size, 1);
+	journal->j_revoked = (uint8_t *) calloc(bitmap_size, 1);
+	journal->j_logged = (uint8_t *) calloc(bitmap_size, 1);
+	if (!journal->j_in_trans || !journal->j_revoked || !journal->j_logged) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	/* transactions use at most a quarter of the log and a quarter of the buffer cache (twice for a single operation) */
+	journal->j_max_buffers = (journal->j_last - journal->j_first) / 4;
+	if (journal->j_max_buffers > VFS_NR_BUFFER / 4)
+		journal->j_max_buffers = VFS_NR_BUFFER / 4;
+	journal->j_sequence = be32toh(jsb->s_sequence);
+
+	/* replay log if file system was not cleanly unmounted */
+	if (le32toh(sbi->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_RECOVER && jsb->s_start) {
+		err = ext2_journal_recover(sb);
+		if (err)
+			goto err_recover;
+	}
+
+	/* log is empty now */
+	jsb->s_start = 0;
+	journal->j_head = journal->j_first;
+	journal->j_tail_set = 0;
+
+	/* clear recovery flag (set again at first commit) */
+	if (le32toh(sbi->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_RECOVER) {
+		jsb->s_sequence = htobe32(journal->j_sequence);
+		if (ext2_journal_write_sb(sb))
+			goto err_recover;
+
+		sbi->s_es->s_feature_incompat = htole32(le32toh(sbi->s_es->s_feature_incompat) & ~EXT2_FEATURE_INCOMPAT_RECOVER);
+		if (bwrite(sbi->s_sbh))
+			goto err_recover;
+	}
+
+	return 0;
+err_recover:
+	fprintf(stderr, "Ext2 : can't recover journal\n");
+	err = -EIO;
+	goto err;
+err_bad_journal:
+	fprintf(stderr, "Ext2 : bad journal\n");
+err:
+	ext2_journal_free(journal);
+	sbi->s_journal = NULL;
+	return err;
+}
+
+/*
+ * Release a Ext2 journal (commit running transaction and mark journal empty).
+ */
+void ext2_journal_release(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct ext2_journal *journal = sbi->s_journal;
+
+	if (!journal)
+		return;
+
+	/* commit running transaction */
+	ext2_journal_commit(sb);
+
+	/* everything is checkpointed : mark journal empty and file system clean */
+	if (journal->j_tail_set) {
+		fdatasync(sb->s_fd);
+
+		ext2_jsb(journal)->s_start = 0;
+		ext2_jsb(journal)->s_sequence = htobe32(journal->j_sequence);
+		if (ext2_journal_write_sb(sb))
+			fprintf(stderr, "Ext2 : can't write journal super block\n");
+
+		sbi->s_es->s_feature_incompat = htole32(le32toh(sbi->s_es->s_feature_incompat) & ~EXT2_FEATURE_INCOMPAT_RECOVER);
+		if (bwrite(sbi->s_sbh))
+			fprintf(stderr, "Ext2 : can't write super block\n");
+
+		fdatasync(sb->s_fd);
+	}
+
+	ext2_journal_free(journal);
+	sbi->s_journal = NULL;
+}
+
+/*
+ * Start a Ext2 operation : commit running transaction if it is big or old enough.
+ * This is called before the operation modifies anything, so transactions hold whole operations
+ * (including inodes written when the previous operation released them).
+ */
+void ext2_journal_start(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct ext2_journal *journal = sbi->s_journal;
+
+	/* no journal or empty transaction */
+	if (!journal || (!journal->j_nr_buffers && !journal->j_nr_revokes && !journal->j_nr_frees))
+		return;
+
+	if (journal->j_nr_buffers >= journal->j_max_buffers / 2 || time(NULL) - journal->j_start_time >= sbi->s_commit_interval)
+		ext2_journal_commit(sb);
+}
+
+/*
+ * Add a dirty buffer to running transaction (buffer is pinned in cache until transaction is checkpointed).
+ */
+int ext2_journal_dirty(struct buffer_head *bh)
+{
+	struct ext2_sb_info *sbi = ext2_sb(bh->b_sb);
+	struct ext2_journal *journal = sbi->s_journal;
+	struct buffer_head **buffers;
+
+	/* not a file system block : write it in place */
+	if (bh->b_block >= le32toh(sbi->s_es->s_blocks_count))
+		return bwrite(bh);
+
+	/* already in running transaction */
+	if (EXT2_JBITMAP_TEST(journal->j_in_trans, bh->b_block)) {
+		bh->b_dirt = 0;
+		return 0;
+	}
+
+	/*
+	 * Running operation may grow transaction past its size limit (it is committed at next operation start).
+	 * Only an operation dirtying twice this limit (half of the log or of the buffer cache) forces a commit.
+	 */
+	if (journal->j_nr_buffers >= 2 * journal->j_max_buffers && !journal->j_committing) {
+		fprintf(stderr, "Ext2 : operation too big for a transaction, committing it\n");
+		ext2_journal_commit(bh->b_sb);
+	}
+
+	/* grow buffers array */
+	if (journal->j_nr_buffers == journal->j_size_buffers) {
+		buffers = realloc(journal->j_buffers, sizeof(struct buffer_head *) * (journal->j_size_buffers ? journal->j_size_buffers * 2 : 64));
+		if (!buffers)
+			return bwrite(bh);
+
+		journal->j_buffers = buffers;
+		journal->j_size_buffers = journal->j_size_buffers ? journal->j_size_buffers * 2 : 64;
+	}
+
+	/* new transaction */
+	if (!journal->j_nr_buffers && !journal->j_nr_revokes)
+		journal->j_start_time = time(NULL);
+
+	/* block is used again : cancel its revoke */
+	EXT2_JBITMAP_CLR(journal->j_revoked, bh->b_block);
+
+	/* pin buffer */
+	EXT2_JBITMAP_SET(journal->j_in_trans, bh->b_block);
+	journal->j_buffers[journal->j_nr_buffers++] = bh;
+	bh->b_ref++;
+	bh->b_dirt = 0;
+
+	return 0;
+}
+
+/*
+ * Revoke freed blocks : logged copies must not be replayed over a later use of these blocks.
+ */
+void ext2_journal_revoke(struct super_block *sb, uint32_t block, uint32_t count)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	uint32_t *revokes;
+
+	if (!journal)
+		return;
+
+	for (; count > 0; count--, block++) {
+		/* only logged blocks need a revoke record */
+		if (!EXT2_JBITMAP_TEST(journal->j_logged, block) && !EXT2_JBITMAP_TEST(journal->j_in_trans, block))
+			continue;
+
+		/* already revoked */
+		if (EXT2_JBITMAP_TEST(journal->j_revoked, block))
+			continue;
+
+		/* grow revoked blocks array */
+		if (journal->j_nr_revokes == journal->j_size_revokes) {
+			revokes = realloc(journal->j_revokes, sizeof(uint32_t) * (journal->j_size_revokes ? journal->j_size_revokes * 2 : 64));
+			if (!revokes)
+				return;
+
+			journal->j_revokes = revokes;
+			journal->j_size_revokes = journal->j_size_revokes ? journal->j_size_revokes * 2 : 64;
+		}
+
+		/* new transaction */
+		if (!journal->j_nr_buffers && !journal->j_nr_revokes)
+			journal->j_start_time = time(NULL);
+
+		EXT2_JBITMAP_SET(journal->j_revoked, block);
+		journal->j_revokes[journal->j_nr_revokes++] = block;
+	}
+}
+
+/*
+ * Add freed blocks to running transaction : they stay allocated until it is committed.
+ */
+int ext2_journal_free_blocks(struct super_block *sb, uint32_t block, uint32_t count)
+{
+	struct ext2_journal *journal = ext2_sb(sb)->s_journal;
+	struct ext2_free_range *frees;
+
+	/* extend last freed range */
+	if (journal->j_nr_frees && journal->j_frees[journal->j_nr_frees - 1].start + journal->j_frees[journal->j_nr_frees - 1].count == block) {
+		journal->j_frees[journal->j_nr_frees - 1].count += count;
+		return 0;
+	}
+
+	/* grow freed ranges array (or release blocks at once) */
+	if (journal->j_nr_frees == journal->j_size_frees) {
+		frees = realloc(journal->j_frees, sizeof(struct ext2_free_range) * (journal->j_size_frees ? journal->j_size_frees * 2 : 64));
+		if (!frees)
+			return ext2_release_blocks(sb, block, count);
+
+		journal->j_frees = frees;
+		journal->j_size_frees = journal->j_size_frees ? journal->j_size_frees * 2 : 64;
+	}
+
+	/* new transaction */
+	if (!journal->j_nr_buffers && !journal->j_nr_revokes && !journal->j_nr_frees)
+		journal->j_start_time = time(NULL);
+
+	journal->j_frees[journal->j_nr_frees].start = block;
+	journal->j_frees[journal->j_nr_frees++].count = count;
+
+	return 0;
+}
+
+/*
+ * Compare 2 buffers block numbers.
+ */
+static int ext2_buffer_cmp(const void *a, const void *b)
+{
+	const struct buffer_head *bh1 = *((const struct buffer_head **) a), *bh2 = *((const struct buffer_head **) b);
+
+	return bh1->b_block < bh2->b_block ? -1 : bh1->b_block > bh2->b_block;
+}
+
+/*
+ * Restart log at first journal block (everything before is checkpointed).
+ */
+static int ext2_journal_reset_log(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct ext2_journal *journal = sbi->s_journal;
+	struct ext2_journal_super_block *jsb = ext2_jsb(journal);
+
+	/* previous checkpoints must be on disk before their log is overwritten */
+	if (journal->j_tail_set)
+		fdatasync(sb->s_fd);
+
+	/* upgrade journal super block to version 2 (revoke records) */
+	if (be32toh(jsb->s_header.h_blocktype) == EXT2_JOURNAL_SUPERBLOCK_V1) {
+		jsb->s_header.h_blocktype = htobe32(EXT2_JOURNAL_SUPERBLOCK_V2);
+		memset(&jsb->s_feature_compat, 0, sb->s_blocksize - offsetof(struct ext2_journal_super_block, s_feature_compat));
+	}
+
+	/* point journal super block to new log */
+	journal->j_head = journal->j_first;
+	jsb->s_feature_incompat = htobe32(be32toh(jsb->s_feature_incompat) | EXT2_JOURNAL_FEATURE_INCOMPAT_REVOKE);
+	jsb->s_start = htobe32(journal->j_head);
+	jsb->s_sequence = htobe32(journal->j_sequence);
+	if (ext2_journal_write_sb(sb))
+		return -EIO;
+
+	/* file system needs recovery from now on */
+	if (!journal->j_tail_set) {
+		sbi->s_es->s_feature_incompat = htole32(le32toh(sbi->s_es->s_feature_incompat) | EXT2_FEATURE_INCOMPAT_RECOVER);
+		if (bwrite(sbi->s_sbh))
+			return -EIO;
+	}
+
+	/* blocks logged before are not replayed anymore */
+	memset(journal->j_logged, 0, (le32toh(sbi->s_es->s_blocks_count) + 7) / 8);
+	journal->j_tail_set = 1;
+
+	return 0;
+}
+
+/*
+ * Set a journal block header.
+ */
+static void ext2_journal_set_header(char *buf, uint32_t blocktype, uint32_t sequence)
+{
+	struct ext2_journal_header *header = (struct ext2_journal_header *) buf;
+
+	header->h_magic = htobe32(EXT2_JOURNAL_MAGIC);
+	header->h_blocktype = htobe32(blocktype);
+	header->h_sequence = htobe32(sequence);
+}
+
+/*
+ * Commit running transaction : revoke blocks, descriptors and logged blocks are written in one sequential run,
+ * then the commit block and finally logged blocks are checkpointed to their home locations.
+ * Data blocks are written in place by file writes, so they reach the disk before the transaction referencing them.
+ */
+int ext2_journal_commit(struct super_block *sb)
+{
+	uint32_t nr_revokes, nr_revoke_blocks, nr_desc, nr_escaped, nr_log, tags_per_desc, revokes_per_block, i, j, k, off;
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	struct ext2_journal *journal = sbi->s_journal;
+	struct ext2_journal_revoke_header *rh;
+	struct ext2_journal_block_tag *tag;
+	char *meta = NULL, *esc, *buf;
+	struct iovec *iov = NULL, commit_iov;
+	int err = 0, nr_iov;
+
+	if (!journal || journal->j_committing)
+		return 0;
+
+	journal->j_committing = 1;
+
+	/* release freed blocks (bitmaps are logged in this transaction, blocks can be reused once it is committed) */
+	for (i = 0; i < journal->j_nr_frees; i++)
+		if (ext2_release_blocks(sb, journal->j_frees[i].start, journal->j_frees[i].count))
+			err = -EIO;
+
+	/* log dirty inodes and group descriptors */
+	vfs_sync_inodes(sb);
+	for (i = 0; i < sbi->s_gdb_count; i++)
+		if (sbi->s_group_desc[i]->b_dirt)
+			ext2_journal_dirty(sbi->s_group_desc[i]);
+
+	/* empty transaction */
+	if (!journal->j_nr_buffers && !journal->j_nr_revokes)
+		goto out;
+
+	/* keep revokes still valid (a block may be used again after being revoked) */
+	for (i = 0, nr_revokes = 0; i < journal->j_nr_revokes; i++) {
+		if (EXT2_JBITMAP_TEST(journal->j_revoked, journal->j_revokes[i])) {
+			EXT2_JBITMAP_CLR(journal->j_revoked, journal->j_revokes[i]);
+			journal->j_revokes[nr_revokes++] = journal->j_revokes[i];
+		}
+	}
+
+	/* compute log size (first tag of each descriptor carries journal uuid) */
+	tags_per_desc = (sb->s_blocksize - sizeof(struct ext2_journal_header) - 16) / sizeof(struct ext2_journal_block_tag);
+	revokes_per_block = (sb->s_blocksize - sizeof(struct ext2_journal_revoke_header)) / 4;
+	nr_desc = (journal->j_nr_buffers + tags_per_desc - 1) / tags_per_desc;
+	nr_revoke_blocks = (nr_revokes + revokes_per_block - 1) / revokes_per_block;
+	nr_log = nr_revoke_blocks + nr_desc + journal->j_nr_buffers + 1;
+
+	/* transaction doesn't fit in journal (can't happen with transactions size limit) */
+	if (nr_log > journal->j_last - journal->j_first) {
+		fprintf(stderr, "Ext2 : transaction too big for journal (%u blocks)\n", nr_log);
+		err = -ENOSPC;
+		goto checkpoint;
+	}
+
+	/* log doesn't fit before end of journal (or journal not used yet) : restart it */
+	if (!journal->j_tail_set || journal->j_head + nr_log > journal->j_last) {
+		err = ext2_journal_reset_log(sb);
+		if (err)
+			goto checkpoint;
+	}
+
+	/* count blocks starting with journal magic (they are logged escaped) */
+	for (i = 0, nr_escaped = 0; i < journal->j_nr_buffers; i++)
+		if (be32toh(*((uint32_t *) journal->j_buffers[i]->b_data)) == EXT2_JOURNAL_MAGIC)
+			nr_escaped++;
+
+	/* allocate revoke/descriptor/commit blocks, escaped blocks copies and I/O vectors */
+	meta = (char *) calloc(nr_revoke_blocks + nr_desc + 1 + nr_escaped, sb->s_blocksize);
+	iov = (struct iovec *) malloc(sizeof(struct iovec) * nr_log);
+	if (!meta || !iov) {
+		err = -ENOMEM;
+		goto checkpoint;
+	}
+
+	/* sort buffers (checkpoint writes them in order) */
+	qsort(journal->j_buffers, journal->j_nr_buffers, sizeof(struct buffer_head *), ext2_buffer_cmp);
+
+	/* build revoke blocks (escaped copies are stored after commit block) */
+	buf = meta;
+	esc = meta + (nr_revoke_blocks + nr_desc + 1) * sb->s_blocksize;
+	nr_iov = 0;
+	for (i = 0; i < nr_revoke_blocks; i++, buf += sb->s_blocksize) {
+		ext2_journal_set_header(buf, EXT2_JOURNAL_REVOKE_BLOCK, journal->j_sequence);
+		rh = (struct ext2_journal_revoke_header *) buf;
+
+		off = sizeof(struct ext2_journal_revoke_header);
+		for (j = i * revokes_per_block; j < nr_revokes && j < (i + 1) * revokes_per_block; j++, off += 4)
+			*((uint32_t *) (buf + off)) = htobe32(journal->j_revokes[j]);
+
+		rh->r_count = htobe32(off);
+		iov[nr_iov].iov_base = buf;
+		iov[nr_iov++].iov_len = sb->s_blocksize;
+	}
+
+	/* build descriptor blocks, each one followed by its logged blocks */
+	for (i = 0; i < nr_desc; i++, buf += sb->s_blocksize) {
+		ext2_journal_set_header(buf, EXT2_JOURNAL_DESCRIPTOR_BLOCK, journal->j_sequence);
+		iov[nr_iov].iov_base = buf;
+		iov[nr_iov++].iov_len = sb->s_blocksize;
+
+		off = sizeof(struct ext2_journal_header);
+		for (j = i * tags_per_desc; j < journal->j_nr_buffers && j < (i + 1) * tags_per_desc; j++) {
+			tag = (struct ext2_journal_block_tag *) (buf + off);
+			tag->t_blocknr = htobe32(journal->j_buffers[j]->b_block);
+			tag->t_flags = j == i * tags_per_desc ? 0 : EXT2_JOURNAL_FLAG_SAME_UUID;
+			if (j + 1 == journal->j_nr_buffers || j + 1 == (i + 1) * tags_per_desc)
+				tag->t_flags |= EXT2_JOURNAL_FLAG_LAST_TAG;
+
+			/* logged block */
+			iov[nr_iov].iov_base = journal->j_buffers[j]->b_data;
+			iov[nr_iov].iov_len = sb->s_blocksize;
+
+			/* block starts with journal magic : log an escaped copy */
+			if (be32toh(*((uint32_t *) journal->j_buffers[j]->b_data)) == EXT2_JOURNAL_MAGIC) {
+				memcpy(esc, journal->j_buffers[j]->b_data, sb->s_blocksize);
+				memset(esc, 0, 4);
+				iov[nr_iov].iov_base = esc;
+				esc += sb->s_blocksize;
+				tag->t_flags |= EXT2_JOURNAL_FLAG_ESCAPE;
+			}
+
+			tag->t_flags = htobe16(tag->t_flags);
+			nr_iov++;
+
+			/* journal uuid after first tag */
+			off += sizeof(struct ext2_journal_block_tag);
+			if (j == i * tags_per_desc) {
+				memcpy(buf + off, ext2_jsb(journal)->s_uuid, 16);
+				off += 16;
+			}
+		}
+	}
+
+	/* write log */
+	err = ext2_journal_write(sb, journal->j_head, iov, nr_iov);
+	if (err)
+		goto checkpoint;
+
+	/* logged blocks must be on disk before commit block */
+	fdatasync(sb->s_fd);
+
+	/* write commit block */
+	ext2_journal_set_header(buf, EXT2_JOURNAL_COMMIT_BLOCK, journal->j_sequence);
+	commit_iov.iov_base = buf;
+	commit_iov.iov_len = sb->s_blocksize;
+	err = ext2_journal_write(sb, journal->j_head + nr_iov, &commit_iov, 1);
+	if (err)
+		goto checkpoint;
+
+	/* transaction is committed */
+	fdatasync(sb->s_fd);
+	journal->j_head += nr_log;
+	journal->j_sequence++;
+
+checkpoint:
+	/* write logged blocks to their home locations and unpin them */
+	for (k = 0; k < journal->j_nr_buffers; k++) {
+		if (bwrite(journal->j_buffers[k]))
+			err = -EIO;
+
+		EXT2_JBITMAP_CLR(journal->j_in_trans, journal->j_buffers[k]->b_block);
+		EXT2_JBITMAP_SET(journal->j_logged, journal->j_buffers[k]->b_block);
+		journal->j_buffers[k]->b_ref--;
+	}
+
+	/* punch freed blocks out of image once they are not referenced by any committed state */
+	for (k = 0; k < journal->j_nr_frees; k++)
+		if (!err)
+			ext2_discard_blocks(sb, journal->j_frees[k].start, journal->j_frees[k].count);
+
+	journal->j_nr_buffers = 0;
+	journal->j_nr_revokes = 0;
+	free(meta);
+	free(iov);
+out:
+	journal->j_nr_frees = 0;
+	journal->j_committing = 0;
+	return err;
+}
@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "ext2.h"
@@ -14,6 +16,659 @@ static inline int ext2_name_match(const char *name, size_t len, struct ext2_dir_
 	return len == de->d_name_len && !memcmp(name, de->d_name, len);
 }
 
+/*
+ * Is a file name "." or ".." ?
+ */
+static inline int ext2_dot_name(const char *name, size_t len)
+{
+	return (len == 1 || len == 2) && name[0] == '.' && (len == 1 || name[1] == '.');
+}
+
+/*
+ * Ext2 directory index path (one frame per index level).
+ */
+struct ext2_dx_frame {
+	struct buffer_head *		bh;				/* index block */
+	struct ext2_dx_entry *		entries;			/* index entries */
+	struct ext2_dx_entry *		at;				/* followed entry */
+};
+
+/*
+ * Ext2 directory entry of a leaf block (used to split leaves).
+ */
+struct ext2_dx_map_entry {
+	uint32_t			hash;				/* name hash */
+	uint16_t			offs;				/* offset in block */
+	uint16_t			size;				/* entry size */
+};
+
+/*
+ * Is a directory indexed ?
+ */
+static inline int ext2_dx_dir(struct inode *dir)
+{
+	return (le32toh(ext2_sb(dir->i_sb)->s_es->s_feature_compat) & EXT2_FEATURE_COMPAT_DIR_INDEX)
+		&& (ext2_i(dir)->i_flags & EXT2_INDEX_FL);
+}
+
+/*
+ * Get number of entries of an index block.
+ */
+static inline int ext2_dx_count(struct ext2_dx_entry *entries)
+{
+	return le16toh(((struct ext2_dx_countlimit *) entries)->count);
+}
+
+/*
+ * Get max number of entries of an index block.
+ */
+static inline int ext2_dx_limit(struct ext2_dx_entry *entries)
+{
+	return le16toh(((struct ext2_dx_countlimit *) entries)->limit);
+}
+
+/*
+ * Set number of entries and max number of entries of an index block.
+ */
+static inline void ext2_dx_set_countlimit(struct ext2_dx_entry *entries, int count, int limit)
+{
+	((struct ext2_dx_countlimit *) entries)->count = htole16(count);
+	((struct ext2_dx_countlimit *) entries)->limit = htole16(limit);
+}
+
+/*
+ * Get directory block of an index entry.
+ */
+static inline uint32_t ext2_dx_block(struct ext2_dx_entry *entry)
+{
+	return le32toh(entry->block) & 0x0FFFFFFF;
+}
+
+/*
+ * Init an index node block (a fake empty entry hides index entries from directory walkers).
+ */
+static struct ext2_dx_entry *ext2_dx_init_node(struct buffer_head *bh)
+{
+	struct ext2_dir_entry *de = (struct ext2_dir_entry *) bh->b_data;
+
+	memset(bh->b_data, 0, bh->b_size);
+	de->d_inode = 0;
+	de->d_rec_len = htole16(bh->b_size);
+	bh->b_dirt = 1;
+
+	return (struct ext2_dx_entry *) (bh->b_data + EXT2_DIR_REC_LEN(0));
+}
+
+/*
+ * Release directory index path.
+ */
+static void ext2_dx_release(struct ext2_dx_frame *frames, struct ext2_dx_frame *frame)
+{
+	for (; frame >= frames; frame--)
+		brelse(frame->bh);
+}
+
+/*
+ * Walk directory index down to the leaf block of a name (returns deepest frame or NULL if index is bad).
+ */
+static struct ext2_dx_frame *ext2_dx_probe(struct inode *dir, const char *name, size_t name_len, uint32_t *hash,
+					   int *hash_version, struct ext2_dx_frame *frames)
+{
+	struct ext2_sb_info *sbi = ext2_sb(dir->i_sb);
+	struct ext2_dx_frame *frame = frames;
+	struct ext2_dx_entry *entries, *p, *q, *m;
+	struct ext2_dx_root_info *info;
+	struct buffer_head *bh;
+	int levels, count;
+
+	/* read root block */
+	bh = ext2_bread(dir, 0, 0);
+	if (!bh)
+		return NULL;
+
+	/* check root info */
+	info = (struct ext2_dx_root_info *) (bh->b_data + EXT2_DIR_REC_LEN(1) + EXT2_DIR_REC_LEN(2));
+	if (info->reserved_zero || info->info_length < sizeof(struct ext2_dx_root_info)
+	    || info->indirect_levels >= EXT2_HTREE_MAX_LEVELS || info->hash_version > EXT2_HASH_TEA)
+		goto err_bad;
+
+	/* compute name hash */
+	*hash_version = info->hash_version + sbi->s_hash_unsigned;
+	if (ext2_dirhash(name, name_len, *hash_version, sbi->s_hash_seed, hash))
+		goto err_bad;
+
+	/* walk index levels */
+	entries = (struct ext2_dx_entry *) ((char *) info + info->info_length);
+	for (levels = info->indirect_levels;; levels--) {
+		/* check number of entries */
+		count = ext2_dx_count(entries);
+		if (!count || count > ext2_dx_limit(entries)
+		    || ext2_dx_limit(entries) != (bh->b_data + bh->b_size - (char *) entries) / sizeof(struct ext2_dx_entry))
+			goto err_bad;
+
+		/* find last entry with a lower or equal hash (first entry has no hash) */
+		for (p = entries + 1, q = entries + count - 1; p <= q;) {
+			m = p + (q - p) / 2;
+			if (le32toh(m->hash) > *hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+
+		/* set frame */
+		frame->bh = bh;
+		frame->entries = entries;
+		frame->at = p - 1;
+		if (!levels)
+			return frame;
+
+		/* read next level */
+		frame++;
+		bh = ext2_bread(dir, ext2_dx_block(frame[-1].at), 0);
+		if (!bh)
+			goto err_release;
+		entries = (struct ext2_dx_entry *) (bh->b_data + EXT2_DIR_REC_LEN(0));
+	}
+
+err_bad:
+	fprintf(stderr, "Ext2 : bad directory index (inode = %ld)\n", dir->i_ino);
+	brelse(bh);
+err_release:
+	ext2_dx_release(frames, frame - 1);
+	return NULL;
+}
+
+/*
+ * Go to next leaf block if it continues a hash (hash collision between blocks). Returns 1 if so.
+ */
+static int ext2_dx_next_leaf(struct inode *dir, uint32_t hash, struct ext2_dx_frame *frames, struct ext2_dx_frame *frame)
+{
+	struct ext2_dx_frame *p = frame;
+	struct buffer_head *bh;
+	int nr_levels = 0;
+
+	/* find a level with a next entry */
+	for (;;) {
+		if (p->at + 1 < p->entries + ext2_dx_count(p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		p--;
+		nr_levels++;
+	}
+
+	/* next block must start with same hash (collision bit set) */
+	if ((le32toh(p->at[1].hash) & ~1) != hash)
+		return 0;
+	p->at++;
+
+	/* reload lower levels */
+	for (; nr_levels > 0; nr_levels--) {
+		bh = ext2_bread(dir, ext2_dx_block(p->at), 0);
+		if (!bh)
+			return 0;
+
+		p++;
+		brelse(p->bh);
+		p->bh = bh;
+		p->entries = (struct ext2_dx_entry *) (bh->b_data + EXT2_DIR_REC_LEN(0));
+		p->at = p->entries;
+	}
+
+	return 1;
+}
+
+/*
+ * Find a Ext2 entry in a directory block.
+ */
+static struct ext2_dir_entry *ext2_find_entry_block(struct buffer_head *bh, const char *name, size_t name_len)
+{
+	struct ext2_dir_entry *de;
+	uint32_t offset;
+
+	for (offset = 0; offset < bh->b_size; offset += le16toh(de->d_rec_len)) {
+		de = (struct ext2_dir_entry *) (bh->b_data + offset);
+		if (!le16toh(de->d_rec_len))
+			return NULL;
+
+		if (ext2_name_match(name, name_len, de))
+			return de;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a Ext2 entry in an indexed directory (err is set if index is bad).
+ */
+static struct buffer_head *ext2_dx_find_entry(struct inode *dir, const char *name, size_t name_len,
+					      struct ext2_dir_entry **res_de, int *err)
+{
+	struct ext2_dx_frame frames[EXT2_HTREE_MAX_LEVELS], *frame;
+	struct buffer_head *bh = NULL;
+	int hash_version;
+	uint32_t hash;
+
+	/* walk index */
+	frame = ext2_dx_probe(dir, name, name_len, &hash, &hash_version, frames);
+	if (!frame) {
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	/* search leaf block (and next ones on hash collision) */
+	*err = 0;
+	do {
+		bh = ext2_bread(dir, ext2_dx_block(frame->at), 0);
+		if (!bh)
+			break;
+
+		*res_de = ext2_find_entry_block(bh, name, name_len);
+		if (*res_de)
+			break;
+
+		brelse(bh);
+		bh = NULL;
+	} while (ext2_dx_next_leaf(dir, hash, frames, frame));
+
+	ext2_dx_release(frames, frame);
+	return bh;
+}
+
+/*
+ * Add a Ext2 entry in a directory block (returns -ENOSPC if block is full).
+ */
+static int ext2_add_entry_block(struct buffer_head *bh, const char *name, size_t name_len, struct inode *inode)
+{
+	uint16_t rec_len = EXT2_DIR_REC_LEN(name_len);
+	struct ext2_dir_entry *de, *de1;
+	uint32_t offset;
+
+	for (offset = 0; offset < bh->b_size; offset += le16toh(de->d_rec_len)) {
+		de = (struct ext2_dir_entry *) (bh->b_data + offset);
+		if (!le16toh(de->d_rec_len))
+			return -EIO;
+
+		/* free entry with enough space */
+		if ((!le32toh(de->d_inode) && le16toh(de->d_rec_len) >= rec_len)
+		    || (le32toh(de->d_inode) && le16toh(de->d_rec_len) >= EXT2_DIR_REC_LEN(de->d_name_len) + rec_len)) {
+			/* used entry : split it */
+			if (le32toh(de->d_inode)) {
+				de1 = (struct ext2_dir_entry *) ((char *) de + EXT2_DIR_REC_LEN(de->d_name_len));
+				de1->d_rec_len = htole16(le16toh(de->d_rec_len) - EXT2_DIR_REC_LEN(de->d_name_len));
+				de->d_rec_len = htole16(EXT2_DIR_REC_LEN(de->d_name_len));
+				de = de1;
+			}
+
+			/* set new entry */
+			de->d_inode = htole32(inode->i_ino);
+			de->d_name_len = name_len;
+			ext2_set_de_type(inode->i_sb, de, inode->i_mode);
+			memcpy(de->d_name, name, name_len);
+			bh->b_dirt = 1;
+
+			return 0;
+		}
+	}
+
+	return -ENOSPC;
+}
+
+/*
+ * Append a block to a Ext2 directory.
+ */
+static struct buffer_head *ext2_append_block(struct inode *dir, uint32_t *block)
+{
+	struct buffer_head *bh;
+
+	/* allocate block */
+	*block = dir->i_size / dir->i_sb->s_blocksize;
+	bh = ext2_bread(dir, *block, 1);
+	if (!bh)
+		return NULL;
+
+	/* update directory size */
+	dir->i_size += dir->i_sb->s_blocksize;
+	dir->i_dirt = 1;
+
+	return bh;
+}
+
+/*
+ * Insert an index entry after followed entry.
+ */
+static void ext2_dx_insert(struct ext2_dx_frame *frame, uint32_t hash, uint32_t block)
+{
+	struct ext2_dx_entry *new = frame->at + 1;
+	int count = ext2_dx_count(frame->entries);
+
+	memmove(new + 1, new, (char *) (frame->entries + count) - (char *) new);
+	new->hash = htole32(hash);
+	new->block = htole32(block);
+	ext2_dx_set_countlimit(frame->entries, count + 1, ext2_dx_limit(frame->entries));
+	frame->bh->b_dirt = 1;
+}
+
+/*
+ * Compare 2 leaf entries hashes.
+ */
+static int ext2_dx_map_cmp(const void *a, const void *b)
+{
+	const struct ext2_dx_map_entry *m1 = a, *m2 = b;
+
+	return m1->hash < m2->hash ? -1 : m1->hash > m2->hash;
+}
+
+/*
+ * Pack entries of a leaf block copy into a block (last entry gets remaining space).
+ */
+static void ext2_dx_pack_entries(struct buffer_head *bh, const char *from, struct ext2_dx_map_entry *map, int count)
+{
+	struct ext2_dir_entry *de = (struct ext2_dir_entry *) bh->b_data;
+	uint32_t offset = 0;
+	int i;
+
+	/* copy entries */
+	memset(bh->b_data, 0, bh->b_size);
+	for (i = 0; i < count; i++) {
+		de = (struct ext2_dir_entry *) (bh->b_data + offset);
+		memcpy(de, from + map[i].offs, map[i].size);
+		de->d_rec_len = htole16(map[i].size);
+		offset += map[i].size;
+	}
+
+	/* last entry gets remaining space */
+	de->d_rec_len = htole16(bh->b_size - ((char *) de - bh->b_data));
+	bh->b_dirt = 1;
+}
+
+/*
+ * Split a full leaf block : upper half of hashes moves to a new block.
+ * Returns block where hash must go (bh is released in all cases, NULL on error).
+ */
+static struct buffer_head *ext2_dx_split_leaf(struct inode *dir, struct ext2_dx_frame *frame, struct buffer_head *bh,
+					      uint32_t hash, int hash_version)
+{
+	struct ext2_sb_info *sbi = ext2_sb(dir->i_sb);
+	struct ext2_dx_map_entry *map = NULL;
+	struct buffer_head *bh2 = NULL;
+	uint32_t offset, size, hash2, block2;
+	struct ext2_dir_entry *de;
+	int count = 0, split;
+	char *data = NULL;
+
+	/* allocate a copy of block and a map of its entries */
+	data = (char *) malloc(bh->b_size);
+	map = (struct ext2_dx_map_entry *) malloc(sizeof(struct ext2_dx_map_entry) * (bh->b_size / EXT2_DIR_REC_LEN(1)));
+	if (!data || !map)
+		goto err;
+
+	/* map used entries */
+	memcpy(data, bh->b_data, bh->b_size);
+	for (offset = 0; offset < bh->b_size; offset += le16toh(de->d_rec_len)) {
+		de = (struct ext2_dir_entry *) (data + offset);
+		if (!le16toh(de->d_rec_len))
+			goto err;
+
+		if (le32toh(de->d_inode)) {
+			ext2_dirhash(de->d_name, de->d_name_len, hash_version, sbi->s_hash_seed, &map[count].hash);
+			map[count].offs = offset;
+			map[count].size = EXT2_DIR_REC_LEN(de->d_name_len);
+			count++;
+		}
+	}
+
+	/* can't split less than 2 entries */
+	if (count < 2)
+		goto err;
+
+	/* sort entries by hash and move upper half (in bytes) */
+	qsort(map, count, sizeof(struct ext2_dx_map_entry), ext2_dx_map_cmp);
+	for (size = 0, split = count - 1; split > 0; split--) {
+		if (size + map[split].size / 2 > bh->b_size / 2)
+			break;
+		size += map[split].size;
+	}
+	split = split + 1 < count ? split + 1 : count - 1;
+	hash2 = map[split].hash;
+
+	/* allocate new leaf */
+	bh2 = ext2_append_block(dir, &block2);
+	if (!bh2)
+		goto err;
+
+	/* rewrite both leaves */
+	ext2_dx_pack_entries(bh, data, map, split);
+	ext2_dx_pack_entries(bh2, data, map + split, count - split);
+
+	/* add new leaf to index (set collision bit if same hash is in both blocks) */
+	ext2_dx_insert(frame, hash2 + (hash2 == map[split - 1].hash), block2);
+
+	free(data);
+	free(map);
+
+	/* return block where new entry must go */
+	if (hash >= hash2) {
+		brelse(bh);
+		return bh2;
+	}
+
+	brelse(bh2);
+	return bh;
+err:
+	free(data);
+	free(map);
+	brelse(bh);
+	return NULL;
+}
+
+/*
+ * Make room in a full index block (add a level or split index node).
+ */
+static int ext2_dx_grow_index(struct inode *dir, struct ext2_dx_frame *frames, struct ext2_dx_frame **frame)
+{
+	struct ext2_dx_entry *entries = (*frame)->entries, *entries2;
+	int count = ext2_dx_count(entries), count1, limit;
+	struct ext2_dx_root_info *info;
+	struct buffer_head *bh2;
+	uint32_t block2;
+
+	/* allocate a new index node */
+	bh2 = ext2_append_block(dir, &block2);
+	if (!bh2)
+		return -ENOSPC;
+	entries2 = ext2_dx_init_node(bh2);
+	limit = (dir->i_sb->s_blocksize - EXT2_DIR_REC_LEN(0)) / sizeof(struct ext2_dx_entry);
+
+	/* full root : move its entries to the new node and add a level */
+	if (*frame == frames) {
+		info = (struct ext2_dx_root_info *) (frames->bh->b_data + EXT2_DIR_REC_LEN(1) + EXT2_DIR_REC_LEN(2));
+		if (info->indirect_levels + 1 >= EXT2_HTREE_MAX_LEVELS) {
+			brelse(bh2);
+			return -ENOSPC;
+		}
+
+		/* copy root entries to node */
+		memcpy(entries2, entries, count * sizeof(struct ext2_dx_entry));
+		ext2_dx_set_countlimit(entries2, count, limit);
+
+		/* root points to node only */
+		ext2_dx_set_countlimit(entries, 1, ext2_dx_limit(entries));
+		entries[0].block = htole32(block2);
+		info->indirect_levels++;
+		frames->bh->b_dirt = 1;
+
+		/* update path */
+		frames[1].bh = bh2;
+		frames[1].entries = entries2;
+		frames[1].at = entries2 + (frames->at - entries);
+		frames->at = entries;
+		*frame = frames + 1;
+		return 0;
+	}
+
+	/* full node : parent must have room */
+	if (ext2_dx_count(frames->entries) >= ext2_dx_limit(frames->entries)) {
+		fprintf(stderr, "Ext2 : directory index full (inode = %ld)\n", dir->i_ino);
+		brelse(bh2);
+		return -ENOSPC;
+	}
+
+	/* move upper half of entries to new node */
+	count1 = count / 2;
+	memcpy(entries2, entries + count1, (count - count1) * sizeof(struct ext2_dx_entry));
+	ext2_dx_set_countlimit(entries2, count - count1, limit);
+	ext2_dx_set_countlimit(entries, count1, ext2_dx_limit(entries));
+	(*frame)->bh->b_dirt = 1;
+
+	/* add new node to parent */
+	ext2_dx_insert(frames, le32toh(entries[count1].hash), block2);
+
+	/* follow new node if needed */
+	if ((*frame)->at >= entries + count1) {
+		brelse((*frame)->bh);
+		(*frame)->bh = bh2;
+		(*frame)->at = entries2 + ((*frame)->at - entries - count1);
+		(*frame)->entries = entries2;
+	} else {
+		brelse(bh2);
+	}
+
+	return 0;
+}
+
+/*
+ * Add a Ext2 entry in an indexed directory (returns -EINVAL if index is bad).
+ */
+static int ext2_dx_add_entry(struct inode *dir, const char *name, size_t name_len, struct inode *inode)
+{
+	struct ext2_dx_frame frames[EXT2_HTREE_MAX_LEVELS], *frame;
+	struct buffer_head *bh;
+	int hash_version, err;
+	uint32_t hash;
+
+	/* walk index */
+	frame = ext2_dx_probe(dir, name, name_len, &hash, &hash_version, frames);
+	if (!frame)
+		return -EINVAL;
+
+	/* try to add entry in leaf block */
+	bh = ext2_bread(dir, ext2_dx_block(frame->at), 0);
+	if (!bh) {
+		err = -EIO;
+		goto out;
+	}
+	err = ext2_add_entry_block(bh, name, name_len, inode);
+	if (err != -ENOSPC)
+		goto out_release;
+
+	/* leaf is full : make room in index first */
+	if (ext2_dx_count(frame->entries) >= ext2_dx_limit(frame->entries)) {
+		err = ext2_dx_grow_index(dir, frames, &frame);
+		if (err)
+			goto out_release;
+	}
+
+	/* split leaf and add entry */
+	bh = ext2_dx_split_leaf(dir, frame, bh, hash, hash_version);
+	if (!bh) {
+		err = -ENOSPC;
+		goto out;
+	}
+	err = ext2_add_entry_block(bh, name, name_len, inode);
+out_release:
+	brelse(bh);
+out:
+	ext2_dx_release(frames, frame);
+	return err;
+}
+
+/*
+ * Convert a full one block Ext2 directory to an indexed directory.
+ */
+static int ext2_dx_make_indexed(struct inode *dir)
+{
+	struct ext2_sb_info *sbi = ext2_sb(dir->i_sb);
+	struct ext2_dir_entry *de, *de1;
+	struct ext2_dx_root_info *info;
+	struct ext2_dx_entry *entries;
+	struct buffer_head *bh, *bh1;
+	uint32_t offset, block1;
+	uint8_t dotdot_type;
+	ino_t dotdot;
+
+	/* read first block */
+	bh = ext2_bread(dir, 0, 0);
+	if (!bh)
+		return -EIO;
+
+	/* first 2 entries must be '.' and '..' */
+	de = (struct ext2_dir_entry *) bh->b_data;
+	de1 = (struct ext2_dir_entry *) (bh->b_data + le16toh(de->d_rec_len));
+	if (de->d_name_len != 1 || de->d_name[0] != '.' || le16toh(de->d_rec_len) > bh->b_size - EXT2_DIR_REC_LEN(2)
+	    || de1->d_name_len != 2 || de1->d_name[0] != '.' || de1->d_name[1] != '.') {
+		brelse(bh);
+		return -EINVAL;
+	}
+
+	/* move other entries to a new block */
+	bh1 = ext2_append_block(dir, &block1);
+	if (!bh1) {
+		brelse(bh);
+		return -ENOSPC;
+	}
+	offset = le16toh(de->d_rec_len) + le16toh(de1->d_rec_len);
+	memcpy(bh1->b_data, bh->b_data + offset, bh->b_size - offset);
+
+	/* last moved entry gets space of '.' and '..' */
+	if (offset < bh->b_size) {
+		for (de = (struct ext2_dir_entry *) bh1->b_data;
+		     (char *) de + le16toh(de->d_rec_len) < bh1->b_data + bh->b_size - offset;
+		     de = (struct ext2_dir_entry *) ((char *) de + le16toh(de->d_rec_len)));
+		de->d_rec_len = htole16(le16toh(de->d_rec_len) + offset);
+	} else {
+		de = (struct ext2_dir_entry *) bh1->b_data;
+		de->d_inode = 0;
+		de->d_rec_len = htole16(bh1->b_size);
+	}
+	bh1->b_dirt = 1;
+	brelse(bh1);
+
+	/* rebuild '.' and '..' entries (dot dot covers the rest of block) */
+	dotdot = le32toh(de1->d_inode);
+	dotdot_type = de1->d_fileype;
+	de = (struct ext2_dir_entry *) bh->b_data;
+	de->d_rec_len = htole16(EXT2_DIR_REC_LEN(1));
+	memset(bh->b_data + EXT2_DIR_REC_LEN(1), 0, bh->b_size - EXT2_DIR_REC_LEN(1));
+	de1 = (struct ext2_dir_entry *) (bh->b_data + EXT2_DIR_REC_LEN(1));
+	de1->d_inode = htole32(dotdot);
+	de1->d_rec_len = htole16(bh->b_size - EXT2_DIR_REC_LEN(1));
+	de1->d_name_len = 2;
+	de1->d_fileype = dotdot_type;
+	memcpy(de1->d_name, "..", 2);
+
+	/* set root info */
+	info = (struct ext2_dx_root_info *) (bh->b_data + EXT2_DIR_REC_LEN(1) + EXT2_DIR_REC_LEN(2));
+	info->reserved_zero = 0;
+	info->hash_version = sbi->s_def_hash_version <= EXT2_HASH_TEA ? sbi->s_def_hash_version : EXT2_HASH_HALF_MD4;
+	info->info_length = sizeof(struct ext2_dx_root_info);
+	info->indirect_levels = 0;
+	info->unused_flags = 0;
+
+	/* root points to new block */
+	entries = (struct ext2_dx_entry *) (info + 1);
+	ext2_dx_set_countlimit(entries, 1, (bh->b_data + bh->b_size - (char *) entries) / sizeof(struct ext2_dx_entry));
+	entries[0].block = htole32(block1);
+	bh->b_dirt = 1;
+	brelse(bh);
+
+	/* mark directory indexed */
+	ext2_i(dir)->i_flags |= EXT2_INDEX_FL;
+	dir->i_dirt = 1;
+
+	return 0;
+}
+
 /*
  * Find a Ext2 entry in a directory.
  */
@@ -22,6 +677,14 @@ static struct buffer_head *ext2_find_entry(struct inode *dir, const char *name,
 	struct buffer_head *bh = NULL;
 	struct ext2_dir_entry *de;
 	uint32_t offset, block, pos;
+	int err;
+
+	/* indexed directory (fall back to linear search if index is bad, "." and ".." are not indexed : found in block 0) */
+	if (ext2_dx_dir(dir) && !ext2_dot_name(name, name_len)) {
+		bh = ext2_dx_find_entry(dir, name, name_len, res_de, &err);
+		if (!err)
+			return bh;
+	}
 
 	/* read block by block */
 	for (block = 0, offset = 0, pos = 0; pos < dir->i_size; block++) {
@@ -74,11 +737,22 @@ static int ext2_add_entry(struct inode *dir, const char *name, size_t name_len,
 	struct buffer_head *bh = NULL;
 	uint16_t rec_len;
 	uint32_t offset;
+	int err;
 
 	/* truncate name if needed */
 	if (name_len > EXT2_NAME_LEN)
 		name_len = EXT2_NAME_LEN;
 
+	/* indexed directory (drop index and fall back to linear insertion if it is bad) */
+	if (ext2_dx_dir(dir)) {
+		err = ext2_dx_add_entry(dir, name, name_len, inode);
+		if (err != -EINVAL)
+			goto out;
+
+		ext2_i(dir)->i_flags &= ~EXT2_INDEX_FL;
+		dir->i_dirt = 1;
+	}
+
 	/* compute record length */
 	rec_len = EXT2_DIR_REC_LEN(name_len);
 
@@ -94,6 +768,14 @@ static int ext2_add_entry(struct inode *dir, const char *name, size_t name_len,
 			/* release previous block */
 			brelse(bh);
 
+			/* full one block directory : index it */
+			if (offset >= dir->i_size && offset == dir->i_sb->s_blocksize
+			    && (le32toh(ext2_sb(dir->i_sb)->s_es->s_feature_compat) & EXT2_FEATURE_COMPAT_DIR_INDEX)
+			    && ext2_dx_make_indexed(dir) == 0) {
+				err = ext2_dx_add_entry(dir, name, name_len, inode);
+				goto out;
+			}
+
 			/* read next block */
 			bh = ext2_bread(dir, offset / dir->i_sb->s_blocksize, 1);
 			if (!bh)
@@ -141,18 +823,21 @@ found_entry:
 	/* set new entry */
 	de->d_inode = htole32(inode->i_ino);
 	de->d_name_len = name_len;
-	de->d_fileype = 0;
+	ext2_set_de_type(dir->i_sb, de, inode->i_mode);
 	memcpy(de->d_name, name, name_len);
 
 	/* mark buffer dirty and release it */
 	bh->b_dirt = 1;
 	brelse(bh);
-
+	err = 0;
+out:
 	/* update parent directory */
-	dir->i_mtime = dir->i_ctime = current_time();
-	dir->i_dirt = 1;
+	if (!err) {
+		dir->i_mtime = dir->i_ctime = current_time();
+		dir->i_dirt = 1;
+	}
 
-	return 0;
+	return err;
 }
 
 /*
@@ -294,6 +979,11 @@ int ext2_lookup(struct inode *dir, const char *name, size_t name_len, struct ino
 	/* get inode number */
 	ino = le32toh(de->d_inode);
 
+	/* second lookup in this directory block : assume a scan and prefetch inodes of the block */
+	if (bh->b_block == ext2_i(dir)->i_lookup_block && bh->b_block != ext2_i(dir)->i_ra_block)
+		ext2_prefetch_inodes(dir, bh);
+	ext2_i(dir)->i_lookup_block = bh->b_block;
+
 	/* release block buffer */
 	brelse(bh);
 
@@ -322,6 +1012,15 @@ int ext2_create(struct inode *dir, const char *name, size_t name_len, mode_t mod
 	if (!dir)
 		return -ENOENT;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* check if file already exists */
 	dir->i_ref++;
 	if (ext2_lookup(dir, name, name_len, &tmp) == 0) {
@@ -377,6 +1076,15 @@ int ext2_mkdir(struct inode *dir, const char *name, size_t name_len, mode_t mode
 	struct inode *inode;
 	int err;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* check if file exists */
 	bh = ext2_find_entry(dir, name, name_len, &de);
 	if (bh) {
@@ -412,13 +1120,15 @@ int ext2_mkdir(struct inode *dir, const char *name, size_t name_len, mode_t mode
 	de->d_inode = htole32(inode->i_ino);
 	de->d_name_len = 1;
 	de->d_rec_len = htole16(EXT2_DIR_REC_LEN(de->d_name_len));
+	ext2_set_de_type(inode->i_sb, de, S_IFDIR);
 	strcpy(de->d_name, ".");
 
-	/* add '.' entry */
+	/* add '..' entry */
 	de = (struct ext2_dir_entry *) ((char *) de + le16toh(de->d_rec_len));
 	de->d_inode = htole32(dir->i_ino);
 	de->d_name_len = 2;
 	de->d_rec_len = htole16(inode->i_sb->s_blocksize - EXT2_DIR_REC_LEN(1));
+	ext2_set_de_type(inode->i_sb, de, S_IFDIR);
 	strcpy(de->d_name, "..");
 
 	/* release first block */
@@ -456,6 +1166,15 @@ int ext2_rmdir(struct inode *dir, const char *name, size_t name_len)
 	ino_t ino;
 	int err;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* check if file exists */
 	bh = ext2_find_entry(dir, name, name_len, &de);
 	if (!bh) {
@@ -525,6 +1244,16 @@ int ext2_link(struct inode *old_inode, struct inode *dir, const char *name, size
 	struct buffer_head *bh;
 	int err;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(old_inode);
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* check if new file exists */
 	bh = ext2_find_entry(dir, name, name_len, &de);
 	if (bh) {
@@ -564,6 +1293,15 @@ int ext2_unlink(struct inode *dir, const char *name, size_t name_len)
 	struct inode *inode;
 	ino_t ino, err = 0;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* get directory entry */
 	bh = ext2_find_entry(dir, name, name_len, &de);
 	if (!bh) {
@@ -620,8 +1358,18 @@ int ext2_symlink(struct inode *dir, const char *name, size_t name_len, const cha
 	struct ext2_dir_entry *de;
 	struct buffer_head *bh;
 	struct inode *inode;
+	size_t len;
 	int err, i;
 
+	/* read only file system */
+	if (ext2_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(dir->i_sb);
+
 	/* create a new inode */
 	inode = ext2_new_inode(dir, S_IFLNK);
 	if (!inode) {
@@ -634,6 +1382,15 @@ int ext2_symlink(struct inode *dir, const char *name, size_t name_len, const cha
 	inode->i_mode = S_IFLNK | 0777;
 	inode->i_dirt = 1;
 
+	/* short target : store it in block pointers (fast symlink) */
+	len = strlen(target);
+	if (len < sizeof(ext2_i(inode)->i_data)) {
+		memset(ext2_i(inode)->i_data, 0, sizeof(ext2_i(inode)->i_data));
+		memcpy(ext2_i(inode)->i_data, target, len);
+		i = len;
+		goto out_size;
+	}
+
 	/* read/create first block */
 	bh = ext2_bread(inode, 0, 1);
 	if(!bh) {
@@ -650,6 +1407,7 @@ int ext2_symlink(struct inode *dir, const char *name, size_t name_len, const cha
 	bh->b_dirt = 1;
 	brelse(bh);
 
+out_size:
 	/* update inode size */
 	inode->i_size = i;
 	inode->i_dirt = 1;
@@ -690,6 +1448,16 @@ int ext2_rename(struct inode *old_dir, const char *old_name, size_t old_name_len
 	ino_t old_ino, new_ino;
 	int err;
 
+	/* read only file system */
+	if (ext2_rdonly(old_dir->i_sb)) {
+		vfs_iput(old_dir);
+		vfs_iput(new_dir);
+		return -EROFS;
+	}
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(old_dir->i_sb);
+
 	/* find old entry */
 	old_bh = ext2_find_entry(old_dir, old_name, old_name_len, &old_de);
 	if (!old_bh) {
@@ -728,6 +1496,8 @@ int ext2_rename(struct inode *old_dir, const char *old_name, size_t old_name_len
 
 		/* modify new directory entry inode */
 		new_de->d_inode = htole32(old_inode->i_ino);
+		ext2_set_de_type(new_dir->i_sb, new_de, old_inode->i_mode);
+		new_bh->b_dirt = 1;
 
 		/* update new inode */
 		new_inode->i_nlinks--;
@@ -738,6 +1508,16 @@ int ext2_rename(struct inode *old_dir, const char *old_name, size_t old_name_len
 		err = ext2_add_entry(new_dir, new_name, new_name_len, old_inode);
 		if (err)
 			goto out;
+
+		/* old entry may have moved if an index leaf was split */
+		if (old_dir == new_dir && ext2_dx_dir(old_dir)) {
+			brelse(old_bh);
+			old_bh = ext2_find_entry(old_dir, old_name, old_name_len, &old_de);
+			if (!old_bh) {
+				err = -ENOENT;
+				goto out;
+			}
+		}
 	}
 
 	/* remove old directory entry */
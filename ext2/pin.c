@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ext2.h"
+
+/*
+ * Compare two block numbers.
+ */
+static int ext2_pin_cmp(const void *a, const void *b)
+{
+	uint32_t b1 = *((const uint32_t *) a), b2 = *((const uint32_t *) b);
+
+	return b1 < b2 ? -1 : b1 > b2;
+}
+
+/*
+ * Add a block to pinned blocks (holes, invalid blocks and blocks above limit are skipped).
+ */
+static void ext2_pin_add(struct inode *inode, uint32_t block)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+
+	if (!block || block >= le32toh(ext2_sb(inode->i_sb)->s_es->s_blocks_count))
+		return;
+
+	if (pin->p_nr_blocks < EXT2_PIN_MAX_BLOCKS)
+		pin->p_blocks[pin->p_nr_blocks++] = block;
+}
+
+/*
+ * Add blocks addressed by pinned blocks [first, last[.
+ */
+static int ext2_pin_add_children(struct inode *inode, uint32_t first, uint32_t last)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+	int addr_per_block = inode->i_sb->s_blocksize / 4, i;
+	struct buffer_head *bh;
+	uint32_t *blocks;
+
+	/* read parents at once */
+	sb_breadahead(inode->i_sb, &pin->p_blocks[first], last - first);
+
+	for (; first < last; first++) {
+		bh = sb_bread(inode->i_sb, pin->p_blocks[first]);
+		if (!bh)
+			return -EIO;
+
+		blocks = (uint32_t *) bh->b_data;
+		for (i = 0; i < addr_per_block; i++)
+			ext2_pin_add(inode, blocks[i]);
+
+		brelse(bh);
+	}
+
+	return 0;
+}
+
+/*
+ * Release pinned blocks arena of a Ext2 inode.
+ */
+static void ext2_pin_release(struct inode *inode)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+
+	free(pin->p_blocks);
+	free(pin->p_data);
+	pin->p_blocks = NULL;
+	pin->p_data = NULL;
+	pin->p_nr_blocks = 0;
+}
+
+/*
+ * Read indirect blocks of a Ext2 inode in pinned blocks arena (upper levels are pinned first).
+ */
+static int ext2_pin_load(struct inode *inode)
+{
+	struct ext2_inode_info *ext2_inode = ext2_i(inode);
+	struct ext2_pin *pin = &ext2_inode->i_pin;
+	uint32_t blocksize = inode->i_sb->s_blocksize, dind, tind, start, i, j, n, *blocks;
+	struct buffer_head *bh;
+	int err;
+
+	/* extent mapped files have no indirect blocks */
+	if (ext2_inode_has_extents(inode))
+		return 0;
+
+	/* allocate blocks numbers */
+	pin->p_nr_blocks = 0;
+	pin->p_blocks = (uint32_t *) malloc(sizeof(uint32_t) * EXT2_PIN_MAX_BLOCKS);
+	if (!pin->p_blocks)
+		return -ENOMEM;
+
+	/* indirect, double indirect and triple indirect blocks of inode */
+	ext2_pin_add(inode, ext2_inode->i_data[EXT2_IND_BLOCK]);
+	dind = pin->p_nr_blocks;
+	ext2_pin_add(inode, ext2_inode->i_data[EXT2_DIND_BLOCK]);
+	tind = pin->p_nr_blocks;
+	ext2_pin_add(inode, ext2_inode->i_data[EXT2_TIND_BLOCK]);
+
+	/* double indirect blocks addressed by triple indirect block */
+	start = pin->p_nr_blocks;
+	err = tind < start ? ext2_pin_add_children(inode, tind, tind + 1) : 0;
+	if (err)
+		goto err;
+
+	/* indirect blocks addressed by these double indirect blocks and by double indirect block */
+	n = pin->p_nr_blocks;
+	err = ext2_pin_add_children(inode, start, n);
+	if (!err && dind < tind)
+		err = ext2_pin_add_children(inode, dind, dind + 1);
+	if (err)
+		goto err;
+
+	/* nothing to pin */
+	if (!pin->p_nr_blocks)
+		goto err;
+
+	/* sort blocks numbers (lookups are done by binary search) */
+	qsort(pin->p_blocks, pin->p_nr_blocks, sizeof(uint32_t), ext2_pin_cmp);
+
+	/* shrink blocks numbers */
+	blocks = (uint32_t *) realloc(pin->p_blocks, sizeof(uint32_t) * pin->p_nr_blocks);
+	if (blocks)
+		pin->p_blocks = blocks;
+
+	/* allocate arena */
+	pin->p_data = (char *) malloc((size_t) pin->p_nr_blocks * blocksize);
+	if (!pin->p_data) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	/* copy blocks in arena (read through buffer cache, by chunks) */
+	for (i = 0; i < pin->p_nr_blocks; i += n) {
+		n = pin->p_nr_blocks - i < EXT2_PIN_CHUNK ? pin->p_nr_blocks - i : EXT2_PIN_CHUNK;
+		sb_breadahead(inode->i_sb, &pin->p_blocks[i], n);
+
+		for (j = i; j < i + n; j++) {
+			bh = sb_bread(inode->i_sb, pin->p_blocks[j]);
+			if (!bh) {
+				err = -EIO;
+				goto err;
+			}
+
+			memcpy(pin->p_data + (size_t) j * blocksize, bh->b_data, blocksize);
+			brelse(bh);
+		}
+	}
+
+	return 0;
+err:
+	ext2_pin_release(inode);
+	return err;
+}
+
+/*
+ * Pin indirect blocks of a Ext2 inode (blocks are read at first open).
+ */
+void ext2_pin_indirect(struct inode *inode)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+
+	/* a failed load only disables pinning */
+	if (pin->p_count++ == 0 && ext2_pin_load(inode))
+		fprintf(stderr, "Ext2 : can't pin indirect blocks of inode %ld\n", inode->i_ino);
+}
+
+/*
+ * Unpin indirect blocks of a Ext2 inode (arena is released at last close).
+ */
+void ext2_unpin_indirect(struct inode *inode)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+
+	if (pin->p_count > 0 && --pin->p_count == 0)
+		ext2_pin_release(inode);
+}
+
+/*
+ * Read pinned blocks again (called when indirect blocks are freed or block map is replaced).
+ */
+void ext2_pin_reload(struct inode *inode)
+{
+	if (!ext2_i(inode)->i_pin.p_count)
+		return;
+
+	ext2_pin_release(inode);
+	ext2_pin_load(inode);
+}
+
+/*
+ * Get pinned copy of an indirect block (returns NULL if block is not pinned).
+ */
+uint32_t *ext2_pin_lookup(struct inode *inode, uint32_t block)
+{
+	struct ext2_pin *pin = &ext2_i(inode)->i_pin;
+	uint32_t *res;
+
+	if (!pin->p_nr_blocks)
+		return NULL;
+
+	res = bsearch(&block, pin->p_blocks, pin->p_nr_blocks, sizeof(uint32_t), ext2_pin_cmp);
+	if (!res)
+		return NULL;
+
+	return (uint32_t *) (pin->p_data + (size_t) (res - pin->p_blocks) * inode->i_sb->s_blocksize);
+}
+
+/*
+ * Update pinned copy of a modified indirect block.
+ */
+void ext2_pin_update(struct inode *inode, struct buffer_head *bh)
+{
+	uint32_t *blocks;
+
+	blocks = ext2_pin_lookup(inode, bh->b_block);
+	if (blocks)
+		memcpy(blocks, bh->b_data, bh->b_size);
+}
@@ -1,8 +1,34 @@
+#define _GNU_SOURCE
 #include <string.h>
+#include <errno.h>
 #include <sys/fcntl.h>
 
 #include "ext2.h"
 
+/*
+ * Open a Ext2 file.
+ */
+int ext2_file_open(struct file *filp)
+{
+	/* pin indirect blocks while file is opened */
+	if (ext2_sb(filp->f_inode->i_sb)->s_mount_opt & EXT2_MOUNT_PIN_INDIRECT)
+		ext2_pin_indirect(filp->f_inode);
+
+	return 0;
+}
+
+/*
+ * Close a Ext2 file.
+ */
+int ext2_file_close(struct file *filp)
+{
+	/* unpin indirect blocks at last close */
+	if (ext2_sb(filp->f_inode->i_sb)->s_mount_opt & EXT2_MOUNT_PIN_INDIRECT)
+		ext2_unpin_indirect(filp->f_inode);
+
+	return 0;
+}
+
 /*
  * Read a Ext2 file.
  */
@@ -10,6 +36,7 @@ int ext2_file_read(struct file *filp, char *buf, int count)
 {
 	struct buffer_head *bh;
 	int pos, nb_chars, left;
+	uint32_t phys;
 
 	/* adjust size */
 	if (filp->f_pos + count > filp->f_inode->i_size)
@@ -21,20 +48,26 @@ int ext2_file_read(struct file *filp, char *buf, int count)
 
 	/* read block by block */
 	for (left = count; left > 0;) {
-		/* read block */
-		bh = ext2_bread(filp->f_inode, filp->f_pos / filp->f_inode->i_sb->s_blocksize, 0);
-		if (!bh)
-			goto out;
-
 		/* find position and numbers of chars to read */
 		pos = filp->f_pos % filp->f_inode->i_sb->s_blocksize;
 		nb_chars = filp->f_inode->i_sb->s_blocksize - pos <= left ? filp->f_inode->i_sb->s_blocksize - pos : left;
 
-		/* copy to buffer */
-		memcpy(buf, bh->b_data + pos, nb_chars);
-
-		/* release block */
-		brelse(bh);
+		/* hole : read zeros */
+		phys = ext2_bmap(filp->f_inode, filp->f_pos / filp->f_inode->i_sb->s_blocksize);
+		if (!phys) {
+			memset(buf, 0, nb_chars);
+		} else {
+			/* read block */
+			bh = sb_bread(filp->f_inode->i_sb, phys);
+			if (!bh)
+				goto out;
+
+			/* copy to buffer */
+			memcpy(buf, bh->b_data + pos, nb_chars);
+
+			/* release block */
+			brelse(bh);
+		}
 
 		/* update sizes */
 		filp->f_pos += nb_chars;
@@ -53,29 +86,62 @@ out:
  */
 int ext2_file_write(struct file *filp, const char *buf, int count)
 {
-	struct buffer_head *bh;
-	int pos, nb_chars, left;
+	struct inode *inode = filp->f_inode;
+	uint32_t blocksize = inode->i_sb->s_blocksize;
+	int pos, nb_chars, left, nr_blocks, new;
+	struct buffer_head *bh, *tmp;
+	uint32_t block;
+
+	/* read only file system */
+	if (ext2_rdonly(inode->i_sb))
+		return -EROFS;
+
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(inode->i_sb);
 
 	/* handle append flag */
 	if (filp->f_flags & O_APPEND)
-		filp->f_pos = filp->f_inode->i_size;
+		filp->f_pos = inode->i_size;
 
 	/* write block by block */
 	for (left = count; left > 0;) {
-		/* read block */
-		bh = ext2_bread(filp->f_inode, filp->f_pos / filp->f_inode->i_sb->s_blocksize, 1);
+		/* find position and numbers of chars to write */
+		block = filp->f_pos / blocksize;
+		pos = filp->f_pos % blocksize;
+		nb_chars = blocksize - pos <= left ? blocksize - pos : left;
+
+		/* allocate all blocks left to write at once (except a last partial block inside file, it must be cleared) */
+		nr_blocks = (pos + left + blocksize - 1) / blocksize;
+		if (nr_blocks > 1 && (filp->f_pos + left) % blocksize && (filp->f_pos + left) / blocksize * blocksize < inode->i_size)
+			nr_blocks--;
+
+		/* get block buffer without reading it */
+		bh = ext2_getblk(inode, block, nr_blocks, &new);
 		if (!bh)
 			goto out;
 
-		/* find position and numbers of chars to read */
-		pos = filp->f_pos % filp->f_inode->i_sb->s_blocksize;
-		nb_chars = filp->f_inode->i_sb->s_blocksize - pos <= left ? filp->f_inode->i_sb->s_blocksize - pos : left;
+		/* partial write : read block if it holds data, else clear it */
+		if (nb_chars < blocksize) {
+			if (!new && (off_t) block * blocksize < inode->i_size) {
+				if (!bh->b_uptodate) {
+					tmp = sb_bread(inode->i_sb, bh->b_block);
+					brelse(bh);
+					bh = tmp;
+					if (!bh)
+						goto out;
+				}
+			} else {
+				memset(bh->b_data, 0, blocksize);
+			}
+		}
 
 		/* copy to buffer */
 		memcpy(bh->b_data + pos, buf, nb_chars);
 
-		/* release block */
+		/* write data in place (before the transaction referencing it is committed) and release block */
+		bh->b_uptodate = 1;
 		bh->b_dirt = 1;
+		bwrite(bh);
 		brelse(bh);
 
 		/* update sizes */
@@ -84,14 +150,43 @@ int ext2_file_write(struct file *filp, const char *buf, int count)
 		left -= nb_chars;
 
 		/* end of file : grow it and mark inode dirty */
-		if (filp->f_pos > filp->f_inode->i_size) {
-			filp->f_inode->i_size = filp->f_pos;
-			filp->f_inode->i_dirt = 1;
+		if (filp->f_pos > inode->i_size) {
+			inode->i_size = filp->f_pos;
+			inode->i_dirt = 1;
 		}
 	}
 
 out:
-	filp->f_inode->i_mtime = filp->f_inode->i_ctime = current_time();
-	filp->f_inode->i_dirt = 1;
+	inode->i_mtime = inode->i_ctime = current_time();
+	inode->i_dirt = 1;
 	return count - left;
 }
+
+/*
+ * Seek data or hole in a Ext2 file (offset is inside file).
+ */
+off_t ext2_file_lseek(struct file *filp, off_t offset, int whence)
+{
+	struct inode *inode = filp->f_inode;
+	uint32_t blocksize = inode->i_sb->s_blocksize, block, last;
+
+	/* get first and last blocks */
+	block = offset / blocksize;
+	last = (inode->i_size - 1) / blocksize;
+
+	/* find next mapped block */
+	if (whence == SEEK_DATA) {
+		block = ext2_find_data_block(inode, block);
+		if (block == (uint32_t) -1 || block > last)
+			return -ENXIO;
+	} else if (whence == SEEK_HOLE) {
+		/* find next unmapped block (end of file is a virtual hole) */
+		for (; block <= last && ext2_bmap(inode, block); block++);
+		if (block > last)
+			return inode->i_size;
+	} else {
+		return -EINVAL;
+	}
+
+	return (off_t) block * blocksize > offset ? (off_t) block * blocksize : offset;
+}
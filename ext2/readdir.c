@@ -3,6 +3,18 @@
 
 #include "ext2.h"
 
+/* directory entry file type to file mode (d_type is mode >> 12) */
+static const mode_t ext2_ft_to_mode[EXT2_FT_MAX] = {
+	[EXT2_FT_UNKNOWN]	= 0,
+	[EXT2_FT_REG_FILE]	= S_IFREG,
+	[EXT2_FT_DIR]		= S_IFDIR,
+	[EXT2_FT_CHRDEV]	= S_IFCHR,
+	[EXT2_FT_BLKDEV]	= S_IFBLK,
+	[EXT2_FT_FIFO]		= S_IFIFO,
+	[EXT2_FT_SOCK]		= S_IFSOCK,
+	[EXT2_FT_SYMLINK]	= S_IFLNK,
+};
+
 /*
  * Get directory entries.
  */
@@ -30,6 +42,10 @@ int ext2_getdents64(struct file *filp, void *dirp, size_t count)
 			continue;
 		}
 
+		/* directory scan : prefetch inodes of this block (callers often stat all entries) */
+		if (bh->b_block != ext2_i(inode)->i_ra_block)
+			ext2_prefetch_inodes(inode, bh);
+
 		/* read all entries in block */
 		while (filp->f_pos < inode->i_size && offset < sb->s_blocksize) {
 			/* check next entry */
@@ -56,7 +72,7 @@ int ext2_getdents64(struct file *filp, void *dirp, size_t count)
 			dirent->d_inode = le32toh(de->d_inode);
 			dirent->d_off = 0;
 			dirent->d_reclen = sizeof(struct dirent64) + de->d_name_len + 1;
-			dirent->d_type = 0;
+			dirent->d_type = ext2_has_filetype(sb) && de->d_fileype < EXT2_FT_MAX ? ext2_ft_to_mode[de->d_fileype] >> 12 : 0;
 			memcpy(dirent->d_name, de->d_name, de->d_name_len);
 			dirent->d_name[de->d_name_len] = 0;
 
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
 
@@ -15,14 +16,61 @@ struct super_operations ext2_sops = {
 	.write_inode		= ext2_write_inode,
 	.put_super		= ext2_put_super,
 	.statfs			= ext2_statfs,
+	.sync_fs		= ext2_sync_fs,
+	.commit_fs		= ext2_commit_fs,
+	.write_buffer		= ext2_write_buffer,
 };
 
+/*
+ * Parse Ext2 mount options (comma separated).
+ */
+static int ext2_parse_options(struct ext2_sb_info *sbi, const char *options)
+{
+	char *opts, *opt, *saveptr;
+	int err = 0;
+
+	/* no options */
+	sbi->s_mount_opt = 0;
+	sbi->s_commit_interval = EXT2_JOURNAL_COMMIT_INTERVAL;
+	if (!options)
+		return 0;
+
+	/* duplicate options */
+	opts = strdup(options);
+	if (!opts)
+		return -ENOMEM;
+
+	/* parse options */
+	for (opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+		if (strcmp(opt, "discard") == 0) {
+			sbi->s_mount_opt |= EXT2_MOUNT_DISCARD;
+		} else if (strcmp(opt, "ro") == 0) {
+			sbi->s_mount_opt |= EXT2_MOUNT_RDONLY;
+		} else if (strcmp(opt, "preload") == 0) {
+			sbi->s_mount_opt |= EXT2_MOUNT_PRELOAD;
+		} else if (strcmp(opt, "pin_indirect") == 0) {
+			sbi->s_mount_opt |= EXT2_MOUNT_PIN_INDIRECT;
+		} else if (strncmp(opt, "commit=", 7) == 0) {
+			sbi->s_commit_interval = atoi(opt + 7);
+		} else {
+			fprintf(stderr, "Ext2 : unknown mount option '%s'\n", opt);
+			err = -EINVAL;
+			break;
+		}
+	}
+
+	free(opts);
+	return err;
+}
+
 /*
  * Read a Ext2 super block.
  */
 int ext2_read_super(struct super_block *sb, void *data)
 {
 	uint32_t block, sb_block = 1, offset = 0, logic_sb_block = 1;
+	uint32_t *blocks;
+	struct ext2_group_desc *gdp;
 	int err = -ENOSPC, blocksize, i;
 	struct ext2_sb_info *sbi;
 
@@ -31,6 +79,16 @@ int ext2_read_super(struct super_block *sb, void *data)
 	if (!sbi)
 		return -ENOMEM;
 
+	/* no journal and no group summaries yet */
+	sbi->s_journal = NULL;
+	sbi->s_max_free_runs = NULL;
+
+	/* parse mount options */
+	err = ext2_parse_options(sbi, data);
+	if (err)
+		goto err;
+	err = -ENOSPC;
+
 	/* set default block size */
 	blocksize = EXT2_BLOCK_SIZE;
 	sb->s_blocksize = EXT2_BLOCK_SIZE;
@@ -104,15 +162,47 @@ int ext2_read_super(struct super_block *sb, void *data)
 		sbi->s_first_ino = le32toh(sbi->s_es->s_first_ino);
 	}
 
+	/* check features (unknown incompatible features can't be handled, ext4 and unknown read only compatible features are only read) */
+	if (le32toh(sbi->s_es->s_feature_incompat) & ~(EXT2_FEATURE_INCOMPAT_SUPP | EXT2_FEATURE_INCOMPAT_RO_SUPP))
+		goto err_bad_features;
+	if ((le32toh(sbi->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_RO_SUPP)
+	    || (le32toh(sbi->s_es->s_feature_ro_compat) & ~EXT2_FEATURE_RO_COMPAT_SUPP)) {
+		if (!ext2_rdonly(sb))
+			fprintf(stderr, "Ext2 : file system has ext4 or unsupported features, mounting read only\n");
+		sbi->s_mount_opt |= EXT2_MOUNT_RDONLY;
+	}
+
+	/* let VFS refuse modifications */
+	if (ext2_rdonly(sb))
+		sb->s_flags |= VFS_SB_RDONLY;
+
+	/* get group descriptor size (64bit feature) */
+	sbi->s_desc_size = EXT2_MIN_DESC_SIZE;
+	if (le32toh(sbi->s_es->s_feature_incompat) & EXT4_FEATURE_INCOMPAT_64BIT) {
+		sbi->s_desc_size = le16toh(sbi->s_es->s_desc_size);
+		if (sbi->s_desc_size < EXT2_MIN_DESC_SIZE || sbi->s_desc_size > EXT2_MAX_DESC_SIZE
+		    || (sbi->s_desc_size & (sbi->s_desc_size - 1)))
+			goto err_bad_desc_size;
+	}
+
 	/* set super block */
 	sbi->s_inodes_per_block = sb->s_blocksize / EXT2_INODE_SIZE(sb);
 	sbi->s_blocks_per_group = le32toh(sbi->s_es->s_blocks_per_group);
 	sbi->s_inodes_per_group = le32toh(sbi->s_es->s_inodes_per_group);
 	sbi->s_itb_per_group = sbi->s_inodes_per_group / sbi->s_inodes_per_block;
-	sbi->s_desc_per_block = sb->s_blocksize / sizeof(struct ext2_group_desc);
+	sbi->s_desc_per_block = sb->s_blocksize / sbi->s_desc_size;
 	sbi->s_groups_count = (le32toh(sbi->s_es->s_blocks_count) - le32toh(sbi->s_es->s_first_data_block) + sbi->s_blocks_per_group - 1) / sbi->s_blocks_per_group;
 	sbi->s_gdb_count = (sbi->s_groups_count + sbi->s_desc_per_block - 1) / sbi->s_desc_per_block;
 
+	/* directory index hash settings */
+	for (i = 0; i < 4; i++)
+		sbi->s_hash_seed[i] = le32toh(sbi->s_es->s_hash_seed[i]);
+	sbi->s_def_hash_version = sbi->s_es->s_def_hash_version;
+	sbi->s_hash_unsigned = le32toh(sbi->s_es->s_flags) & EXT2_FLAGS_UNSIGNED_HASH ? 3 : 0;
+
+	/* no reservation window */
+	INIT_LIST_HEAD(&sbi->s_rsv_windows);
+
 	/* allocate group descriptors buffers */
 	sbi->s_group_desc = (struct buffer_head **) malloc(sizeof(struct buffer_head *) * sbi->s_gdb_count);
 	if (!sbi->s_group_desc) {
@@ -124,6 +214,15 @@ int ext2_read_super(struct super_block *sb, void *data)
 	for (i = 0; i < sbi->s_gdb_count; i++)
 		sbi->s_group_desc[i] = NULL;
 
+	/* read ahead group descriptors (contiguous after super block) */
+	blocks = (uint32_t *) malloc(sizeof(uint32_t) * sbi->s_gdb_count);
+	if (blocks) {
+		for (i = 0; i < sbi->s_gdb_count; i++)
+			blocks[i] = logic_sb_block + i + 1;
+		sb_breadahead(sb, blocks, sbi->s_gdb_count);
+		free(blocks);
+	}
+
 	/* read group descriptors */
 	for (i = 0; i < sbi->s_gdb_count; i++) {
 		/* get group descriptor block = +1 for super block stored in front of each group */
@@ -137,6 +236,42 @@ int ext2_read_super(struct super_block *sb, void *data)
 		}
 	}
 
+	/* load journal (replay it if needed) : a read only file system can't be replayed */
+	if (!ext2_rdonly(sb)) {
+		err = ext2_journal_load(sb);
+		if (err)
+			goto err_journal;
+	} else if (le32toh(sbi->s_es->s_feature_incompat) & EXT2_FEATURE_INCOMPAT_RECOVER) {
+		goto err_needs_recovery;
+	}
+	err = -ENOSPC;
+
+	/* count free blocks, free inodes and directories from group descriptors */
+	sbi->s_free_blocks_count = 0;
+	sbi->s_free_inodes_count = 0;
+	sbi->s_dirs_count = 0;
+	for (i = 0; i < sbi->s_groups_count; i++) {
+		gdp = ext2_get_group_desc(sb, i, NULL);
+		sbi->s_free_blocks_count += le16toh(gdp->bg_free_blocks_count);
+		sbi->s_free_inodes_count += le16toh(gdp->bg_free_inodes_count);
+		sbi->s_dirs_count += le16toh(gdp->bg_used_dirs_count);
+	}
+
+	/* allocate next free block hints */
+	sbi->s_free_hints = (uint32_t *) calloc(sbi->s_groups_count, sizeof(uint32_t));
+	if (!sbi->s_free_hints) {
+		err = -ENOMEM;
+		goto err_no_hints;
+	}
+
+	/* preload bitmaps and build group summaries */
+	if ((sbi->s_mount_opt & EXT2_MOUNT_PRELOAD) && !ext2_rdonly(sb)) {
+		err = ext2_preload_bitmaps(sb);
+		if (err)
+			goto err_preload;
+		err = -ENOSPC;
+	}
+
 	/* get root inode */
 	sb->s_root_inode = vfs_iget(sb, EXT2_ROOT_INO);
 	if (!sb->s_root_inode)
@@ -145,6 +280,24 @@ int ext2_read_super(struct super_block *sb, void *data)
 	return 0;
 err_root_inode:
 	fprintf(stderr, "Ext2 : can't get root inode\n");
+	free(sbi->s_max_free_runs);
+	free(sbi->s_free_hints);
+	goto err_release_journal;
+err_preload:
+	fprintf(stderr, "Ext2 : can't preload bitmaps\n");
+	free(sbi->s_free_hints);
+	goto err_release_journal;
+err_no_hints:
+	fprintf(stderr, "Ext2 : can't allocate free blocks hints\n");
+err_release_journal:
+	ext2_journal_release(sb);
+	goto err_release_gdb;
+err_journal:
+	fprintf(stderr, "Ext2 : can't load journal\n");
+	goto err_release_gdb;
+err_needs_recovery:
+	fprintf(stderr, "Ext2 : read only file system needs journal recovery (run e2fsck)\n");
+	err = -EROFS;
 	goto err_release_gdb;
 err_read_gdb:
 	fprintf(stderr, "Ext2 : can't read group descriptors\n");
@@ -156,6 +309,13 @@ err_release_gdb:
 		brelse(sbi->s_group_desc[i]);
 	free(sbi->s_group_desc);
 	goto err_release_sb;
+err_bad_desc_size:
+	fprintf(stderr, "Ext2 : wrong group descriptor size\n");
+	goto err_release_sb;
+err_bad_features:
+	fprintf(stderr, "Ext2 : unsupported incompatible features (0x%x)\n",
+		le32toh(sbi->s_es->s_feature_incompat) & ~(EXT2_FEATURE_INCOMPAT_SUPP | EXT2_FEATURE_INCOMPAT_RO_SUPP));
+	goto err_release_sb;
 err_bad_blocksize:
 	fprintf(stderr, "Ext2 : wrong block size (only 1024, 2048 and 4096 supported)\n");
 	goto err_release_sb;
@@ -185,6 +345,12 @@ void ext2_put_super(struct super_block *sb)
 	/* release root inode */
 	vfs_iput(sb->s_root_inode);
 
+	/* write free counters and group descriptors */
+	ext2_sync_fs(sb);
+
+	/* release journal (file system is clean now) */
+	ext2_journal_release(sb);
+
 	/* release group descriptors */
 	if (sbi->s_group_desc) {
 		for (i = 0; i < sbi->s_gdb_count; i++)
@@ -193,6 +359,10 @@ void ext2_put_super(struct super_block *sb)
 		free(sbi->s_group_desc);
 	}
 
+	/* release next free block hints and group summaries */
+	free(sbi->s_free_hints);
+	free(sbi->s_max_free_runs);
+
 	/* release super block */
 	brelse(sbi->s_sbh);
 
@@ -200,6 +370,17 @@ void ext2_put_super(struct super_block *sb)
 	free(sbi);
 }
 
+/*
+ * Write a Ext2 dirty buffer (metadata goes through journal).
+ */
+int ext2_write_buffer(struct buffer_head *bh)
+{
+	if (ext2_sb(bh->b_sb)->s_journal)
+		return ext2_journal_dirty(bh);
+
+	return bwrite(bh);
+}
+
 /*
  * Get Ext2 File system status.
  */
@@ -220,13 +401,62 @@ int ext2_statfs(struct super_block *sb, struct statfs *buf)
 	buf->f_type = sb->s_magic;
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32toh(sbi->s_es->s_blocks_count) - overhead;
-	buf->f_bfree = le32toh(sbi->s_es->s_free_blocks_count);
+	buf->f_bfree = sbi->s_free_blocks_count;
 	buf->f_bavail = buf->f_bfree - le32toh(sbi->s_es->s_r_blocks_count);
 	if (buf->f_bfree < le32toh(sbi->s_es->s_r_blocks_count))
 		buf->f_bavail = 0;
 	buf->f_files = le32toh(sbi->s_es->s_inodes_count);
-	buf->f_ffree = le32toh(sbi->s_es->s_free_inodes_count);
+	buf->f_ffree = sbi->s_free_inodes_count;
 	buf->f_namelen = EXT2_NAME_LEN;
 
 	return 0;
 }
+
+/*
+ * Synchronize a Ext2 file system (fold free counters in super block and write group descriptors).
+ */
+int ext2_sync_fs(struct super_block *sb)
+{
+	struct ext2_sb_info *sbi = ext2_sb(sb);
+	int err = 0, i;
+
+	/* read only file system : nothing to write */
+	if (ext2_rdonly(sb))
+		return 0;
+
+	/* commit journal (group descriptors are logged) or write dirty group descriptors */
+	if (sbi->s_journal) {
+		err = ext2_journal_commit(sb);
+	} else {
+		for (i = 0; i < sbi->s_gdb_count; i++)
+			if (sbi->s_group_desc[i]->b_dirt && bwrite(sbi->s_group_desc[i]))
+				err = -EIO;
+	}
+
+	/* fold free counters in super block */
+	if (le32toh(sbi->s_es->s_free_blocks_count) != sbi->s_free_blocks_count
+	    || le32toh(sbi->s_es->s_free_inodes_count) != sbi->s_free_inodes_count) {
+		sbi->s_es->s_free_blocks_count = htole32(sbi->s_free_blocks_count);
+		sbi->s_es->s_free_inodes_count = htole32(sbi->s_free_inodes_count);
+		sbi->s_sbh->b_dirt = 1;
+	}
+
+	/* write super block */
+	if (sbi->s_sbh->b_dirt && bwrite(sbi->s_sbh))
+		err = -EIO;
+
+	return err;
+}
+
+/*
+ * Periodic commit of a Ext2 file system : running transaction is committed once older than commit interval.
+ */
+int ext2_commit_fs(struct super_block *sb)
+{
+	/* no journal : metadata is written in place */
+	if (ext2_rdonly(sb) || !ext2_sb(sb)->s_journal)
+		return 0;
+
+	ext2_journal_start(sb);
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
 
@@ -23,6 +24,13 @@ int ext2_follow_link(struct inode *dir, struct inode *inode, struct inode **res_
 		return 0;
 	}
 
+	/* fast symlink : target is stored in inode */
+	if (ext2_inode_is_fast_symlink(inode)) {
+		*res_inode = vfs_namei(NULL, dir, (char *) ext2_i(inode)->i_data, 0);
+		vfs_iput(inode);
+		return *res_inode ? 0 : -EACCES;
+	}
+
 	/* read first link block */
 	bh = ext2_bread(inode, 0, 0);
 	if (!bh) {
@@ -63,6 +71,14 @@ ssize_t ext2_readlink(struct inode *inode, char *buf, size_t bufsize)
 	if (bufsize > inode->i_sb->s_blocksize)
 		bufsize = inode->i_sb->s_blocksize;
 
+	/* fast symlink : copy target from inode (with end of string) */
+	if (ext2_inode_is_fast_symlink(inode)) {
+		len = inode->i_size + 1 < bufsize ? inode->i_size + 1 : bufsize;
+		memcpy(buf, ext2_i(inode)->i_data, len);
+		vfs_iput(inode);
+		return len;
+	}
+
 	/* read first block */
 	bh = ext2_bread(inode, 0, 0);
 	if (!bh) {
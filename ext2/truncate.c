@@ -7,11 +7,39 @@
 #define DINDIRECT_BLOCK(inode, offset)		(INDIRECT_BLOCK(inode, offset) / addr_per_block)
 #define TINDIRECT_BLOCK(inode, offset)		(INDIRECT_BLOCK(inode, offset) / (addr_per_block * addr_per_block))
 
+/*
+ * Free pending range of blocks.
+ */
+static void ext2_free_range_flush(struct inode *inode, struct ext2_free_range *range)
+{
+	if (!range->count)
+		return;
+
+	ext2_free_blocks(inode, range->start, range->count);
+	range->count = 0;
+}
+
+/*
+ * Add a block to free (contiguous blocks are freed at once).
+ */
+static void ext2_free_range_add(struct inode *inode, struct ext2_free_range *range, uint32_t block)
+{
+	/* extend current range */
+	if (range->count && block == range->start + range->count) {
+		range->count++;
+		return;
+	}
+
+	/* else free current range and start a new one */
+	ext2_free_range_flush(inode, range);
+	range->start = block;
+	range->count = 1;
+}
 
 /*
  * Free Ext2 direct blocks.
  */
-static void ext2_free_direct_blocks(struct inode *inode)
+static void ext2_free_direct_blocks(struct inode *inode, struct ext2_free_range *range)
 {
 	struct ext2_inode_info *ext2_inode = ext2_i(inode);
 	int i;
@@ -23,7 +51,7 @@ static void ext2_free_direct_blocks(struct inode *inode)
 
 		/* free block */
 		if (ext2_inode->i_data[i]) {
-			ext2_free_block(inode, ext2_inode->i_data[i]);
+			ext2_free_range_add(inode, range, ext2_inode->i_data[i]);
 			ext2_inode->i_data[i] = 0;
 		}
 	}
@@ -32,7 +60,8 @@ static void ext2_free_direct_blocks(struct inode *inode)
 /*
  * Free Ext2 single indirect blocks.
  */
-static void ext2_free_indirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block)
+static void ext2_free_indirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block,
+				      struct ext2_free_range *range)
 {
 	struct buffer_head *bh;
 	uint32_t *blocks;
@@ -52,13 +81,12 @@ static void ext2_free_indirect_blocks(struct inode *inode, int offset, uint32_t
 		if (i < 0)
 			i = 0;
 
-		/* free block */
-		if (blocks[i])
-			ext2_free_block(inode, blocks[i]);
-
-		/* mark parent block dirty */
-		blocks[i] = 0;
-		bh->b_dirt = 1;
+		/* free block and mark parent block dirty */
+		if (blocks[i]) {
+			ext2_free_range_add(inode, range, blocks[i]);
+			blocks[i] = 0;
+			bh->b_dirt = 1;
+		}
 	}
 
 	/* get first used address */
@@ -66,9 +94,10 @@ static void ext2_free_indirect_blocks(struct inode *inode, int offset, uint32_t
 		if (blocks[i])
 			break;
 
-	/* indirect block not used anymore : free it */
+	/* indirect block not used anymore : free it (don't write it back) */
 	if (i >= addr_per_block) {
-		ext2_free_block(inode, *block);
+		bh->b_dirt = 0;
+		ext2_free_range_add(inode, range, *block);
 		*block = 0;
 	}
 
@@ -79,7 +108,8 @@ static void ext2_free_indirect_blocks(struct inode *inode, int offset, uint32_t
 /*
  * Free Ext2 double indirect blocks.
  */
-static void ext2_free_dindirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block)
+static void ext2_free_dindirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block,
+				       struct ext2_free_range *range)
 {
 	struct buffer_head *bh;
 	uint32_t *blocks;
@@ -93,19 +123,17 @@ static void ext2_free_dindirect_blocks(struct inode *inode, int offset, uint32_t
 	if (!bh)
 		return;
 
-	/* free all pointed blocks */
+	/* free all pointed blocks (child clears its entry if it is freed) */
 	blocks = (uint32_t * ) bh->b_data;
 	for (i = DINDIRECT_BLOCK(inode, offset); i < addr_per_block; i++) {
 		if (i < 0)
 			i = 0;
 
-		/* free block */
-		if (blocks[i])
-			ext2_free_indirect_blocks(inode, offset + (i / addr_per_block), &blocks[i], addr_per_block);
-
-		/* mark parent block dirty */
-		blocks[i] = 0;
-		bh->b_dirt = 1;
+		/* free block and mark parent block dirty */
+		if (blocks[i]) {
+			ext2_free_indirect_blocks(inode, offset + i * addr_per_block, &blocks[i], addr_per_block, range);
+			bh->b_dirt = 1;
+		}
 	}
 
 	/* get first used address */
@@ -113,9 +141,10 @@ static void ext2_free_dindirect_blocks(struct inode *inode, int offset, uint32_t
 		if (blocks[i])
 			break;
 
-	/* indirect block not used anymore : free it */
+	/* indirect block not used anymore : free it (don't write it back) */
 	if (i >= addr_per_block) {
-		ext2_free_block(inode, *block);
+		bh->b_dirt = 0;
+		ext2_free_range_add(inode, range, *block);
 		*block = 0;
 	}
 
@@ -126,7 +155,8 @@ static void ext2_free_dindirect_blocks(struct inode *inode, int offset, uint32_t
 /*
  * Free Ext2 triple indirect blocks.
  */
-static void ext2_free_tindirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block)
+static void ext2_free_tindirect_blocks(struct inode *inode, int offset, uint32_t *block, int addr_per_block,
+				       struct ext2_free_range *range)
 {
 	struct buffer_head *bh;
 	uint32_t *blocks;
@@ -140,19 +170,17 @@ static void ext2_free_tindirect_blocks(struct inode *inode, int offset, uint32_t
 	if (!bh)
 		return;
 
-	/* free all pointed blocks */
+	/* free all pointed blocks (child clears its entry if it is freed) */
 	blocks = (uint32_t * ) bh->b_data;
 	for (i = TINDIRECT_BLOCK(inode, offset); i < addr_per_block; i++) {
 		if (i < 0)
 			i = 0;
 
-		/* free block */
-		if (blocks[i])
-			ext2_free_dindirect_blocks(inode, offset + (i / addr_per_block), &blocks[i], addr_per_block);
-
-		/* mark parent block dirty */
-		blocks[i] = 0;
-		bh->b_dirt = 1;
+		/* free block and mark parent block dirty */
+		if (blocks[i]) {
+			ext2_free_dindirect_blocks(inode, offset + i * addr_per_block * addr_per_block, &blocks[i], addr_per_block, range);
+			bh->b_dirt = 1;
+		}
 	}
 
 	/* get first used address */
@@ -160,9 +188,10 @@ static void ext2_free_tindirect_blocks(struct inode *inode, int offset, uint32_t
 		if (blocks[i])
 			break;
 
-	/* indirect block not used anymore : free it */
+	/* indirect block not used anymore : free it (don't write it back) */
 	if (i >= addr_per_block) {
-		ext2_free_block(inode, *block);
+		bh->b_dirt = 0;
+		ext2_free_range_add(inode, range, *block);
 		*block = 0;
 	}
 
@@ -170,26 +199,78 @@ static void ext2_free_tindirect_blocks(struct inode *inode, int offset, uint32_t
 	brelse(bh);
 }
 
+/*
+ * Clear end of last block of a file (after end of file).
+ */
+static void ext2_truncate_last_block(struct inode *inode)
+{
+	struct buffer_head *bh;
+	uint32_t offset;
+
+	/* end of file is block aligned */
+	offset = inode->i_size & (inode->i_sb->s_blocksize - 1);
+	if (!offset)
+		return;
+
+	/* last block is a hole */
+	if (!ext2_bmap(inode, inode->i_size >> inode->i_sb->s_blocksize_bits))
+		return;
+
+	/* read last block */
+	bh = ext2_bread(inode, inode->i_size >> inode->i_sb->s_blocksize_bits, 0);
+	if (!bh) {
+		fprintf(stderr, "Ext2 : can't clear end of inode %ld\n", inode->i_ino);
+		return;
+	}
+
+	/* clear end of block and write it in place (like file data) */
+	memset(bh->b_data + offset, 0, inode->i_sb->s_blocksize - offset);
+	bh->b_dirt = 1;
+	bwrite(bh);
+	brelse(bh);
+}
+
 /*
  * Truncate a Ext2 inode.
  */
 void ext2_truncate(struct inode *inode)
 {
 	struct ext2_inode_info *ext2_inode = ext2_i(inode);
+	struct ext2_free_range range = { 0, 0 };
 	int addr_per_block;
 
-	/* only allowed on regular files and directories */
-	if (!inode || !(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)))
+	/* only allowed on regular files, directories and symbolic links stored in blocks */
+	if (!inode || !(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode)
+			|| (S_ISLNK(inode->i_mode) && !ext2_inode_is_fast_symlink(inode))))
+		return;
+
+	/* read only file system (VFS refuses truncate with EROFS before) */
+	if (ext2_rdonly(inode->i_sb))
 		return;
 
+	/* start operation (may commit running transaction) */
+	ext2_journal_start(inode->i_sb);
+
 	/* compute number of addressed per block */
 	addr_per_block = inode->i_sb->s_blocksize / 4;
 
+	/* invalidate extents cache and release reservation window */
+	ext2_extent_truncate(inode, DIRECT_BLOCK(inode));
+	ext2_discard_reservation(inode);
+
 	/* free direct, indirect, double indirect and triple indirect blocks */
-	ext2_free_direct_blocks(inode);
-	ext2_free_indirect_blocks(inode, EXT2_NDIR_BLOCKS, &ext2_inode->i_data[EXT2_IND_BLOCK], addr_per_block);
-	ext2_free_dindirect_blocks(inode, EXT2_NDIR_BLOCKS + addr_per_block, &ext2_inode->i_data[EXT2_DIND_BLOCK], addr_per_block);
-	ext2_free_tindirect_blocks(inode, EXT2_NDIR_BLOCKS + addr_per_block + addr_per_block * addr_per_block, &ext2_inode->i_data[EXT2_TIND_BLOCK], addr_per_block);
+	ext2_free_direct_blocks(inode, &range);
+	ext2_free_indirect_blocks(inode, EXT2_NDIR_BLOCKS, &ext2_inode->i_data[EXT2_IND_BLOCK], addr_per_block, &range);
+	ext2_free_dindirect_blocks(inode, EXT2_NDIR_BLOCKS + addr_per_block, &ext2_inode->i_data[EXT2_DIND_BLOCK], addr_per_block, &range);
+	ext2_free_tindirect_blocks(inode, EXT2_NDIR_BLOCKS + addr_per_block + addr_per_block * addr_per_block, &ext2_inode->i_data[EXT2_TIND_BLOCK], addr_per_block, &range);
+	ext2_free_range_flush(inode, &range);
+
+	/* pinned indirect blocks may have been freed */
+	ext2_pin_reload(inode);
+
+	/* clear end of last block (file may grow again : bytes after end of file must read as zeros) */
+	if (S_ISREG(inode->i_mode))
+		ext2_truncate_last_block(inode);
 
 	/* mark inode dirty */
 	inode->i_mtime = inode->i_ctime = current_time();
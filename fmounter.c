@@ -6,11 +6,14 @@
 #include <getopt.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "vfs/vfs.h"
 #include "ftpfs/ftpfs.h"
 
 #define DIR_BUF_SIZE			4096
+#define COMMIT_PERIOD			1				/* periodic commit check (in seconds) */
 
 /*
  * VFS data.
@@ -21,20 +24,169 @@ struct vfs_data {
 	int				fs_type;			/* file system type */
 	void *				fs_options;			/* file system options */
 	struct super_block *		sb;				/* mounted super block */
+	char *				stats_path;			/* latency histograms output file */
+	uint64_t			slow_op_ns;			/* slow operations threshold */
+	char *				trace_path;			/* operations trace file */
+	uint32_t			trace_records;			/* operations trace ring size */
+	struct vfs_trace *		trace;				/* operations trace */
+	pthread_t			commit_thread;			/* periodic commit thread */
+	int				commit_running;			/* periodic commit thread started */
 };
 
+/*
+ * VFS lock : fuse operations and periodic commits are serialized.
+ */
+static pthread_mutex_t vfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+static int commit_stop = 0;
+
+/*
+ * Fuse operations latency histograms.
+ */
+static struct vfs_histogram op_stats[VFS_NR_OPS] = {
+	[VFS_OP_GETATTR]	= { .h_name = "getattr",	.h_stage = -1 },
+	[VFS_OP_READLINK]	= { .h_name = "readlink",	.h_stage = -1 },
+	[VFS_OP_MKNOD]		= { .h_name = "mknod",		.h_stage = -1 },
+	[VFS_OP_MKDIR]		= { .h_name = "mkdir",		.h_stage = -1 },
+	[VFS_OP_UNLINK]		= { .h_name = "unlink",		.h_stage = -1 },
+	[VFS_OP_RMDIR]		= { .h_name = "rmdir",		.h_stage = -1 },
+	[VFS_OP_SYMLINK]	= { .h_name = "symlink",	.h_stage = -1 },
+	[VFS_OP_RENAME]		= { .h_name = "rename",		.h_stage = -1 },
+	[VFS_OP_LINK]		= { .h_name = "link",		.h_stage = -1 },
+	[VFS_OP_CHMOD]		= { .h_name = "chmod",		.h_stage = -1 },
+	[VFS_OP_CHOWN]		= { .h_name = "chown",		.h_stage = -1 },
+	[VFS_OP_TRUNCATE]	= { .h_name = "truncate",	.h_stage = -1 },
+	[VFS_OP_OPEN]		= { .h_name = "open",		.h_stage = -1 },
+	[VFS_OP_READ]		= { .h_name = "read",		.h_stage = -1 },
+	[VFS_OP_WRITE]		= { .h_name = "write",		.h_stage = -1 },
+	[VFS_OP_STATFS]		= { .h_name = "statfs",		.h_stage = -1 },
+	[VFS_OP_FLUSH]		= { .h_name = "flush",		.h_stage = -1 },
+	[VFS_OP_RELEASE]	= { .h_name = "release",	.h_stage = -1 },
+	[VFS_OP_FSYNC]		= { .h_name = "fsync",		.h_stage = -1 },
+	[VFS_OP_SETXATTR]	= { .h_name = "setxattr",	.h_stage = -1 },
+	[VFS_OP_GETXATTR]	= { .h_name = "getxattr",	.h_stage = -1 },
+	[VFS_OP_LISTXATTR]	= { .h_name = "listxattr",	.h_stage = -1 },
+	[VFS_OP_REMOVEXATTR]	= { .h_name = "removexattr",	.h_stage = -1 },
+	[VFS_OP_READDIR]	= { .h_name = "readdir",	.h_stage = -1 },
+	[VFS_OP_INIT]		= { .h_name = "init",		.h_stage = -1 },
+	[VFS_OP_DESTROY]	= { .h_name = "destroy",	.h_stage = -1 },
+	[VFS_OP_ACCESS]		= { .h_name = "access",		.h_stage = -1 },
+	[VFS_OP_CREATE]		= { .h_name = "create",		.h_stage = -1 },
+	[VFS_OP_LOCK]		= { .h_name = "lock",		.h_stage = -1 },
+	[VFS_OP_UTIMENS]	= { .h_name = "utimens",	.h_stage = -1 },
+	[VFS_OP_LSEEK]		= { .h_name = "lseek",		.h_stage = -1 },
+	[VFS_OP_COPY_FILE_RANGE]	= { .h_name = "copy_file_range",	.h_stage = -1 },
+};
+
+/*
+ * Begin a timed operation (VFS is locked until operation end).
+ */
+static void op_stat_begin(struct vfs_stat_ctx *ctx)
+{
+	pthread_mutex_lock(&vfs_lock);
+	vfs_stat_begin(ctx);
+}
+
+/*
+ * End a timed operation : update its histogram, trace it and log it if it's too slow.
+ */
+static void op_stat_end(int op, struct vfs_stat_ctx *ctx, struct vfs_trace_args *args)
+{
+	struct vfs_data *vfs_data;
+	uint64_t elapsed;
+
+	/* get VFS data */
+	vfs_data = fuse_get_context()->private_data;
+
+	/* update histogram */
+	elapsed = vfs_stat_end(&op_stats[op], ctx);
+
+	/* trace operation */
+	if (vfs_data && vfs_data->trace)
+		vfs_trace_add(vfs_data->trace, op, ctx->c_start, elapsed, args);
+
+	/* log slow operation */
+	if (vfs_data && vfs_data->slow_op_ns && elapsed >= vfs_data->slow_op_ns) {
+		fprintf(stderr, "VFS: slow %s %s : %.3fms", op_stats[op].h_name, args->path ? args->path : "", elapsed / 1000000.0);
+		vfs_stat_print_stages(stderr, ctx);
+		fprintf(stderr, "\n");
+	}
+
+	/* unlock VFS */
+	pthread_mutex_unlock(&vfs_lock);
+}
+
+/*
+ * Periodic commit thread : file system writes metadata pending for too long (even if no operation comes).
+ */
+static void *commit_thread(void *arg)
+{
+	struct vfs_data *vfs_data = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&vfs_lock);
+	while (!commit_stop) {
+		/* wait for next period (VFS is unlocked while waiting) */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += COMMIT_PERIOD;
+		pthread_cond_timedwait(&commit_cond, &vfs_lock, &deadline);
+
+		/* commit */
+		if (!commit_stop && vfs_commit(vfs_data->sb))
+			fprintf(stderr, "VFS: periodic commit failed\n");
+	}
+	pthread_mutex_unlock(&vfs_lock);
+
+	return NULL;
+}
+
+/*
+ * Dump latency histograms.
+ */
+static void dump_stats(struct vfs_data *vfs_data)
+{
+	FILE *fp = stderr;
+	int i;
+
+	if (!vfs_data->stats_path)
+		return;
+
+	/* open output file */
+	if (strcmp(vfs_data->stats_path, "-") != 0) {
+		fp = fopen(vfs_data->stats_path, "w");
+		if (!fp) {
+			fprintf(stderr, "VFS: can't open statistics file %s\n", vfs_data->stats_path);
+			return;
+		}
+	}
+
+	/* dump fuse operations and VFS hooks */
+	for (i = 0; i < VFS_NR_OPS; i++)
+		vfs_hist_dump(fp, &op_stats[i]);
+	vfs_stats_dump(fp);
+
+	if (fp != stderr)
+		fclose(fp);
+}
+
 /*
  * Get file attributes/status.
  */
 static int op_getattr(const char *pathname, struct stat *statbuf, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* stat file */
-	return vfs_stat(vfs_data->sb->s_root_inode, pathname, statbuf);
+	op_stat_begin(&ctx);
+	err = vfs_stat(vfs_data->sb->s_root_inode, pathname, statbuf);
+	op_stat_end(VFS_OP_GETATTR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = err });
+
+	return err;
 }
 
 /*
@@ -43,13 +195,16 @@ static int op_getattr(const char *pathname, struct stat *statbuf, struct fuse_fi
 static int op_readlink(const char *pathname, char *buf, size_t bufsize)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
 	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* read link */
+	op_stat_begin(&ctx);
 	err = vfs_readlink(vfs_data->sb->s_root_inode, pathname, buf, bufsize);
+	op_stat_end(VFS_OP_READLINK, &ctx, &(struct vfs_trace_args) { .path = pathname, .length = bufsize, .result = err });
 	if (err < 0)
 		return err;
 
@@ -61,7 +216,12 @@ static int op_readlink(const char *pathname, char *buf, size_t bufsize)
  */
 static int op_mknod(const char *pathname, mode_t mode, dev_t dev)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "mknod not implemented\n");
+	op_stat_end(VFS_OP_MKNOD, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = mode, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -71,12 +231,18 @@ static int op_mknod(const char *pathname, mode_t mode, dev_t dev)
 static int op_mkdir(const char *pathname, mode_t mode)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* make directory */
-	return vfs_mkdir(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_begin(&ctx);
+	err = vfs_mkdir(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_end(VFS_OP_MKDIR, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = mode, .result = err });
+
+	return err;
 }
 
 /*
@@ -85,12 +251,18 @@ static int op_mkdir(const char *pathname, mode_t mode)
 static int op_unlink(const char *pathname)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* remove file */
-	return vfs_unlink(vfs_data->sb->s_root_inode, pathname);
+	op_stat_begin(&ctx);
+	err = vfs_unlink(vfs_data->sb->s_root_inode, pathname);
+	op_stat_end(VFS_OP_UNLINK, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = err });
+
+	return err;
 }
 
 /*
@@ -99,12 +271,18 @@ static int op_unlink(const char *pathname)
 static int op_rmdir(const char *pathname)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* remove directory */
-	return vfs_rmdir(vfs_data->sb->s_root_inode, pathname);
+	op_stat_begin(&ctx);
+	err = vfs_rmdir(vfs_data->sb->s_root_inode, pathname);
+	op_stat_end(VFS_OP_RMDIR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = err });
+
+	return err;
 }
 
 /*
@@ -113,12 +291,18 @@ static int op_rmdir(const char *pathname)
 static int op_symlink(const char *target, const char *linkpath)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* remove directory */
-	return vfs_symlink(vfs_data->sb->s_root_inode, target, linkpath);
+	op_stat_begin(&ctx);
+	err = vfs_symlink(vfs_data->sb->s_root_inode, target, linkpath);
+	op_stat_end(VFS_OP_SYMLINK, &ctx, &(struct vfs_trace_args) { .path = linkpath, .path2 = target, .result = err });
+
+	return err;
 }
 
 /*
@@ -127,12 +311,18 @@ static int op_symlink(const char *target, const char *linkpath)
 static int op_rename(const char *oldpath, const char *newpath, unsigned int flags)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* rename file */
-	return vfs_rename(vfs_data->sb->s_root_inode, oldpath, newpath);
+	op_stat_begin(&ctx);
+	err = vfs_rename(vfs_data->sb->s_root_inode, oldpath, newpath);
+	op_stat_end(VFS_OP_RENAME, &ctx, &(struct vfs_trace_args) { .path = oldpath, .path2 = newpath, .result = err });
+
+	return err;
 }
 
 /*
@@ -141,12 +331,18 @@ static int op_rename(const char *oldpath, const char *newpath, unsigned int flag
 static int op_link(const char *oldpath, const char *newpath)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* link file */
-	return vfs_link(vfs_data->sb->s_root_inode, oldpath, newpath);
+	op_stat_begin(&ctx);
+	err = vfs_link(vfs_data->sb->s_root_inode, oldpath, newpath);
+	op_stat_end(VFS_OP_LINK, &ctx, &(struct vfs_trace_args) { .path = newpath, .path2 = oldpath, .result = err });
+
+	return err;
 }
 
 /*
@@ -155,12 +351,18 @@ static int op_link(const char *oldpath, const char *newpath)
 static int op_chmod(const char *pathname, mode_t mode, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* chmod */
-	return vfs_chmod(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_begin(&ctx);
+	err = vfs_chmod(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_end(VFS_OP_CHMOD, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = mode, .result = err });
+
+	return err;
 }
 
 /*
@@ -169,12 +371,18 @@ static int op_chmod(const char *pathname, mode_t mode, struct fuse_file_info *fi
 static int op_chown(const char *pathname, uid_t uid, gid_t gid, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* chown */
-	return vfs_chown(vfs_data->sb->s_root_inode, pathname, uid, gid);
+	op_stat_begin(&ctx);
+	err = vfs_chown(vfs_data->sb->s_root_inode, pathname, uid, gid);
+	op_stat_end(VFS_OP_CHOWN, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = uid, .length = gid, .result = err });
+
+	return err;
 }
 
 /*
@@ -183,12 +391,18 @@ static int op_chown(const char *pathname, uid_t uid, gid_t gid, struct fuse_file
 static int op_truncate(const char *pathname, off_t length, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* chown */
-	return vfs_truncate(vfs_data->sb->s_root_inode, pathname, length);
+	op_stat_begin(&ctx);
+	err = vfs_truncate(vfs_data->sb->s_root_inode, pathname, length);
+	op_stat_end(VFS_OP_TRUNCATE, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = length, .result = err });
+
+	return err;
 }
 
 /*
@@ -197,13 +411,16 @@ static int op_truncate(const char *pathname, off_t length, struct fuse_file_info
 static int op_open(const char *pathname, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
 	struct file *file;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* open file */
+	op_stat_begin(&ctx);
 	file = vfs_open(vfs_data->sb->s_root_inode, pathname, fi->flags, 0);
+	op_stat_end(VFS_OP_OPEN, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = fi->flags, .fh = (uint64_t) file, .result = file ? 0 : -ENOENT });
 	if (!file)
 		return -ENOENT;
 
@@ -219,18 +436,22 @@ static int op_open(const char *pathname, struct fuse_file_info *fi)
 static int op_read(const char *pathname, char *buf, size_t length, off_t offset, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
 	int err, close_fi = 0;
 	struct file *file;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 	file = (struct file *) fi->fh;
+	op_stat_begin(&ctx);
 
 	/* open file if needed */
 	if (!file) {
 		file = vfs_open(vfs_data->sb->s_root_inode, pathname, O_RDONLY, 0);
-		if (!file)
+		if (!file) {
+			op_stat_end(VFS_OP_READ, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = offset, .length = length, .result = -1 });
 			return -1;
+		}
 
 		close_fi = 1;
 	}
@@ -247,6 +468,7 @@ out:
 	if (close_fi)
 		vfs_close(file);
 
+	op_stat_end(VFS_OP_READ, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = offset, .length = length, .fh = fi->fh, .result = err });
 	return err;
 }
 
@@ -256,18 +478,22 @@ out:
 static int op_write(const char *pathname, const char *buf, size_t length, off_t offset, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
 	int err, close_fi = 0;
 	struct file *file;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 	file = (struct file *) fi->fh;
+	op_stat_begin(&ctx);
 
 	/* open file if needed */
 	if (!file) {
 		file = vfs_open(vfs_data->sb->s_root_inode, pathname, O_WRONLY, 0);
-		if (!file)
+		if (!file) {
+			op_stat_end(VFS_OP_WRITE, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = offset, .length = length, .result = -1 });
 			return -1;
+		}
 
 		close_fi = 1;
 	}
@@ -284,6 +510,7 @@ out:
 	if (close_fi)
 		vfs_close(file);
 
+	op_stat_end(VFS_OP_WRITE, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = offset, .length = length, .fh = fi->fh, .result = err });
 	return err;
 }
 
@@ -294,13 +521,16 @@ static int op_statfs(const char *pathname, struct statvfs *statbuf)
 {
 	struct vfs_data *vfs_data;
 	struct statfs statbuf_fs;
+	struct vfs_stat_ctx ctx;
 	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* get stats */
+	op_stat_begin(&ctx);
 	err = vfs_statfs(vfs_data->sb, &statbuf_fs);
+	op_stat_end(VFS_OP_STATFS, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = err });
 	if (err)
 		return err;
 
@@ -322,7 +552,12 @@ static int op_statfs(const char *pathname, struct statvfs *statbuf)
  */
 static int op_flush(const char *pathname, struct fuse_file_info *fi)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "flush not implemented\n");
+	op_stat_end(VFS_OP_FLUSH, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi->fh, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -331,13 +566,19 @@ static int op_flush(const char *pathname, struct fuse_file_info *fi)
  */
 static int op_release(const char *pathname, struct fuse_file_info *fi)
 {
+	struct vfs_stat_ctx ctx;
 	struct file *file;
+	int err;
 
 	/* get file */
 	file = (struct file *) fi->fh;
 
 	/* close file */
-	return vfs_close(file);
+	op_stat_begin(&ctx);
+	err = vfs_close(file);
+	op_stat_end(VFS_OP_RELEASE, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi->fh, .result = err });
+
+	return err;
 }
 
 /*
@@ -345,8 +586,19 @@ static int op_release(const char *pathname, struct fuse_file_info *fi)
  */
 static int op_fsync(const char *pathname, int data_sync, struct fuse_file_info *fi)
 {
-	fprintf(stderr, "fsync not implemented\n");
-	return -ENOSYS;
+	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
+
+	/* get VFS data */
+	vfs_data = fuse_get_context()->private_data;
+
+	/* data is written through buffer cache : just synchronize file system metadata */
+	op_stat_begin(&ctx);
+	err = vfs_sync(vfs_data->sb);
+	op_stat_end(VFS_OP_FSYNC, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi ? fi->fh : 0, .result = err });
+
+	return err;
 }
 
 /*
@@ -354,7 +606,12 @@ static int op_fsync(const char *pathname, int data_sync, struct fuse_file_info *
  */
 static int op_setxattr(const char *pathname, const char *name, const char *value, size_t size, int flags)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "setxattr not implemented\n");
+	op_stat_end(VFS_OP_SETXATTR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -363,7 +620,12 @@ static int op_setxattr(const char *pathname, const char *name, const char *value
  */
 static int op_getxattr(const char *pathname, const char *name, char *value, size_t size)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "getxattr not implemented\n");
+	op_stat_end(VFS_OP_GETXATTR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -372,7 +634,12 @@ static int op_getxattr(const char *pathname, const char *name, char *value, size
  */
 static int op_listxattr(const char *pathname, char *list, size_t size)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "listxattr not implemented\n");
+	op_stat_end(VFS_OP_LISTXATTR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -381,7 +648,12 @@ static int op_listxattr(const char *pathname, char *list, size_t size)
  */
 static int op_removexattr(const char *pathname, const char *name)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "removexattr not implemented\n");
+	op_stat_end(VFS_OP_REMOVEXATTR, &ctx, &(struct vfs_trace_args) { .path = pathname, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -392,18 +664,23 @@ static int op_readdir(const char *pathname, void *buf, fuse_fill_dir_t filler, o
 {
 	struct dirent64 *dir_entry;
 	char dir_buf[DIR_BUF_SIZE];
+	struct vfs_stat_ctx ctx;
 	struct file *file;
+	struct stat st;
 	int n, i;
 
 	/* get file */
 	file = (struct file *) fi->fh;
 
 	/* read directory */
+	op_stat_begin(&ctx);
 	for (;;) {
 		/* read next entries */
 		n = vfs_getdents64(file, dir_buf, DIR_BUF_SIZE);
-		if (n < 0)
+		if (n < 0) {
+			op_stat_end(VFS_OP_READDIR, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi->fh, .result = n });
 			return n;
+		}
 
 		/* no more data */
 		if (n == 0)
@@ -414,14 +691,22 @@ static int op_readdir(const char *pathname, void *buf, fuse_fill_dir_t filler, o
 			/* get entry */
 			dir_entry = (struct dirent64 *) (dir_buf + i);
 
-			/* fill directory */
-			filler(buf, dir_entry->d_name, NULL, 0, 0);
+			/* fill directory (pass file type if known, so callers can skip getattr) */
+			if (dir_entry->d_type) {
+				memset(&st, 0, sizeof(struct stat));
+				st.st_ino = dir_entry->d_inode;
+				st.st_mode = dir_entry->d_type << 12;
+				filler(buf, dir_entry->d_name, &st, 0, 0);
+			} else {
+				filler(buf, dir_entry->d_name, NULL, 0, 0);
+			}
 
 			/* go to next entry */
 			i += dir_entry->d_reclen;
 		}
 	}
 
+	op_stat_end(VFS_OP_READDIR, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi->fh, .result = 0 });
 	return 0;
 }
 
@@ -431,16 +716,34 @@ static int op_readdir(const char *pathname, void *buf, fuse_fill_dir_t filler, o
 static void *op_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx stat_ctx;
 	struct fuse_context *ctx;
 
 	/* get VFS data */
 	ctx = fuse_get_context();
 	vfs_data = ctx->private_data;
 
+	/* create operations trace */
+	if (vfs_data->trace_path) {
+		vfs_data->trace = vfs_trace_create(vfs_data->trace_path, vfs_data->trace_records);
+		if (!vfs_data->trace)
+			fprintf(stderr, "VFS: can't create trace file %s\n", vfs_data->trace_path);
+	}
+
 	/* mount file system */
+	op_stat_begin(&stat_ctx);
 	vfs_data->sb = vfs_mount(vfs_data->dev, vfs_data->fs_type, vfs_data->fs_options);
-	if (!vfs_data->sb)
+	op_stat_end(VFS_OP_INIT, &stat_ctx, &(struct vfs_trace_args) { .path = vfs_data->dev, .result = vfs_data->sb ? 0 : -EINVAL });
+	if (!vfs_data->sb) {
 		fuse_exit(ctx->fuse);
+		return vfs_data;
+	}
+
+	/* start periodic commit thread */
+	if (pthread_create(&vfs_data->commit_thread, NULL, commit_thread, vfs_data) == 0)
+		vfs_data->commit_running = 1;
+	else
+		fprintf(stderr, "VFS: can't start periodic commit thread\n");
 
 	return vfs_data;
 }
@@ -451,13 +754,33 @@ static void *op_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 static void op_destroy(void *private_data)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
+	/* stop periodic commit thread */
+	if (vfs_data->commit_running) {
+		pthread_mutex_lock(&vfs_lock);
+		commit_stop = 1;
+		pthread_cond_signal(&commit_cond);
+		pthread_mutex_unlock(&vfs_lock);
+		pthread_join(vfs_data->commit_thread, NULL);
+		vfs_data->commit_running = 0;
+	}
+
 	/* unmount file system */
+	op_stat_begin(&ctx);
 	if (vfs_data->sb)
 		vfs_umount(vfs_data->sb);
+	op_stat_end(VFS_OP_DESTROY, &ctx, &(struct vfs_trace_args) { .path = vfs_data->dev });
+
+	/* dump latency histograms */
+	dump_stats(vfs_data);
+
+	/* close operations trace */
+	vfs_trace_close(vfs_data->trace);
+	vfs_data->trace = NULL;
 }
 
 /*
@@ -466,12 +789,18 @@ static void op_destroy(void *private_data)
 static int op_access(const char *pathname, int mask)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* check access */
-	return vfs_access(vfs_data->sb->s_root_inode, pathname, 0);
+	op_stat_begin(&ctx);
+	err = vfs_access(vfs_data->sb->s_root_inode, pathname, 0);
+	op_stat_end(VFS_OP_ACCESS, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = mask, .result = err });
+
+	return err;
 }
 
 /*
@@ -480,12 +809,18 @@ static int op_access(const char *pathname, int mask)
 static int op_create(const char *pathname, mode_t mode, struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* create file */
-	return vfs_create(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_begin(&ctx);
+	err = vfs_create(vfs_data->sb->s_root_inode, pathname, mode);
+	op_stat_end(VFS_OP_CREATE, &ctx, &(struct vfs_trace_args) { .path = pathname, .mode = mode, .result = err });
+
+	return err;
 }
 
 /*
@@ -493,7 +828,12 @@ static int op_create(const char *pathname, mode_t mode, struct fuse_file_info *f
  */
 static int op_lock(const char *pathname, struct fuse_file_info *fi, int cmd, struct flock *lock)
 {
+	struct vfs_stat_ctx ctx;
+
+	op_stat_begin(&ctx);
 	fprintf(stderr, "lock not implemented\n");
+	op_stat_end(VFS_OP_LOCK, &ctx, &(struct vfs_trace_args) { .path = pathname, .fh = fi->fh, .result = -ENOSYS });
+
 	return -ENOSYS;
 }
 
@@ -503,12 +843,63 @@ static int op_lock(const char *pathname, struct fuse_file_info *fi, int cmd, str
 static int op_utimens(const char *pathname, const struct timespec tv[2], struct fuse_file_info *fi)
 {
 	struct vfs_data *vfs_data;
+	struct vfs_stat_ctx ctx;
+	int err;
 
 	/* get VFS data */
 	vfs_data = fuse_get_context()->private_data;
 
 	/* set timestamps */
-	return vfs_utimens(vfs_data->sb->s_root_inode, pathname, tv, 0);
+	op_stat_begin(&ctx);
+	err = vfs_utimens(vfs_data->sb->s_root_inode, pathname, tv, 0);
+	op_stat_end(VFS_OP_UTIMENS, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = vfs_trace_time(&tv[0]),
+				 .offset2 = vfs_trace_time(&tv[1]), .result = err });
+
+	return err;
+}
+
+/*
+ * Seek a file (used for SEEK_DATA/SEEK_HOLE).
+ */
+static off_t op_lseek(const char *pathname, off_t offset, int whence, struct fuse_file_info *fi)
+{
+	struct vfs_stat_ctx ctx;
+	struct file *file;
+	off_t ret;
+
+	/* get file */
+	file = (struct file *) fi->fh;
+
+	/* seek */
+	op_stat_begin(&ctx);
+	ret = vfs_lseek(file, offset, whence);
+	op_stat_end(VFS_OP_LSEEK, &ctx, &(struct vfs_trace_args) { .path = pathname, .offset = offset, .mode = whence,
+				 .fh = fi->fh, .result = ret < 0 ? ret : 0 });
+
+	return ret;
+}
+
+/*
+ * Copy a range of a file to another file (file system may share data).
+ */
+static ssize_t op_copy_file_range(const char *pathname_in, struct fuse_file_info *fi_in, off_t off_in,
+				  const char *pathname_out, struct fuse_file_info *fi_out, off_t off_out, size_t len, int flags)
+{
+	struct vfs_stat_ctx ctx;
+	struct file *file_in, *file_out;
+	ssize_t ret;
+
+	/* get files */
+	file_in = (struct file *) fi_in->fh;
+	file_out = (struct file *) fi_out->fh;
+
+	/* copy */
+	op_stat_begin(&ctx);
+	ret = flags ? -EINVAL : vfs_copy_file_range(file_in, off_in, file_out, off_out, len);
+	op_stat_end(VFS_OP_COPY_FILE_RANGE, &ctx, &(struct vfs_trace_args) { .path = pathname_in, .path2 = pathname_out,
+				 .offset = off_in, .offset2 = off_out, .length = len, .fh = fi_in->fh, .result = ret });
+
+	return ret;
 }
 
 /*
@@ -548,12 +939,19 @@ static const struct fuse_operations vfs_ops = {
 	.create			= op_create,
 	.lock			= op_lock,
 	.utimens		= op_utimens,
+	.lseek			= op_lseek,
+	.copy_file_range	= op_copy_file_range,
 };
 
 /* Mount parameters */
-static const char *sopt = "t:h";
+static const char *sopt = "t:o:s:l:T:R:h";
 static const struct option lopt[] = {
 		{ "type",	required_argument,	NULL,	't'	},
+		{ "options",	required_argument,	NULL,	'o'	},
+		{ "stats",	required_argument,	NULL,	's'	},
+		{ "slow-op",	required_argument,	NULL,	'l'	},
+		{ "trace",	required_argument,	NULL,	'T'	},
+		{ "trace-size",	required_argument,	NULL,	'R'	},
 		{ "help",	no_argument,		NULL,	'h'	},
 		{ NULL,		0,			NULL,	0 	}
 };
@@ -568,6 +966,13 @@ static void usage(char *prog_name)
 	printf("Options :\n");
 	printf(" -h	print help\n");
 	printf(" -t	file system type (minix,bfs,ext2,isofs,memfs,ftpfs,tarfs)\n");
+	printf(" -o	file system options (comma separated, not for ftpfs)\n");
+	printf("	ext2 : discard, ro, commit=<seconds>, preload, pin_indirect\n");
+	printf("	memfs : size=<bytes>[k|m|g] (file data and metadata), nr_inodes=<n>[k|m|g]\n");
+	printf(" -s	dump latency histograms to file at umount ('-' = stderr)\n");
+	printf(" -l	log operations slower than this threshold (in microseconds)\n");
+	printf(" -T	trace operations to a binary ring file (see vfsreplay)\n");
+	printf(" -R	number of records in the trace ring (default %d)\n", VFS_TRACE_DEFAULT_RECORDS);
 }
 
 /*
@@ -591,11 +996,34 @@ static int parse_options(int argc, char **argv, struct vfs_data *vfs_data)
 			case 't':
 				fs_type = optarg;
 				break;
+			case 'o':
+				free(vfs_data->fs_options);
+				vfs_data->fs_options = strdup(optarg);
+				break;
+			case 's':
+				vfs_data->stats_path = strdup(optarg);
+				vfs_stats_enabled = 1;
+				break;
+			case 'l':
+				vfs_data->slow_op_ns = strtoull(optarg, NULL, 10) * 1000;
+				vfs_stats_enabled = 1;
+				break;
+			case 'T':
+				vfs_data->trace_path = strdup(optarg);
+				vfs_stats_enabled = 1;
+				break;
+			case 'R':
+				vfs_data->trace_records = strtoul(optarg, NULL, 10);
+				break;
 			default:
 				break;
 		}
 	}
 
+	/* default trace size */
+	if (!vfs_data->trace_records)
+		vfs_data->trace_records = VFS_TRACE_DEFAULT_RECORDS;
+
 	/* missing file system type */
 	if (!fs_type) {
 		usage(argv[0]);
@@ -633,6 +1061,12 @@ static int parse_options(int argc, char **argv, struct vfs_data *vfs_data)
 		vfs_data->fs_type = VFS_MEMFS_TYPE;
 	} else if (strcmp(fs_type, "ftpfs") == 0) {
 		vfs_data->fs_type = VFS_FTPFS_TYPE;
+
+		/* FTPFS options are connection parameters, asked at mount */
+		if (vfs_data->fs_options) {
+			fprintf(stderr, "VFS: ftpfs doesn't take mount options (connection parameters are asked)\n");
+			return -1;
+		}
 	} else if (strcmp(fs_type, "tarfs") == 0) {
 		vfs_data->fs_type = VFS_TARFS_TYPE;
 	} else {
@@ -648,10 +1082,9 @@ static int parse_options(int argc, char **argv, struct vfs_data *vfs_data)
  */
 static void ask_parameters(struct vfs_data *vfs_data)
 {
+	/* FTPFS options = connection parameters, other file systems get options string */
 	if (vfs_data->fs_type == VFS_FTPFS_TYPE)
 		vfs_data->fs_options = ftp_ask_parameters();
-	else
-		vfs_data->fs_options = NULL;
 }
 
 /*
@@ -687,9 +1120,16 @@ int main(int argc, char **argv)
 	/* ask user parameters */
 	ask_parameters(&vfs_data);
 
-	return fuse_main(fargs.argc, fargs.argv, &vfs_ops, &vfs_data);
+	err = fuse_main(fargs.argc, fargs.argv, &vfs_ops, &vfs_data);
+	fuse_opt_free_args(&fargs);
+	goto out;
 err:
+	err = -1;
+out:
 	free(vfs_data.dev);
 	free(vfs_data.mnt_point);
-	return -1;
+	free(vfs_data.fs_options);
+	free(vfs_data.stats_path);
+	free(vfs_data.trace_path);
+	return err;
 }
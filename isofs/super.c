@@ -81,6 +81,7 @@ int isofs_read_super(struct super_block *sb, void *data)
 	sb->s_magic = ISOFS_MAGIC;
 	sb->s_root_inode = NULL;
 	sb->s_op = &isofs_sops;
+	sb->s_flags |= VFS_SB_RDONLY;
 
 	/* release super block buffer */
 	brelse(sbh);
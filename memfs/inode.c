@@ -11,6 +11,7 @@
 struct file_operations memfs_file_fops = {
 	.read			= memfs_file_read,
 	.write			= memfs_file_write,
+	.copy_file_range	= memfs_file_copy_range,
 };
 
 /*
@@ -66,6 +67,9 @@ struct inode *memfs_alloc_inode(struct super_block *sb)
 
 	/* reset data */
 	memfs_inode->i_data = NULL;
+	memfs_inode->i_dir = NULL;
+	memfs_inode->i_pages = NULL;
+	memfs_inode->i_height = 0;
 
 	return &memfs_inode->vfs_inode;
 }
@@ -109,6 +113,10 @@ struct inode *memfs_new_inode(struct super_block *sb, mode_t mode)
 	struct memfs_sb_info *sbi = memfs_sb(sb);
 	struct inode *inode;
 
+	/* inodes limit reached */
+	if (sbi->s_max_inodes && sbi->s_ninodes >= sbi->s_max_inodes)
+		return NULL;
+
 	/* get an empty inode */
 	inode = vfs_get_empty_inode(sb);
 	if (!inode)
@@ -125,6 +133,9 @@ struct inode *memfs_new_inode(struct super_block *sb, mode_t mode)
 	inode->i_ref = 1;
 	inode->i_dirt = 1;
 	memfs_i(inode)->i_data = NULL;
+	memfs_i(inode)->i_dir = NULL;
+	memfs_i(inode)->i_pages = NULL;
+	memfs_i(inode)->i_height = 0;
 
 	/* set operations */
 	if (S_ISDIR(mode)) {
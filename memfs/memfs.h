@@ -1,6 +1,8 @@
 #ifndef _MEMFS_H_
 #define _MEMFS_H_
 
+#include <errno.h>
+
 #include "../vfs/vfs.h"
 
 #define MEMFS_MAGIC				0xABAB
@@ -9,19 +11,75 @@
 
 #define MEMFS_DIR_REC_LEN(name_len)		(8 + (name_len))
 
+#define MEMFS_PAGE_SHIFT			12
+#define MEMFS_PAGE_SIZE				(1 << MEMFS_PAGE_SHIFT)
+#define MEMFS_POOL_CHUNK			256				/* pages mapped at once by page pool */
+#define MEMFS_RADIX_SHIFT			6
+#define MEMFS_RADIX_SIZE			(1 << MEMFS_RADIX_SHIFT)
+#define MEMFS_RADIX_MASK			(MEMFS_RADIX_SIZE - 1)
+#define MEMFS_DIR_HTABLE_BITS			4				/* initial directory hash table size (log2) */
+#define MEMFS_DIR_SLOT_SIZE			(sizeof(struct memfs_dir_entry *) + sizeof(uint32_t))	/* slot and free slot stack entry */
+#define MEMFS_DIR_MIN_SLOTS			16				/* initial directory entries slots */
+
+/*
+ * MemFS data page.
+ */
+struct memfs_page {
+	char *					p_data;				/* Page data */
+	struct memfs_page_chunk *		p_chunk;			/* Chunk of page */
+	uint32_t				p_ref;				/* Reference counter (files sharing page) */
+	struct memfs_page *			p_next;				/* Next free page */
+};
+
+/*
+ * MemFS chunk of pages (pages are mapped at once).
+ */
+struct memfs_page_chunk {
+	char *					c_data;				/* Mapped pages */
+	uint32_t				c_nr_free;			/* Number of free pages */
+	struct memfs_page			c_pages[MEMFS_POOL_CHUNK];	/* Pages */
+	struct memfs_page_chunk *		c_next;				/* Next chunk */
+};
+
+/*
+ * MemFS run of contiguous free pages (given back to the system at once).
+ */
+struct memfs_page_run {
+	char *					r_data;				/* First page data */
+	size_t					r_len;				/* Length in bytes */
+};
+
+/*
+ * MemFS radix tree node (leaf nodes point to pages).
+ */
+struct memfs_radix_node {
+	void *					slots[MEMFS_RADIX_SIZE];	/* Children or pages */
+	int					count;				/* Number of used slots */
+};
+
 /*
  * MemFS in memory super block.
  */
 struct memfs_sb_info {
 	ino_t					s_inodes_cpt;			/* Inodes counter */
 	uint64_t				s_ninodes;			/* Total number of inodes */
+	uint64_t				s_max_inodes;			/* Maximum number of inodes (0 = no limit) */
+	uint64_t				s_nr_pages;			/* Number of used pages */
+	uint64_t				s_max_pages;			/* Maximum number of used pages (0 = no limit) */
+	uint64_t				s_meta_bytes;			/* Memory used by directories, symbolic links and radix tree nodes */
+	struct memfs_page *			s_free_pages;			/* Page pool free list */
+	uint64_t				s_nr_free_pages;		/* Number of free pages in pool */
+	struct memfs_page_chunk *		s_chunks;			/* Page pool chunks */
 };
 
 /*
  * MemFS in memory inode.
  */
 struct memfs_inode_info {
-	char *					i_data;				/* Pointers to data blocks */
+	char *					i_data;				/* Symbolic link target */
+	struct memfs_dir *			i_dir;				/* Directory entries */
+	struct memfs_radix_node *		i_pages;			/* Regular file pages */
+	int					i_height;			/* Pages radix tree height */
 	struct inode				vfs_inode;			/* VFS inode */
 };
 
@@ -29,11 +87,26 @@ struct memfs_inode_info {
  * MemFS directory entry.
  */
 struct memfs_dir_entry {
-	uint32_t				d_inode;			/* Inode number */
-	uint16_t				d_rec_len;			/* Directory entry length */
+	ino_t					d_inode;			/* Inode number */
+	uint32_t				d_hash;				/* Name hash */
+	uint32_t				d_cookie;			/* Readdir cookie (= slot in directory) */
+	struct htable_link			d_htable;			/* Directory hash table */
 	uint8_t					d_name_len;			/* Name length */
-	uint8_t					d_fileype;			/* File type */
-	char					d_name[MEMFS_NAME_LEN];		/* File name */
+	char					d_name[];			/* File name */
+};
+
+/*
+ * MemFS directory (entries hashed by name and stored in slots, a slot index is a stable readdir cookie).
+ */
+struct memfs_dir {
+	struct htable_link **			d_htable;			/* Entries hash table */
+	uint32_t				d_htable_bits;			/* Hash table size (log2) */
+	uint32_t				d_nr_entries;			/* Number of entries */
+	struct memfs_dir_entry **		d_slots;			/* Entries by cookie (NULL = free slot) */
+	uint32_t				d_nr_slots;			/* Number of used slots */
+	uint32_t				d_max_slots;			/* Number of allocated slots */
+	uint32_t *				d_free_slots;			/* Free slots stack */
+	uint32_t				d_nr_free_slots;		/* Number of free slots */
 };
 
 
@@ -58,6 +131,7 @@ void memfs_delete_inode(struct inode *inode);
 
 /* MemFS name resolution prototypes */
 int memfs_add_entry(struct inode *dir, const char *name, size_t name_len, ino_t ino);
+void memfs_release_dir(struct inode *dir);
 int memfs_lookup(struct inode *dir, const char *name, size_t name_len, struct inode **res_inode);
 int memfs_create(struct inode *dir, const char *name, size_t name_len, mode_t mode, struct inode **res_inode);
 int memfs_mkdir(struct inode *dir, const char *name, size_t name_len, mode_t mode);
@@ -74,8 +148,16 @@ ssize_t memfs_readlink(struct inode *inode, char *buf, size_t bufsize);
 /* MemFS file prototypes */
 int memfs_file_read(struct file *filp, char *buf, int count);
 int memfs_file_write(struct file *filp, const char *buf, int count);
+ssize_t memfs_file_copy_range(struct file *filp_in, off_t off_in, struct file *filp_out, off_t off_out, size_t len);
 int memfs_getdents64(struct file *filp, void *dirp, size_t count);
 
+/* MemFS page prototypes */
+void memfs_pool_release(struct super_block *sb);
+struct memfs_page *memfs_find_page(struct inode *inode, uint64_t index);
+struct memfs_page *memfs_get_page(struct inode *inode, uint64_t index, int *new);
+int memfs_share_page(struct inode *inode, uint64_t index, struct memfs_page *page);
+void memfs_truncate_pages(struct inode *inode, uint64_t start);
+
 /* MemFS truncate prototypes */
 void memfs_truncate(struct inode *inode);
 
@@ -87,6 +169,44 @@ static inline struct memfs_sb_info *memfs_sb(struct super_block *sb)
 	return sb->s_fs_info;
 }
 
+/*
+ * Get number of pages used by a MemFS file system (data pages and metadata rounded up to pages).
+ */
+static inline uint64_t memfs_used_pages(struct super_block *sb)
+{
+	return memfs_sb(sb)->s_nr_pages + ((memfs_sb(sb)->s_meta_bytes + MEMFS_PAGE_SIZE - 1) >> MEMFS_PAGE_SHIFT);
+}
+
+/*
+ * Check if MemFS size limit is reached.
+ */
+static inline int memfs_full(struct super_block *sb)
+{
+	return memfs_sb(sb)->s_max_pages && memfs_used_pages(sb) >= memfs_sb(sb)->s_max_pages;
+}
+
+/*
+ * Charge metadata memory to MemFS size limit (fails if limit would be exceeded).
+ */
+static inline int memfs_charge(struct super_block *sb, size_t size)
+{
+	struct memfs_sb_info *sbi = memfs_sb(sb);
+
+	if (sbi->s_max_pages && sbi->s_nr_pages + ((sbi->s_meta_bytes + size + MEMFS_PAGE_SIZE - 1) >> MEMFS_PAGE_SHIFT) > sbi->s_max_pages)
+		return -ENOSPC;
+
+	sbi->s_meta_bytes += size;
+	return 0;
+}
+
+/*
+ * Give metadata memory back to MemFS size limit.
+ */
+static inline void memfs_uncharge(struct super_block *sb, size_t size)
+{
+	memfs_sb(sb)->s_meta_bytes -= size;
+}
+
 /*
  * Get MemFS in memory inode from generic inode.
  */
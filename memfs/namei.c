@@ -1,18 +1,144 @@
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "memfs.h"
 
+/*
+ * Hash a file name (FNV-1a).
+ */
+static uint32_t memfs_name_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 /*
  * Test file names equality.
  */
-static inline int memfs_name_match(const char *name, size_t len, struct memfs_dir_entry *de)
+static inline int memfs_name_match(const char *name, size_t len, uint32_t hash, struct memfs_dir_entry *de)
 {
 	/* check dir entry */
-	if (!de || !de->d_inode || len > MEMFS_NAME_LEN)
+	if (!de || len > MEMFS_NAME_LEN)
 		return 0;
 
-	return len == de->d_name_len && !memcmp(name, de->d_name, len);
+	return hash == de->d_hash && len == de->d_name_len && !memcmp(name, de->d_name, len);
+}
+
+/*
+ * Get (or create) a MemFS directory.
+ */
+static struct memfs_dir *memfs_get_dir(struct inode *dir)
+{
+	struct memfs_inode_info *memfs_dir = memfs_i(dir);
+	struct memfs_dir *d;
+
+	if (memfs_dir->i_dir)
+		return memfs_dir->i_dir;
+
+	/* charge directory and hash table to size limit */
+	if (memfs_charge(dir->i_sb, sizeof(struct memfs_dir) + sizeof(struct htable_link *) * (1 << MEMFS_DIR_HTABLE_BITS)))
+		return NULL;
+
+	/* allocate directory */
+	d = (struct memfs_dir *) calloc(1, sizeof(struct memfs_dir));
+	if (!d)
+		goto err;
+
+	/* allocate hash table */
+	d->d_htable_bits = MEMFS_DIR_HTABLE_BITS;
+	d->d_htable = (struct htable_link **) malloc(sizeof(struct htable_link *) * (1 << d->d_htable_bits));
+	if (!d->d_htable) {
+		free(d);
+		goto err;
+	}
+	htable_init(d->d_htable, d->d_htable_bits);
+
+	memfs_dir->i_dir = d;
+	return d;
+err:
+	memfs_uncharge(dir->i_sb, sizeof(struct memfs_dir) + sizeof(struct htable_link *) * (1 << MEMFS_DIR_HTABLE_BITS));
+	return NULL;
+}
+
+/*
+ * Double size of a MemFS directory hash table.
+ */
+static int memfs_grow_dir_htable(struct super_block *sb, struct memfs_dir *d)
+{
+	struct htable_link **htable;
+	uint32_t bits = d->d_htable_bits + 1, i;
+
+	/* charge new hash table half (old one is replaced) */
+	if (memfs_charge(sb, sizeof(struct htable_link *) * (1 << d->d_htable_bits)))
+		return -ENOSPC;
+
+	/* allocate new hash table */
+	htable = (struct htable_link **) malloc(sizeof(struct htable_link *) * (1 << bits));
+	if (!htable) {
+		memfs_uncharge(sb, sizeof(struct htable_link *) * (1 << d->d_htable_bits));
+		return -ENOMEM;
+	}
+	htable_init(htable, bits);
+
+	/* rehash entries */
+	for (i = 0; i < d->d_nr_slots; i++)
+		if (d->d_slots[i])
+			htable_insert32(htable, &d->d_slots[i]->d_htable, d->d_slots[i]->d_hash, bits);
+
+	free(d->d_htable);
+	d->d_htable = htable;
+	d->d_htable_bits = bits;
+	return 0;
+}
+
+/*
+ * Get a free slot in a MemFS directory (freed slots are reused, so cookies stay small).
+ */
+static int memfs_get_dir_slot(struct super_block *sb, struct memfs_dir *d, uint32_t *slot)
+{
+	struct memfs_dir_entry **slots;
+	uint32_t *free_slots, max_slots;
+
+	/* reuse a freed slot */
+	if (d->d_nr_free_slots) {
+		*slot = d->d_free_slots[--d->d_nr_free_slots];
+		return 0;
+	}
+
+	/* grow slots */
+	if (d->d_nr_slots == d->d_max_slots) {
+		max_slots = d->d_max_slots ? d->d_max_slots * 2 : MEMFS_DIR_MIN_SLOTS;
+
+		/* charge new slots to size limit */
+		if (memfs_charge(sb, MEMFS_DIR_SLOT_SIZE * (max_slots - d->d_max_slots)))
+			return -ENOSPC;
+
+		slots = (struct memfs_dir_entry **) realloc(d->d_slots, sizeof(struct memfs_dir_entry *) * max_slots);
+		if (!slots)
+			goto err;
+		d->d_slots = slots;
+
+		/* free slots stack can hold all slots */
+		free_slots = (uint32_t *) realloc(d->d_free_slots, sizeof(uint32_t) * max_slots);
+		if (!free_slots)
+			goto err;
+		d->d_free_slots = free_slots;
+
+		d->d_max_slots = max_slots;
+	}
+
+	*slot = d->d_nr_slots++;
+	return 0;
+err:
+	memfs_uncharge(sb, MEMFS_DIR_SLOT_SIZE * (max_slots - d->d_max_slots));
+	return -ENOMEM;
 }
 
 /*
@@ -20,30 +146,22 @@ static inline int memfs_name_match(const char *name, size_t len, struct memfs_di
  */
 static int memfs_find_entry(struct inode *dir, const char *name, size_t name_len, struct memfs_dir_entry **res_de)
 {
+	struct memfs_dir *d = memfs_i(dir)->i_dir;
 	struct memfs_dir_entry *de;
-	uint32_t pos;
-
-	/* read all entries */
-	for (pos = 0; pos < dir->i_size;) {
-		/* check next entry */
-		de = (struct memfs_dir_entry *) (memfs_i(dir)->i_data + pos);
-		if (de->d_rec_len <= 0)
-			return -ENOENT;
-
-		/* skip null entry */
-		if (de->d_inode == 0) {
-			pos += de->d_rec_len;
-			continue;
-		}
+	struct htable_link *node;
+	uint32_t hash;
+
+	if (!d)
+		return -ENOENT;
 
-		/* check name */
-		if (memfs_name_match(name, name_len, de)) {
+	/* walk hash chain */
+	hash = memfs_name_hash(name, name_len);
+	for (node = htable_lookup32(d->d_htable, hash, d->d_htable_bits); node; node = node->next) {
+		de = htable_entry(node, struct memfs_dir_entry, d_htable);
+		if (memfs_name_match(name, name_len, hash, de)) {
 			*res_de = de;
 			return 0;
 		}
-
-		/* update position */
-		pos += de->d_rec_len;
 	}
 
 	return -ENOENT;
@@ -55,55 +173,59 @@ static int memfs_find_entry(struct inode *dir, const char *name, size_t name_len
 int memfs_add_entry(struct inode *dir, const char *name, size_t name_len, ino_t ino)
 {
 	struct memfs_dir_entry *de;
-	uint16_t rec_len;
-	uint32_t pos;
+	struct memfs_dir *d;
+	uint32_t slot;
+	int err;
 
 	/* truncate name if needed */
 	if (name_len > MEMFS_NAME_LEN)
 		name_len = MEMFS_NAME_LEN;
 
-	/* compute record length */
-	rec_len = MEMFS_DIR_REC_LEN(name_len);
-
-	/* try to find a free entry */
-	for (pos = 0; pos < dir->i_size;) {
-		/* check next entry */
-		de = (struct memfs_dir_entry *) (memfs_i(dir)->i_data + pos);
-		if (de->d_rec_len <= 0)
-			return -ENOENT;
-
-		/* free entry with enough space */
-		if (de->d_inode == 0 && de->d_rec_len >= rec_len) {
-			rec_len = de->d_rec_len;
-			goto found_entry;
-		}
+	/* get directory */
+	d = memfs_get_dir(dir);
+	if (!d)
+		return -ENOSPC;
 
-		/* go to next entry */
-		pos += de->d_rec_len;
-		de = (struct memfs_dir_entry *) ((char *) de + de->d_rec_len);
+	/* keep at most one entry per hash bucket on average */
+	if (d->d_nr_entries >= (1U << d->d_htable_bits)) {
+		err = memfs_grow_dir_htable(dir->i_sb, d);
+		if (err)
+			return err;
 	}
 
-	/* grow directory */
-	memfs_i(dir)->i_data = (char *) realloc(memfs_i(dir)->i_data, dir->i_size + rec_len);
-	if (!memfs_i(dir)->i_data)
+	/* charge entry to size limit */
+	if (memfs_charge(dir->i_sb, sizeof(struct memfs_dir_entry) + name_len))
+		return -ENOSPC;
+
+	/* allocate new entry */
+	de = (struct memfs_dir_entry *) malloc(sizeof(struct memfs_dir_entry) + name_len);
+	if (!de) {
+		memfs_uncharge(dir->i_sb, sizeof(struct memfs_dir_entry) + name_len);
 		return -ENOMEM;
+	}
 
-	/* go to new entry */
-	de = (struct memfs_dir_entry *) (memfs_i(dir)->i_data + dir->i_size);
-	dir->i_size += rec_len;
-	dir->i_dirt = 1;
-	goto found_entry;
+	/* get a slot */
+	err = memfs_get_dir_slot(dir->i_sb, d, &slot);
+	if (err) {
+		memfs_uncharge(dir->i_sb, sizeof(struct memfs_dir_entry) + name_len);
+		free(de);
+		return err;
+	}
 
-	return -EINVAL;
-found_entry:
 	/* set new entry */
-	de->d_rec_len = rec_len;
 	de->d_inode = ino;
+	de->d_hash = memfs_name_hash(name, name_len);
+	de->d_cookie = slot;
 	de->d_name_len = name_len;
-	de->d_fileype = 0;
 	memcpy(de->d_name, name, name_len);
 
+	/* add it to directory */
+	d->d_slots[slot] = de;
+	htable_insert32(d->d_htable, &de->d_htable, de->d_hash, d->d_htable_bits);
+	d->d_nr_entries++;
+
 	/* update parent directory */
+	dir->i_size += MEMFS_DIR_REC_LEN(name_len);
 	dir->i_mtime = dir->i_ctime = current_time();
 	dir->i_dirt = 1;
 
@@ -111,48 +233,69 @@ found_entry:
 }
 
 /*
- * Check if a directory is empty.
+ * Delete an entry from a directory.
  */
-static int memfs_empty_dir(struct inode *inode)
+static void memfs_delete_entry(struct inode *dir, struct memfs_dir_entry *de)
 {
-	struct memfs_dir_entry *de, *de1;
-	uint32_t offset;
+	struct memfs_dir *d = memfs_i(dir)->i_dir;
+
+	/* free slot */
+	d->d_slots[de->d_cookie] = NULL;
+	d->d_free_slots[d->d_nr_free_slots++] = de->d_cookie;
+	d->d_nr_entries--;
+
+	/* unhash and free entry */
+	htable_delete(&de->d_htable);
+	dir->i_size -= MEMFS_DIR_REC_LEN(de->d_name_len);
+	memfs_uncharge(dir->i_sb, sizeof(struct memfs_dir_entry) + de->d_name_len);
+	free(de);
+}
 
-	/* check directory size : must contain '.' and '..' */
-	if (inode->i_size < MEMFS_DIR_REC_LEN(1) + MEMFS_DIR_REC_LEN(2)) {
-		fprintf(stderr, "MemFS : bad directory size %ld (inode = %ld)\n", inode->i_size, inode->i_ino);
-		return 1;
-	}
+/*
+ * Release all entries of a directory.
+ */
+void memfs_release_dir(struct inode *dir)
+{
+	struct memfs_dir *d = memfs_i(dir)->i_dir;
+	uint32_t i;
 
-	/* get first 2 entries */
-	de = (struct memfs_dir_entry *) memfs_i(inode)->i_data;
-	de1 = (struct memfs_dir_entry *) ((char *) de + de->d_rec_len);
+	if (!d)
+		return;
 
-	/* first 2 entries must be '.' and '..' */
-	if (de->d_inode != inode->i_ino || !de1->d_inode || de->d_name_len != 1
-			|| memcmp(".", de->d_name, 1) || de1->d_name_len != 2 || memcmp("..", de1->d_name, 2)) {
-		fprintf(stderr, "MemFS : bad directory (inode = %ld) : no '.' or '..'\n", inode->i_ino);
-		return 1;
+	/* free entries */
+	for (i = 0; i < d->d_nr_slots; i++) {
+		if (d->d_slots[i])
+			memfs_uncharge(dir->i_sb, sizeof(struct memfs_dir_entry) + d->d_slots[i]->d_name_len);
+		free(d->d_slots[i]);
 	}
 
-	/* try to find an entry */
-	offset = de->d_rec_len + de1->d_rec_len;
-	de = (struct memfs_dir_entry *) ((char *) de1 + de1->d_rec_len);
-	while (offset < inode->i_size) {
-		/* check entry */
-		if (de->d_rec_len <= 0)
-			return 1;
+	/* free slots, hash table and directory */
+	memfs_uncharge(dir->i_sb, MEMFS_DIR_SLOT_SIZE * d->d_max_slots + sizeof(struct htable_link *) * (1 << d->d_htable_bits)
+		       + sizeof(struct memfs_dir));
+	free(d->d_slots);
+	free(d->d_free_slots);
+	free(d->d_htable);
+	free(d);
+	memfs_i(dir)->i_dir = NULL;
+}
 
-		/* entry found */
-		if (de->d_inode)
-			return 0;
+/*
+ * Check if a directory is empty.
+ */
+static int memfs_empty_dir(struct inode *inode)
+{
+	struct memfs_dir *d = memfs_i(inode)->i_dir;
+	struct memfs_dir_entry *de;
 
-		/* go to next entry */
-		offset += de->d_rec_len;
-		de = (struct memfs_dir_entry *) ((char *) de + de->d_rec_len);
+	/* directory must contain '.' and '..' */
+	if (!d || memfs_find_entry(inode, ".", 1, &de) || de->d_inode != inode->i_ino
+			|| memfs_find_entry(inode, "..", 2, &de)) {
+		fprintf(stderr, "MemFS : bad directory (inode = %ld) : no '.' or '..'\n", inode->i_ino);
+		return 1;
 	}
 
-	return 1;
+	/* no other entry */
+	return d->d_nr_entries == 2;
 }
 
 /*
@@ -264,7 +407,7 @@ int memfs_mkdir(struct inode *dir, const char *name, size_t name_len, mode_t mod
 	inode = memfs_new_inode(dir->i_sb, S_IFDIR | mode);
 	if (!inode) {
 		vfs_iput(dir);
-		return -ENOMEM;
+		return -ENOSPC;
 	}
 
 	/* mark inode dirty */
@@ -346,7 +489,7 @@ int memfs_rmdir(struct inode *dir, const char *name, size_t name_len)
 	}
 
 	/* remove entry */
-	de->d_inode = 0;
+	memfs_delete_entry(dir, de);
 
 	/* update dir */
 	dir->i_ctime = dir->i_mtime = current_time();
@@ -431,7 +574,7 @@ int memfs_unlink(struct inode *dir, const char *name, size_t name_len)
 	}
 
 	/* delete entry */
-	de->d_inode = 0;
+	memfs_delete_entry(dir, de);
 
 	/* update directory */
 	dir->i_ctime = dir->i_mtime = current_time();
@@ -464,8 +607,12 @@ int memfs_symlink(struct inode *dir, const char *name, size_t name_len, const ch
 		return -ENOSPC;
 	}
 
-	/* copy file name to file's data */
-	memfs_i(inode)->i_data = strdup(target);
+	/* copy file name to file's data (charged to size limit) */
+	if (memfs_charge(dir->i_sb, strlen(target) + 1) == 0) {
+		memfs_i(inode)->i_data = strdup(target);
+		if (!memfs_i(inode)->i_data)
+			memfs_uncharge(dir->i_sb, strlen(target) + 1);
+	}
 	if (!memfs_i(inode)->i_data) {
 		inode->i_nlinks = 0;
 		vfs_iput(inode);
@@ -553,7 +700,7 @@ int memfs_rename(struct inode *old_dir, const char *old_name, size_t old_name_le
 	}
 
 	/* remove old directory entry */
-	old_de->d_inode = 0;
+	memfs_delete_entry(old_dir, old_de);
 
 	/* update old and new directories */
 	old_dir->i_atime = old_dir->i_mtime = current_time();
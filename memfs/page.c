@@ -0,0 +1,394 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "memfs.h"
+
+/*
+ * Add a chunk of pages to MemFS page pool.
+ */
+static int memfs_pool_grow(struct memfs_sb_info *sbi)
+{
+	struct memfs_page_chunk *chunk;
+	int i;
+
+	/* allocate chunk */
+	chunk = (struct memfs_page_chunk *) malloc(sizeof(struct memfs_page_chunk));
+	if (!chunk)
+		return -ENOMEM;
+
+	/* map pages (page aligned and zero filled) */
+	chunk->c_data = mmap(NULL, MEMFS_POOL_CHUNK * MEMFS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk->c_data == MAP_FAILED) {
+		free(chunk);
+		return -ENOMEM;
+	}
+
+	/* add pages to free list */
+	for (i = MEMFS_POOL_CHUNK - 1; i >= 0; i--) {
+		chunk->c_pages[i].p_data = chunk->c_data + i * MEMFS_PAGE_SIZE;
+		chunk->c_pages[i].p_chunk = chunk;
+		chunk->c_pages[i].p_next = sbi->s_free_pages;
+		sbi->s_free_pages = &chunk->c_pages[i];
+	}
+
+	/* add chunk to pool */
+	chunk->c_nr_free = MEMFS_POOL_CHUNK;
+	chunk->c_next = sbi->s_chunks;
+	sbi->s_chunks = chunk;
+	sbi->s_nr_free_pages += MEMFS_POOL_CHUNK;
+
+	return 0;
+}
+
+/*
+ * Get a page from MemFS page pool (page content is undefined).
+ */
+static struct memfs_page *memfs_page_alloc(struct super_block *sb)
+{
+	struct memfs_sb_info *sbi = memfs_sb(sb);
+	struct memfs_page *page;
+
+	/* size limit reached */
+	if (memfs_full(sb))
+		return NULL;
+
+	/* grow pool if needed */
+	if (!sbi->s_free_pages && memfs_pool_grow(sbi))
+		return NULL;
+
+	/* take first free page */
+	page = sbi->s_free_pages;
+	sbi->s_free_pages = page->p_next;
+	sbi->s_nr_free_pages--;
+	sbi->s_nr_pages++;
+	page->p_chunk->c_nr_free--;
+	page->p_next = NULL;
+	page->p_ref = 1;
+
+	return page;
+}
+
+/*
+ * Release a page : last reference gives it back to MemFS page pool.
+ * Returns 1 if page is free and its memory must still be given back to the system.
+ */
+static int memfs_page_release(struct super_block *sb, struct memfs_page *page)
+{
+	struct memfs_sb_info *sbi = memfs_sb(sb);
+	struct memfs_page_chunk *chunk = page->p_chunk;
+
+	/* page still used by another file */
+	if (--page->p_ref)
+		return 0;
+
+	/* add page to free list */
+	page->p_next = sbi->s_free_pages;
+	sbi->s_free_pages = page;
+	sbi->s_nr_free_pages++;
+	sbi->s_nr_pages--;
+
+	/* release whole chunk memory at once (pages stay mapped and will be zero filled on next use) */
+	if (++chunk->c_nr_free == MEMFS_POOL_CHUNK) {
+		madvise(chunk->c_data, MEMFS_POOL_CHUNK * MEMFS_PAGE_SIZE, MADV_DONTNEED);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Release a page and give its memory back to the system if it is free.
+ */
+static void memfs_page_put(struct super_block *sb, struct memfs_page *page)
+{
+	if (memfs_page_release(sb, page))
+		madvise(page->p_data, MEMFS_PAGE_SIZE, MADV_DONTNEED);
+}
+
+/*
+ * Give memory of a run of contiguous free pages back to the system.
+ */
+static void memfs_page_run_flush(struct memfs_page_run *run)
+{
+	if (run->r_len)
+		madvise(run->r_data, run->r_len, MADV_DONTNEED);
+
+	run->r_len = 0;
+}
+
+/*
+ * Release a page and add it to a run of free pages (run is flushed when page is not contiguous).
+ */
+static void memfs_page_put_run(struct super_block *sb, struct memfs_page *page, struct memfs_page_run *run)
+{
+	if (!memfs_page_release(sb, page))
+		return;
+
+	/* extend run */
+	if (run->r_len && run->r_data + run->r_len == page->p_data) {
+		run->r_len += MEMFS_PAGE_SIZE;
+		return;
+	}
+
+	/* start a new run */
+	memfs_page_run_flush(run);
+	run->r_data = page->p_data;
+	run->r_len = MEMFS_PAGE_SIZE;
+}
+
+/*
+ * Release MemFS page pool (all pages must be free).
+ */
+void memfs_pool_release(struct super_block *sb)
+{
+	struct memfs_sb_info *sbi = memfs_sb(sb);
+	struct memfs_page_chunk *chunk;
+
+	while (sbi->s_chunks) {
+		chunk = sbi->s_chunks;
+		sbi->s_chunks = chunk->c_next;
+		munmap(chunk->c_data, MEMFS_POOL_CHUNK * MEMFS_PAGE_SIZE);
+		free(chunk);
+	}
+
+	sbi->s_free_pages = NULL;
+	sbi->s_nr_free_pages = 0;
+	sbi->s_nr_pages = 0;
+}
+
+/*
+ * Get number of pages addressed by a radix tree of a given height.
+ */
+static inline uint64_t memfs_radix_capacity(int height)
+{
+	return height * MEMFS_RADIX_SHIFT >= 64 ? UINT64_MAX : 1ULL << (height * MEMFS_RADIX_SHIFT);
+}
+
+/*
+ * Allocate a radix tree node (charged to MemFS size limit).
+ */
+static struct memfs_radix_node *memfs_radix_node_alloc(struct super_block *sb)
+{
+	struct memfs_radix_node *node;
+
+	if (memfs_charge(sb, sizeof(struct memfs_radix_node)))
+		return NULL;
+
+	node = (struct memfs_radix_node *) calloc(1, sizeof(struct memfs_radix_node));
+	if (!node)
+		memfs_uncharge(sb, sizeof(struct memfs_radix_node));
+
+	return node;
+}
+
+/*
+ * Free a radix tree node.
+ */
+static void memfs_radix_node_free(struct super_block *sb, struct memfs_radix_node *node)
+{
+	memfs_uncharge(sb, sizeof(struct memfs_radix_node));
+	free(node);
+}
+
+/*
+ * Get radix tree leaf node addressing a page of a MemFS inode (missing nodes are created if create is set).
+ */
+static struct memfs_radix_node *memfs_radix_leaf(struct inode *inode, uint64_t index, int create)
+{
+	struct memfs_inode_info *memfs_inode = memfs_i(inode);
+	struct memfs_radix_node *node, **slot;
+	int shift;
+
+	/* index is not addressed by tree */
+	if (!create && (!memfs_inode->i_pages || index >= memfs_radix_capacity(memfs_inode->i_height)))
+		return NULL;
+
+	/* grow tree until it addresses index (old root becomes first child of new root) */
+	while (!memfs_inode->i_pages || index >= memfs_radix_capacity(memfs_inode->i_height)) {
+		node = memfs_radix_node_alloc(inode->i_sb);
+		if (!node)
+			return NULL;
+
+		if (memfs_inode->i_pages) {
+			node->slots[0] = memfs_inode->i_pages;
+			node->count = 1;
+		}
+
+		memfs_inode->i_pages = node;
+		memfs_inode->i_height++;
+	}
+
+	/* walk down to leaf node */
+	node = memfs_inode->i_pages;
+	for (shift = (memfs_inode->i_height - 1) * MEMFS_RADIX_SHIFT; shift > 0; shift -= MEMFS_RADIX_SHIFT) {
+		slot = (struct memfs_radix_node **) &node->slots[(index >> shift) & MEMFS_RADIX_MASK];
+		if (!*slot) {
+			if (!create)
+				return NULL;
+
+			*slot = memfs_radix_node_alloc(inode->i_sb);
+			if (!*slot)
+				return NULL;
+
+			node->count++;
+		}
+
+		node = *slot;
+	}
+
+	return node;
+}
+
+/*
+ * Find a page of a MemFS inode (returns NULL for a hole). Page may be shared : it must not be modified.
+ */
+struct memfs_page *memfs_find_page(struct inode *inode, uint64_t index)
+{
+	struct memfs_radix_node *node;
+
+	node = memfs_radix_leaf(inode, index, 0);
+	if (!node)
+		return NULL;
+
+	return node->slots[index & MEMFS_RADIX_MASK];
+}
+
+/*
+ * Get (or create) a private page of a MemFS inode. new is set if page was created (caller must fill it).
+ * A shared page is copied first (copy on write).
+ */
+struct memfs_page *memfs_get_page(struct inode *inode, uint64_t index, int *new)
+{
+	struct memfs_radix_node *node;
+	struct memfs_page *page, *old_page;
+
+	/* get leaf node */
+	*new = 0;
+	node = memfs_radix_leaf(inode, index, 1);
+	if (!node)
+		return NULL;
+
+	/* private page exists */
+	old_page = node->slots[index & MEMFS_RADIX_MASK];
+	if (old_page && old_page->p_ref == 1)
+		return old_page;
+
+	/* allocate page */
+	page = memfs_page_alloc(inode->i_sb);
+	if (!page)
+		return NULL;
+
+	/* copy shared page and release it */
+	if (old_page) {
+		memcpy(page->p_data, old_page->p_data, MEMFS_PAGE_SIZE);
+		memfs_page_put(inode->i_sb, old_page);
+		node->slots[index & MEMFS_RADIX_MASK] = page;
+		return page;
+	}
+
+	/* add it to tree */
+	node->slots[index & MEMFS_RADIX_MASK] = page;
+	node->count++;
+	inode->i_blocks += MEMFS_PAGE_SIZE >> 9;
+	*new = 1;
+
+	return page;
+}
+
+/*
+ * Map a page in a MemFS inode (page is shared, NULL page punches a hole). Previous page is released.
+ */
+int memfs_share_page(struct inode *inode, uint64_t index, struct memfs_page *page)
+{
+	struct memfs_radix_node *node;
+	struct memfs_page *old_page;
+
+	/* get leaf node (a hole needs no node) */
+	node = memfs_radix_leaf(inode, index, page != NULL);
+	if (!node)
+		return page ? -ENOMEM : 0;
+
+	/* page already mapped */
+	old_page = node->slots[index & MEMFS_RADIX_MASK];
+	if (old_page == page)
+		return 0;
+
+	/* release previous page */
+	if (old_page) {
+		memfs_page_put(inode->i_sb, old_page);
+		node->count--;
+		inode->i_blocks -= MEMFS_PAGE_SIZE >> 9;
+	}
+
+	/* map page */
+	node->slots[index & MEMFS_RADIX_MASK] = page;
+	if (page) {
+		page->p_ref++;
+		node->count++;
+		inode->i_blocks += MEMFS_PAGE_SIZE >> 9;
+	}
+
+	return 0;
+}
+
+/*
+ * Free pages of a radix tree node from index start (base = first index addressed by node).
+ * Returns 1 if node is empty (and has been freed).
+ */
+static int memfs_radix_truncate(struct inode *inode, struct memfs_radix_node *node, int height, uint64_t base,
+				uint64_t start, struct memfs_page_run *run)
+{
+	uint64_t span = memfs_radix_capacity(height - 1), first;
+	int i;
+
+	for (i = 0; i < MEMFS_RADIX_SIZE; i++) {
+		if (!node->slots[i])
+			continue;
+
+		/* slot is before start */
+		first = base + i * span;
+		if (first + span <= start)
+			continue;
+
+		/* free page or sub tree */
+		if (height == 1) {
+			memfs_page_put_run(inode->i_sb, node->slots[i], run);
+			inode->i_blocks -= MEMFS_PAGE_SIZE >> 9;
+		} else if (!memfs_radix_truncate(inode, node->slots[i], height - 1, first, start, run)) {
+			continue;
+		}
+
+		node->slots[i] = NULL;
+		node->count--;
+	}
+
+	/* free empty node */
+	if (node->count)
+		return 0;
+
+	memfs_radix_node_free(inode->i_sb, node);
+	return 1;
+}
+
+/*
+ * Free pages of a MemFS inode from index start (memory of freed pages is given back to the system).
+ */
+void memfs_truncate_pages(struct inode *inode, uint64_t start)
+{
+	struct memfs_inode_info *memfs_inode = memfs_i(inode);
+	struct memfs_page_run run = { NULL, 0 };
+
+	if (!memfs_inode->i_pages)
+		return;
+
+	/* free pages (and whole tree if it gets empty) */
+	if (memfs_radix_truncate(inode, memfs_inode->i_pages, memfs_inode->i_height, 0, start, &run)) {
+		memfs_inode->i_pages = NULL;
+		memfs_inode->i_height = 0;
+	}
+
+	/* give last run of free pages back to the system */
+	memfs_page_run_flush(&run);
+}
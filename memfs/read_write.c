@@ -10,17 +10,40 @@
  */
 int memfs_file_read(struct file *filp, char *buf, int count)
 {
+	struct inode *inode = filp->f_inode;
+	struct memfs_page *page;
+	int offset, nb_chars, left;
+
 	/* adjust size */
-	if (filp->f_pos + count > filp->f_inode->i_size)
-		count = filp->f_inode->i_size - filp->f_pos;
+	if (filp->f_pos >= inode->i_size)
+		return 0;
+	if (filp->f_pos + count > inode->i_size)
+		count = inode->i_size - filp->f_pos;
+
+	/* read page by page */
+	for (left = count; left > 0;) {
+		/* compute number of characters to read in this page */
+		offset = filp->f_pos & (MEMFS_PAGE_SIZE - 1);
+		nb_chars = MEMFS_PAGE_SIZE - offset;
+		if (nb_chars > left)
+			nb_chars = left;
 
-	/* copy data */
-	memcpy(buf, memfs_i(filp->f_inode)->i_data + filp->f_pos, count);
-	filp->f_pos += count;
+		/* copy data (holes are read as zeros) */
+		page = memfs_find_page(inode, filp->f_pos >> MEMFS_PAGE_SHIFT);
+		if (page)
+			memcpy(buf, page->p_data + offset, nb_chars);
+		else
+			memset(buf, 0, nb_chars);
+
+		/* update sizes */
+		filp->f_pos += nb_chars;
+		buf += nb_chars;
+		left -= nb_chars;
+	}
 
 	/* update inode */
-	filp->f_inode->i_atime = current_time();
-	filp->f_inode->i_dirt = 1;
+	inode->i_atime = current_time();
+	inode->i_dirt = 1;
 
 	return count;
 }
@@ -30,26 +53,120 @@ int memfs_file_read(struct file *filp, char *buf, int count)
  */
 int memfs_file_write(struct file *filp, const char *buf, int count)
 {
+	struct inode *inode = filp->f_inode;
+	struct memfs_page *page;
+	int offset, nb_chars, left, new;
+
 	/* handle append flag */
 	if (filp->f_flags & O_APPEND)
-		filp->f_pos = filp->f_inode->i_size;
+		filp->f_pos = inode->i_size;
+
+	/* write page by page */
+	for (left = count; left > 0;) {
+		/* compute number of characters to write in this page */
+		offset = filp->f_pos & (MEMFS_PAGE_SIZE - 1);
+		nb_chars = MEMFS_PAGE_SIZE - offset;
+		if (nb_chars > left)
+			nb_chars = left;
+
+		/* get page */
+		page = memfs_get_page(inode, filp->f_pos >> MEMFS_PAGE_SHIFT, &new);
+		if (!page)
+			break;
 
-	/* grow file if needed */
-	if (filp->f_pos + count > filp->f_inode->i_size) {
-		memfs_i(filp->f_inode)->i_data = (char *) realloc(memfs_i(filp->f_inode)->i_data, filp->f_pos + count);
-		if (!memfs_i(filp->f_inode)->i_data)
-			return -ENOMEM;
+		/* clear new page if partially written */
+		if (new && nb_chars < MEMFS_PAGE_SIZE)
+			memset(page->p_data, 0, MEMFS_PAGE_SIZE);
 
-		filp->f_inode->i_size = filp->f_pos + count;
+		/* copy data */
+		memcpy(page->p_data + offset, buf, nb_chars);
+
+		/* update sizes */
+		filp->f_pos += nb_chars;
+		buf += nb_chars;
+		left -= nb_chars;
+
+		/* grow file if needed */
+		if (filp->f_pos > inode->i_size)
+			inode->i_size = filp->f_pos;
 	}
 
-	/* copy data */
-	memcpy(memfs_i(filp->f_inode)->i_data + filp->f_pos, buf, count);
-	filp->f_pos += count;
+	/* no page written */
+	if (left == count)
+		return memfs_full(inode->i_sb) ? -ENOSPC : -ENOMEM;
 
 	/* update inode */
-	filp->f_inode->i_mtime = filp->f_inode->i_ctime = current_time();
-	filp->f_inode->i_dirt = 1;
+	inode->i_mtime = inode->i_ctime = current_time();
+	inode->i_dirt = 1;
 
-	return count;
+	return count - left;
+}
+
+/*
+ * Copy a range of a file to another file : whole pages are shared (and copied at first write), other data is copied.
+ */
+ssize_t memfs_file_copy_range(struct file *filp_in, off_t off_in, struct file *filp_out, off_t off_out, size_t len)
+{
+	struct inode *inode_in = filp_in->f_inode, *inode_out = filp_out->f_inode;
+	struct memfs_page *page_in, *page_out;
+	int offset_in, offset_out, new, err = 0;
+	size_t copied, nb_chars;
+
+	for (copied = 0; copied < len; copied += nb_chars) {
+		/* get input page */
+		offset_in = (off_in + copied) & (MEMFS_PAGE_SIZE - 1);
+		offset_out = (off_out + copied) & (MEMFS_PAGE_SIZE - 1);
+		page_in = memfs_find_page(inode_in, (off_in + copied) >> MEMFS_PAGE_SHIFT);
+
+		/* share aligned pages (last input page is shared if it ends output file, its end is cleared) */
+		nb_chars = len - copied < MEMFS_PAGE_SIZE ? len - copied : MEMFS_PAGE_SIZE;
+		if (!offset_in && !offset_out
+		    && (nb_chars == MEMFS_PAGE_SIZE
+			|| (off_in + copied + nb_chars == (size_t) inode_in->i_size
+			    && off_out + copied + nb_chars >= (size_t) inode_out->i_size))) {
+			err = memfs_share_page(inode_out, (off_out + copied) >> MEMFS_PAGE_SHIFT, page_in);
+			if (err)
+				break;
+
+			goto next;
+		}
+
+		/* compute number of characters to copy in these pages */
+		if (nb_chars > (size_t) (MEMFS_PAGE_SIZE - offset_in))
+			nb_chars = MEMFS_PAGE_SIZE - offset_in;
+		if (nb_chars > (size_t) (MEMFS_PAGE_SIZE - offset_out))
+			nb_chars = MEMFS_PAGE_SIZE - offset_out;
+
+		/* get output page */
+		page_out = memfs_get_page(inode_out, (off_out + copied) >> MEMFS_PAGE_SHIFT, &new);
+		if (!page_out) {
+			err = memfs_full(inode_out->i_sb) ? -ENOSPC : -ENOMEM;
+			break;
+		}
+
+		/* clear new page if partially written */
+		if (new && nb_chars < MEMFS_PAGE_SIZE)
+			memset(page_out->p_data, 0, MEMFS_PAGE_SIZE);
+
+		/* copy data (holes are copied as zeros) */
+		if (page_in)
+			memcpy(page_out->p_data + offset_out, page_in->p_data + offset_in, nb_chars);
+		else
+			memset(page_out->p_data + offset_out, 0, nb_chars);
+
+next:
+		/* grow output file if needed */
+		if (off_out + copied + nb_chars > (size_t) inode_out->i_size)
+			inode_out->i_size = off_out + copied + nb_chars;
+	}
+
+	/* nothing copied */
+	if (!copied)
+		return err;
+
+	/* update output inode */
+	inode_out->i_mtime = inode_out->i_ctime = current_time();
+	inode_out->i_dirt = 1;
+
+	return copied;
 }
@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "memfs.h"
@@ -14,6 +16,72 @@ struct super_operations memfs_sops = {
 	.statfs				= memfs_statfs,
 };
 
+/*
+ * Parse a MemFS size (with an optional k, m or g suffix).
+ */
+static int memfs_parse_size(const char *str, uint64_t *res)
+{
+	char *end;
+
+	*res = strtoull(str, &end, 10);
+	switch (*end) {
+		case 'g':
+		case 'G':
+			*res <<= 10;
+			/* fall through */
+		case 'm':
+		case 'M':
+			*res <<= 10;
+			/* fall through */
+		case 'k':
+		case 'K':
+			*res <<= 10;
+			end++;
+			break;
+		default:
+			break;
+	}
+
+	return end == str || *end ? -EINVAL : 0;
+}
+
+/*
+ * Parse MemFS mount options.
+ */
+static int memfs_parse_options(struct memfs_sb_info *sbi, const char *options)
+{
+	char *opts, *opt, *saveptr;
+	uint64_t size;
+	int err = 0;
+
+	/* no options = no limits */
+	sbi->s_max_pages = 0;
+	sbi->s_max_inodes = 0;
+	if (!options)
+		return 0;
+
+	/* duplicate options */
+	opts = strdup(options);
+	if (!opts)
+		return -ENOMEM;
+
+	/* parse options */
+	for (opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+		if (strncmp(opt, "size=", 5) == 0 && memfs_parse_size(opt + 5, &size) == 0) {
+			sbi->s_max_pages = (size + MEMFS_PAGE_SIZE - 1) >> MEMFS_PAGE_SHIFT;
+		} else if (strncmp(opt, "nr_inodes=", 10) == 0 && memfs_parse_size(opt + 10, &size) == 0) {
+			sbi->s_max_inodes = size;
+		} else {
+			fprintf(stderr, "MemFS : unknown mount option '%s'\n", opt);
+			err = -EINVAL;
+			break;
+		}
+	}
+
+	free(opts);
+	return err;
+}
+
 /*
  * Read a MemFS super block.
  */
@@ -27,6 +95,12 @@ int memfs_read_super(struct super_block *sb, void *data)
 	if (!sbi)
 		return -ENOMEM;
 
+	/* parse mount options */
+	err = memfs_parse_options(sbi, data);
+	if (err)
+		goto err;
+	err = -EINVAL;
+
 	/* set super block */
 	sb->s_blocksize = 1;
 	sb->s_blocksize_bits = 0;
@@ -34,6 +108,11 @@ int memfs_read_super(struct super_block *sb, void *data)
 	sb->s_op = &memfs_sops;
 	memfs_sb(sb)->s_inodes_cpt = MEMFS_ROOT_INODE;
 	memfs_sb(sb)->s_ninodes = 0;
+	memfs_sb(sb)->s_free_pages = NULL;
+	memfs_sb(sb)->s_nr_free_pages = 0;
+	memfs_sb(sb)->s_nr_pages = 0;
+	memfs_sb(sb)->s_meta_bytes = 0;
+	memfs_sb(sb)->s_chunks = NULL;
 
 	/* create root inode */
 	sb->s_root_inode = memfs_new_inode(sb, S_IFDIR | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
@@ -73,24 +152,43 @@ void memfs_put_super(struct super_block *sb)
 	/* release root inode */
 	vfs_iput(sb->s_root_inode);
 
+	/* release page pool */
+	memfs_pool_release(sb);
+
 	/* free in memory super block */
 	free(sbi);
 }
 
 /*
- * Get MemFS File system status.
+ * Get MemFS File system status (without limits, free space is free system memory).
  */
 int memfs_statfs(struct super_block *sb, struct statfs *buf)
 {
-	/* set stat buffer */
+	struct memfs_sb_info *sbi = memfs_sb(sb);
+	uint64_t nr_free_pages;
+
+	/* compute free pages */
+	if (sbi->s_max_pages)
+		nr_free_pages = sbi->s_max_pages - memfs_used_pages(sb);
+	else
+		nr_free_pages = (uint64_t) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE) >> MEMFS_PAGE_SHIFT;
+
+	/* set stat buffer (space is counted in pages) */
 	buf->f_type = sb->s_magic;
-	buf->f_bsize = sb->s_blocksize;
-	buf->f_blocks = 0;
-	buf->f_bfree = 0;
-	buf->f_bavail = 0;
-	buf->f_files = memfs_sb(sb)->s_ninodes;
-	buf->f_ffree = 0;
+	buf->f_bsize = MEMFS_PAGE_SIZE;
+	buf->f_blocks = memfs_used_pages(sb) + nr_free_pages;
+	buf->f_bfree = nr_free_pages;
+	buf->f_bavail = nr_free_pages;
 	buf->f_namelen = MEMFS_NAME_LEN;
 
+	/* without inodes limit, an inode can be created per free page */
+	if (sbi->s_max_inodes) {
+		buf->f_files = sbi->s_max_inodes;
+		buf->f_ffree = sbi->s_max_inodes - sbi->s_ninodes;
+	} else {
+		buf->f_files = sbi->s_ninodes + nr_free_pages;
+		buf->f_ffree = nr_free_pages;
+	}
+
 	return 0;
 }
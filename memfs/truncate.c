@@ -1,7 +1,36 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "memfs.h"
 
+/*
+ * Truncate a regular file (pages after end are freed, end of last page is cleared).
+ */
+static void memfs_truncate_file(struct inode *inode)
+{
+	struct memfs_page *page;
+	int offset, new;
+
+	/* free pages after end of file */
+	memfs_truncate_pages(inode, (inode->i_size + MEMFS_PAGE_SIZE - 1) >> MEMFS_PAGE_SHIFT);
+
+	/* no last page */
+	offset = inode->i_size & (MEMFS_PAGE_SIZE - 1);
+	page = offset ? memfs_find_page(inode, inode->i_size >> MEMFS_PAGE_SHIFT) : NULL;
+	if (!page)
+		return;
+
+	/* a shared last page is copied first */
+	if (page->p_ref > 1)
+		page = memfs_get_page(inode, inode->i_size >> MEMFS_PAGE_SHIFT, &new);
+
+	/* clear end of last page (file may grow again) */
+	if (page)
+		memset(page->p_data + offset, 0, MEMFS_PAGE_SIZE - offset);
+	else
+		fprintf(stderr, "MemFS : can't clear end of inode %ld\n", inode->i_ino);
+}
+
 /*
  * Truncate an inode.
  */
@@ -9,15 +38,34 @@ void memfs_truncate(struct inode *inode)
 {
 	struct memfs_inode_info *memfs_inode = memfs_i(inode);
 
-	/* just free data */
+	/* regular files are stored in pages */
+	if (S_ISREG(inode->i_mode)) {
+		memfs_truncate_file(inode);
+		goto out;
+	}
+
+	/* directory entries are freed with directory */
+	if (S_ISDIR(inode->i_mode)) {
+		if (inode->i_size <= 0)
+			memfs_release_dir(inode);
+		goto out;
+	}
+
+	/* just free data (symbolic link target, charged to size limit) */
 	if (inode->i_size <= 0 && memfs_inode->i_data) {
+		memfs_uncharge(inode->i_sb, strlen(memfs_inode->i_data) + 1);
 		free(memfs_inode->i_data);
 		memfs_inode->i_data = NULL;
 		goto out;
 	}
 
-	/* reallocate with new size */
-	memfs_inode->i_data = (char *) realloc(memfs_inode->i_data, inode->i_size);
+	/* shrink symbolic link target in place (kept null terminated, it can't grow) */
+	if (memfs_inode->i_data && (size_t) inode->i_size < strlen(memfs_inode->i_data)) {
+		memfs_uncharge(inode->i_sb, strlen(memfs_inode->i_data) - inode->i_size);
+		memfs_inode->i_data[inode->i_size] = 0;
+	} else if (memfs_inode->i_data) {
+		inode->i_size = strlen(memfs_inode->i_data);
+	}
 
 out:
 	/* update inode */
@@ -0,0 +1,249 @@
+#!/bin/bash
+#
+# FUSE level benchmark : build images with the Makefile recipes, mount them with fmounter
+# and run a fixed matrix (fio, metadata storms, ls -lR, tar, du). Results go into a JSON report.
+#
+# usage : ./scripts/bench.sh [-f fs,...] [-o report.json] [-s size] [-b bs,...] [-n nr_files] [-w work_dir] [-c baseline.json]
+#
+
+FS_LIST="minix,bfs,ext2,memfs,isofs,tarfs"
+REPORT="bench-$(date +%Y%m%d-%H%M%S).json"
+SIZE="16m"
+BS_LIST="4k,128k,1m"
+NR_FILES=2000
+WORK_DIR="/tmp/fsbench.$$"
+BASELINE=""
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+RESULTS=()
+FAILURES=()
+
+usage() {
+	echo "usage: $0 [-f fs,...] [-o report.json] [-s size] [-b bs,...] [-n nr_files] [-w work_dir] [-c baseline.json]"
+	echo ""
+	echo "Options :"
+	echo " -f	file systems to test (default $FS_LIST)"
+	echo " -o	JSON report (default bench-<date>.json)"
+	echo " -s	fio file size (default $SIZE)"
+	echo " -b	fio block sizes (default $BS_LIST)"
+	echo " -n	number of files for metadata storms (default $NR_FILES)"
+	echo " -w	work directory (images, mount point, source tree)"
+	echo " -c	compare report with a baseline report (see scripts/bench_compare.sh)"
+	exit 1
+}
+
+# add a result
+add_result() {
+	local fs=$1 test=$2 value=$3 unit=$4 better=$5
+
+	RESULTS+=("{\"fs\":\"$fs\",\"test\":\"$test\",\"value\":$value,\"unit\":\"$unit\",\"better\":\"$better\"}")
+	printf "%-8s %-24s %12.3f %s\n" "$fs" "$test" "$value" "$unit"
+}
+
+# add a failed test (no result is recorded, bench_compare.sh reports it as missing)
+add_failure() {
+	local fs=$1 test=$2 status=$3
+
+	FAILURES+=("{\"fs\":\"$fs\",\"test\":\"$test\",\"status\":$status}")
+	printf "%-8s %-24s %12s (status %d)\n" "$fs" "$test" "FAILED" "$status" >&2
+}
+
+# time a command (in seconds, a failed command is recorded as a failure)
+time_cmd() {
+	local fs=$1 test=$2 start end status
+
+	shift 2
+	start=$(date +%s%N)
+	"$@" > /dev/null 2>&1
+	status=$?
+	end=$(date +%s%N)
+	if [ $status -ne 0 ]; then
+		add_failure "$fs" "$test" $status
+		return $status
+	fi
+	add_result "$fs" "$test" "$(awk "BEGIN { printf \"%.6f\", ($end - $start) / 1000000000 }")" "s" "lower"
+}
+
+# run a fio job (bandwidth in MB/s and 99th percentile completion latency in us)
+run_fio() {
+	local fs=$1 rw=$2 bs=$3 out dir status
+
+	shift 3
+	out=$(fio --name="$rw" --rw="$rw" --bs="$bs" --size="$SIZE" --output-format=json "$@" 2> /dev/null)
+	status=$?
+	if [ $status -ne 0 ]; then
+		add_failure "$fs" "fio_${rw}_${bs}" $status
+		return $status
+	fi
+	dir=$(echo "$rw" | sed 's/rand//')
+	add_result "$fs" "fio_${rw}_${bs}" "$(echo "$out" | jq ".jobs[0].$dir.bw_bytes / 1048576")" "MB/s" "higher"
+	add_result "$fs" "fio_${rw}_${bs}_p99" "$(echo "$out" | jq ".jobs[0].$dir.clat_ns.percentile[\"99.000000\"] // 0 | . / 1000")" "us" "lower"
+}
+
+# build source tree (data file, small files tree and its TAR archive)
+build_source() {
+	local d f
+
+	mkdir -p "$WORK_DIR/src"
+	head -c "$(numfmt --from=iec "${SIZE^^}")" /dev/urandom > "$WORK_DIR/src/data"
+	for d in $(seq 1 20); do
+		mkdir -p "$WORK_DIR/src/d$d"
+		for f in $(seq 1 $((NR_FILES / 20))); do
+			echo "file $d/$f" > "$WORK_DIR/src/d$d/f$f"
+		done
+	done
+	tar -cf "$WORK_DIR/src.tar" -C "$WORK_DIR/src" .
+}
+
+# compute image size in MB : fio file or extracted source tree (data file and small files) twice, plus metadata
+image_size() {
+	local size_mb
+
+	size_mb=$(( ($(numfmt --from=iec "${SIZE^^}") + 1048575) / 1048576 ))
+	echo $(( 2 * size_mb + NR_FILES * 8 / 1024 + 16 ))
+}
+
+# build an image with the Makefile recipe
+build_image() {
+	local fs=$1
+
+	case "$fs" in
+		memfs)
+			;;
+		*)
+			make -s -C "$ROOT" "image_$fs" IMG="$WORK_DIR/$fs.img" IMG_SIZE="$(image_size)" \
+				ISO_SRC="$WORK_DIR/src" TAR_SRC="$WORK_DIR/src" > /dev/null 2>&1
+			;;
+	esac
+}
+
+# mount a file system
+mount_fs() {
+	local fs=$1 i
+
+	if [ "$fs" = "memfs" ]; then
+		"$ROOT/fmounter" -t "$fs" -s "$WORK_DIR/$fs.stats" "$WORK_DIR/mnt" &
+	else
+		"$ROOT/fmounter" -t "$fs" -s "$WORK_DIR/$fs.stats" "$WORK_DIR/$fs.img" "$WORK_DIR/mnt" &
+	fi
+	FMOUNTER_PID=$!
+
+	for i in $(seq 1 50); do
+		mountpoint -q "$WORK_DIR/mnt" && return 0
+		sleep 0.1
+	done
+
+	echo "bench: can't mount $fs" >&2
+	kill "$FMOUNTER_PID" 2> /dev/null
+	return 1
+}
+
+# unmount a file system
+umount_fs() {
+	fusermount3 -u "$WORK_DIR/mnt" 2> /dev/null || umount "$WORK_DIR/mnt"
+	wait "$FMOUNTER_PID"
+}
+
+# run benchmark matrix on a file system
+bench_fs() {
+	local fs=$1 mnt="$WORK_DIR/mnt" bs data
+
+	build_image "$fs" || { echo "bench: can't build $fs image" >&2; return; }
+	mount_fs "$fs" || return
+
+	case "$fs" in
+		isofs|tarfs)
+			# read only : read biggest file of source tree
+			data=$(find "$mnt" -type f -size +1M | head -n 1)
+			for bs in ${BS_LIST//,/ }; do
+				run_fio "$fs" read "$bs" --filename="$data" --readonly
+				run_fio "$fs" randread "$bs" --filename="$data" --readonly
+			done
+			;;
+		*)
+			# fio
+			for bs in ${BS_LIST//,/ }; do
+				run_fio "$fs" write "$bs" --directory="$mnt" --filename=fio.data --end_fsync=1
+				run_fio "$fs" read "$bs" --directory="$mnt" --filename=fio.data
+				run_fio "$fs" randwrite "$bs" --directory="$mnt" --filename=fio.data --end_fsync=1
+				run_fio "$fs" randread "$bs" --directory="$mnt" --filename=fio.data
+			done
+			rm -f "$mnt/fio.data"
+
+			# metadata storms and tar extract (BFS has no directories)
+			if [ "$fs" != "bfs" ]; then
+				if mkdir "$mnt/meta"; then
+					time_cmd "$fs" create sh -c "cd $mnt/meta && seq -f 'f%g' $NR_FILES | xargs touch"
+					time_cmd "$fs" stat sh -c "find $mnt/meta -type f | xargs stat"
+					time_cmd "$fs" unlink rm -rf "$mnt/meta"
+				else
+					add_failure "$fs" create 1
+				fi
+
+				if mkdir "$mnt/untar"; then
+					time_cmd "$fs" tar_extract tar -xf "$WORK_DIR/src.tar" -C "$mnt/untar"
+				else
+					add_failure "$fs" tar_extract 1
+				fi
+			fi
+			;;
+	esac
+
+	time_cmd "$fs" ls_lR ls -lR "$mnt"
+	time_cmd "$fs" tar_create sh -c "tar -cf - -C $mnt . | cat"
+	time_cmd "$fs" du du -s "$mnt"
+
+	umount_fs
+}
+
+# parse options
+while getopts "f:o:s:b:n:w:c:h" c; do
+	case "$c" in
+		f) FS_LIST=$OPTARG ;;
+		o) REPORT=$OPTARG ;;
+		s) SIZE=$OPTARG ;;
+		b) BS_LIST=$OPTARG ;;
+		n) NR_FILES=$OPTARG ;;
+		w) WORK_DIR=$OPTARG ;;
+		c) BASELINE=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+
+# check tools
+for tool in fio jq numfmt; do
+	command -v $tool > /dev/null || { echo "bench: $tool is needed" >&2; exit 1; }
+done
+
+# prepare work directory
+mkdir -p "$WORK_DIR/mnt" || exit 1
+build_source
+
+# run benchmarks
+for fs in ${FS_LIST//,/ }; do
+	bench_fs "$fs"
+done
+
+# write report
+{
+	echo "{"
+	echo "\"date\":\"$(date -Iseconds)\","
+	echo "\"commit\":\"$(git -C "$ROOT" rev-parse --short HEAD 2> /dev/null)\","
+	echo "\"host\":\"$(hostname)\","
+	echo "\"size\":\"$SIZE\","
+	echo "\"nr_files\":$NR_FILES,"
+	echo "\"results\":["
+	(IFS=,; echo "${RESULTS[*]}")
+	echo "],"
+	echo "\"failures\":["
+	(IFS=,; echo "${FAILURES[*]}")
+	echo "]"
+	echo "}"
+} | jq . > "$REPORT"
+echo "bench: report written to $REPORT (fmounter histograms in $WORK_DIR/*.stats)"
+
+# compare with baseline
+if [ -n "$BASELINE" ]; then
+	"$ROOT/scripts/bench_compare.sh" "$BASELINE" "$REPORT"
+	exit $?
+fi
@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# Compare two benchmark reports (see scripts/bench.sh) and flag regressions.
+#
+# usage : ./scripts/bench_compare.sh [-t threshold_percent] baseline.json report.json
+#
+
+THRESHOLD=10
+
+while getopts "t:h" c; do
+	case "$c" in
+		t) THRESHOLD=$OPTARG ;;
+		*) echo "usage: $0 [-t threshold_percent] baseline.json report.json"; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 [-t threshold_percent] baseline.json report.json"
+	exit 1
+fi
+
+# join results on (fs, test) and compute change (positive = better), baseline tests without result are missing
+jq -r -n --slurpfile old "$1" --slurpfile new "$2" --argjson threshold "$THRESHOLD" '
+	($old[0].results | map({key: "\(.fs)/\(.test)", value: .}) | from_entries) as $base
+	| ($new[0].results | map({key: "\(.fs)/\(.test)", value: .}) | from_entries) as $cur
+	| ($new[0].results[]
+	   | select($base["\(.fs)/\(.test)"] != null)
+	   | $base["\(.fs)/\(.test)"].value as $prev
+	   | (if $prev == 0 then 0
+	      elif .better == "higher" then (.value - $prev) * 100 / $prev
+	      else ($prev - .value) * 100 / $prev end) as $change
+	   | [.fs, .test, $prev, .value, .unit, $change, (if $change < -$threshold then "REGRESSION" else "" end)]),
+	  ($old[0].results[]
+	   | select($cur["\(.fs)/\(.test)"] == null)
+	   | [.fs, .test, .value, "-", .unit, "-", "MISSING"])
+	| @tsv' | awk -F'\t' '
+	BEGIN {
+		printf "%-8s %-24s %12s %12s %-5s %8s\n", "fs", "test", "baseline", "current", "unit", "change"
+	}
+	$7 == "MISSING" {
+		printf "%-8s %-24s %12.3f %12s %-5s %8s %s\n", $1, $2, $3, "-", $5, "-", $7
+		regressions++
+		next
+	}
+	{
+		printf "%-8s %-24s %12.3f %12.3f %-5s %+7.1f%% %s\n", $1, $2, $3, $4, $5, $6, $7
+		if ($7 != "")
+			regressions++
+	}
+	END {
+		printf "\n%d regression(s)\n", regressions
+		exit regressions > 0
+	}'
@@ -0,0 +1,73 @@
+#!/bin/bash
+#
+# Regression check : "." and ".." must be found in indexed Ext2 directories (they are not in the hash index).
+# Builds a dir_index image, grows a directory past one block through fmounter and resolves dot paths in it.
+#
+# usage : ./scripts/check_dx_dots.sh
+#
+
+WORK_DIR="/tmp/check_dx_dots.$$"
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+MNT="$WORK_DIR/mnt"
+IMG="$WORK_DIR/ext2.img"
+FAILED=0
+
+# check a path resolves through the mount point
+check() {
+	if ! stat "$MNT/$1" > /dev/null 2>&1; then
+		echo "check_dx_dots: can't resolve $1" >&2
+		FAILED=1
+	fi
+}
+
+mkdir -p "$MNT" || exit 1
+make -s -C "$ROOT" fmounter > /dev/null || exit 1
+
+# 1k blocks image with directory index
+dd if=/dev/zero of="$IMG" bs=1M count=8 status=none
+mkfs.ext2 -q -F -b 1024 -O dir_index "$IMG" || exit 1
+
+# mount it
+"$ROOT/fmounter" -t ext2 "$IMG" "$MNT" &
+FMOUNTER_PID=$!
+for i in $(seq 1 50); do
+	mountpoint -q "$MNT" && break
+	sleep 0.1
+done
+if ! mountpoint -q "$MNT"; then
+	echo "check_dx_dots: can't mount $IMG" >&2
+	kill "$FMOUNTER_PID" 2> /dev/null
+	exit 1
+fi
+
+# grow a directory until it is indexed and add a relative symlink in it
+mkdir "$MNT/r"
+for i in $(seq 1 500); do
+	touch "$MNT/r/file_with_a_rather_long_name_$i"
+done
+echo x > "$MNT/x"
+ln -s ../x "$MNT/r/l"
+
+# dot entries and paths going through them
+check r/.
+check r/..
+check r/../r
+check r/./file_with_a_rather_long_name_7
+if [ "$(cat "$MNT/r/l" 2> /dev/null)" != "x" ]; then
+	echo "check_dx_dots: can't follow relative symlink r/l" >&2
+	FAILED=1
+fi
+
+# unmount
+fusermount3 -u "$MNT" 2> /dev/null || umount "$MNT"
+wait "$FMOUNTER_PID"
+
+# directory must really be indexed (else this check proves nothing)
+if command -v debugfs > /dev/null && ! debugfs -R "htree /r" "$IMG" 2> /dev/null | grep -q "Root node"; then
+	echo "check_dx_dots: directory is not indexed" >&2
+	FAILED=1
+fi
+
+rm -rf "$WORK_DIR"
+[ "$FAILED" = 0 ] && echo "check_dx_dots: ok"
+exit "$FAILED"
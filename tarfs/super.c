@@ -36,6 +36,7 @@ int tarfs_read_super(struct super_block *sb, void *data)
 	sb->s_magic = TARFS_MAGIC;
 	sb->s_root_inode = NULL;
 	sb->s_op = &tarfs_sops;
+	sb->s_flags |= VFS_SB_RDONLY;
 	sbi->s_ninodes = 0;
 	sbi->s_root_entry = NULL;
 	sbi->s_tar_entries = NULL;
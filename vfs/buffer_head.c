@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "vfs.h"
 
@@ -13,6 +14,19 @@ static struct buffer_head *buffer_table = NULL;
 static struct htable_link **buffer_htable = NULL;
 static LIST_HEAD(lru_buffers);
 
+/*
+ * Write a released dirty buffer (the file system may redirect it, to a journal for example).
+ */
+static int bflush(struct buffer_head *bh)
+{
+	struct super_block *sb = bh->b_sb;
+
+	if (sb && sb->s_op && sb->s_op->write_buffer)
+		return sb->s_op->write_buffer(bh);
+
+	return bwrite(bh);
+}
+
 /*
  * Get an empty buffer.
  */
@@ -99,31 +113,115 @@ out:
  */
 struct buffer_head *sb_bread(struct super_block *sb, uint32_t block)
 {
+	struct vfs_stat_ctx ctx, miss_ctx, io_ctx;
 	struct buffer_head *bh;
+	ssize_t n = -1;
 
 	/* get block buffer */
+	vfs_stat_begin(&ctx);
 	bh = getblk(sb, block);
 	if (!bh)
-		return NULL;
+		goto out;
 
 	/* buffer up to date : just return it */
 	if (bh->b_uptodate)
-		return bh;
-
-	/* seek to block */
-	if (lseek(sb->s_fd, block * sb->s_blocksize, SEEK_SET) == -1)
-		goto err;
+		goto out;
 
 	/* read block */
-	if (read(sb->s_fd, bh->b_data, sb->s_blocksize) != sb->s_blocksize)
-		goto err;
+	miss_ctx = ctx;
+	vfs_stat_begin(&io_ctx);
+	if (lseek(sb->s_fd, block * sb->s_blocksize, SEEK_SET) != -1)
+		n = read(sb->s_fd, bh->b_data, sb->s_blocksize);
+	vfs_stat_end(&vfs_stats[VFS_STAT_IO], &io_ctx);
+	vfs_stat_end(&vfs_stats[VFS_STAT_MISS], &miss_ctx);
+
+	/* check read */
+	if (n != sb->s_blocksize) {
+		bh->b_ref = 0;
+		free(bh->b_data);
+		bh = NULL;
+		goto out;
+	}
 
 	bh->b_uptodate = 1;
+out:
+	vfs_stat_end(&vfs_stats[VFS_STAT_BREAD], &ctx);
 	return bh;
-err:
-	bh->b_ref = 0;
-	free(bh->b_data);
-	return NULL;
+}
+
+/*
+ * Compare 2 block numbers.
+ */
+static int block_cmp(const void *a, const void *b)
+{
+	uint32_t b1 = *((const uint32_t *) a), b2 = *((const uint32_t *) b);
+
+	return b1 < b2 ? -1 : b1 > b2;
+}
+
+/*
+ * Read ahead a set of blocks : blocks are sorted, cached ones are skipped and others are read by contiguous runs.
+ */
+void sb_breadahead(struct super_block *sb, uint32_t *blocks, int nr_blocks)
+{
+	struct buffer_head *bhs[VFS_READAHEAD_MAX], *bh;
+	struct iovec iov[VFS_READAHEAD_MAX];
+	struct vfs_stat_ctx io_ctx;
+	int i, j, nr;
+	ssize_t n;
+
+	/* sort blocks */
+	qsort(blocks, nr_blocks, sizeof(uint32_t), block_cmp);
+
+	for (i = 0; i < nr_blocks;) {
+		/* build a run of contiguous blocks to read */
+		for (nr = 0; i < nr_blocks && nr < VFS_READAHEAD_MAX; i++) {
+			/* skip duplicates */
+			if (i && blocks[i] == blocks[i - 1])
+				continue;
+
+			/* end of run */
+			if (nr && blocks[i] != bhs[nr - 1]->b_block + 1)
+				break;
+
+			/* no free buffer : stop read ahead */
+			bh = getblk(sb, blocks[i]);
+			if (!bh) {
+				i = nr_blocks;
+				break;
+			}
+
+			/* cached block ends the run */
+			if (bh->b_uptodate) {
+				brelse(bh);
+				if (nr) {
+					i++;
+					break;
+				}
+				continue;
+			}
+
+			bhs[nr] = bh;
+			iov[nr].iov_base = bh->b_data;
+			iov[nr].iov_len = sb->s_blocksize;
+			nr++;
+		}
+
+		if (!nr)
+			continue;
+
+		/* read run */
+		vfs_stat_begin(&io_ctx);
+		n = preadv(sb->s_fd, iov, nr, (off_t) bhs[0]->b_block * sb->s_blocksize);
+		vfs_stat_end(&vfs_stats[VFS_STAT_IO], &io_ctx);
+
+		/* mark read buffers up to date and release them */
+		for (j = 0; j < nr; j++) {
+			if (n >= (ssize_t) ((j + 1) * sb->s_blocksize))
+				bhs[j]->b_uptodate = 1;
+			brelse(bhs[j]);
+		}
+	}
 }
 
 /*
@@ -131,15 +229,22 @@ err:
  */
 int bwrite(struct buffer_head *bh)
 {
+	struct vfs_stat_ctx ctx, io_ctx;
+	ssize_t n = -1;
+
 	if (!bh)
 		return -EINVAL;
 
-	/* seek to block */
-	if (lseek(bh->b_sb->s_fd, bh->b_block * bh->b_sb->s_blocksize, SEEK_SET) == -1)
-		return -EIO;
-
 	/* write block */
-	if (write(bh->b_sb->s_fd, bh->b_data, bh->b_sb->s_blocksize) != bh->b_sb->s_blocksize)
+	vfs_stat_begin(&ctx);
+	vfs_stat_begin(&io_ctx);
+	if (lseek(bh->b_sb->s_fd, bh->b_block * bh->b_sb->s_blocksize, SEEK_SET) != -1)
+		n = write(bh->b_sb->s_fd, bh->b_data, bh->b_sb->s_blocksize);
+	vfs_stat_end(&vfs_stats[VFS_STAT_IO], &io_ctx);
+	vfs_stat_end(&vfs_stats[VFS_STAT_BWRITE], &ctx);
+
+	/* check write */
+	if (n != bh->b_sb->s_blocksize)
 		return -EIO;
 
 	/* mark buffer clear */
@@ -158,12 +263,44 @@ void brelse(struct buffer_head *bh)
 
 	/* write it on disk if needed */
 	if (bh->b_dirt)
-		bwrite(bh);
+		bflush(bh);
 
 	/* update reference count */
 	bh->b_ref--;
 }
 
+/*
+ * Drop all block buffers of a file system (dirty buffers are written first).
+ */
+void vfs_bpurge(struct super_block *sb)
+{
+	struct buffer_head *bh;
+	int i;
+
+	for (i = 0; i < VFS_NR_BUFFER; i++) {
+		bh = &buffer_table[i];
+		if (bh->b_sb != sb)
+			continue;
+
+		/* write it on disk if needed */
+		if (bh->b_dirt && bwrite(bh))
+			fprintf(stderr, "VFS: can't write block %d on disk\n", bh->b_block);
+
+		/* unhash buffer */
+		htable_delete(&bh->b_htable);
+		bh->b_htable.next = NULL;
+		bh->b_htable.pprev = NULL;
+
+		/* reset buffer and reuse it first */
+		bh->b_ref = 0;
+		bh->b_dirt = 0;
+		bh->b_uptodate = 0;
+		bh->b_sb = NULL;
+		list_del(&bh->b_list);
+		list_add(&bh->b_list, &lru_buffers);
+	}
+}
+
 /*
  * Init block buffers.
  */
@@ -0,0 +1,37 @@
+#include <errno.h>
+
+#include "vfs.h"
+
+/*
+ * Defragment a file (file system moves its blocks to contiguous runs, file stays usable).
+ */
+int vfs_defrag(struct inode *root, const char *pathname, struct vfs_defrag *defrag)
+{
+	struct inode *inode;
+	int err;
+
+	/* get inode */
+	inode = vfs_namei(root, NULL, pathname, 1);
+	if (!inode)
+		return -ENOENT;
+
+	/* only regular files can be defragmented */
+	if (!S_ISREG(inode->i_mode)) {
+		vfs_iput(inode);
+		return -EINVAL;
+	}
+
+	/* defragment not implemented */
+	if (!inode->i_op || !inode->i_op->defrag) {
+		vfs_iput(inode);
+		return -EOPNOTSUPP;
+	}
+
+	/* defragment */
+	err = inode->i_op->defrag(inode, defrag);
+
+	/* release inode */
+	vfs_iput(inode);
+
+	return err;
+}
@@ -120,6 +120,52 @@ void vfs_iput(struct inode *inode)
 	}
 }
 
+/*
+ * Write all dirty inodes of a file system.
+ */
+void vfs_sync_inodes(struct super_block *sb)
+{
+	struct htable_link *node;
+	struct inode *inode;
+	int i;
+
+	if (!sb->s_op || !sb->s_op->write_inode)
+		return;
+
+	for (i = 0; i < VFS_NR_INODE; i++) {
+		for (node = inode_htable[i]; node; node = node->next) {
+			inode = htable_entry(node, struct inode, i_htable);
+			if (inode->i_sb == sb && inode->i_dirt) {
+				sb->s_op->write_inode(inode);
+				inode->i_dirt = 0;
+			}
+		}
+	}
+}
+
+/*
+ * Drop all cached inodes of a file system (inodes still referenced are only unhashed).
+ */
+void vfs_ipurge(struct super_block *sb)
+{
+	struct htable_link *node, *next;
+	struct inode *inode;
+	int i;
+
+	for (i = 0; i < VFS_NR_INODE; i++) {
+		for (node = inode_htable[i]; node; node = next) {
+			next = node->next;
+			inode = htable_entry(node, struct inode, i_htable);
+			if (inode->i_sb != sb)
+				continue;
+
+			htable_delete(&inode->i_htable);
+			inode->i_htable.next = NULL;
+			inode->i_htable.pprev = NULL;
+		}
+	}
+}
+
 /*
  * Init inodes.
  */
@@ -3,6 +3,21 @@
 
 #include "vfs.h"
 
+/*
+ * Lookup a file in a directory.
+ */
+static int vfs_lookup(struct inode *dir, const char *name, size_t name_len, struct inode **res_inode)
+{
+	struct vfs_stat_ctx ctx;
+	int err;
+
+	vfs_stat_begin(&ctx);
+	err = dir->i_op->lookup(dir, name, name_len, res_inode);
+	vfs_stat_end(&vfs_stats[VFS_STAT_LOOKUP], &ctx);
+
+	return err;
+}
+
 /*
  * Follow a link.
  */
@@ -71,7 +86,7 @@ static struct inode *vfs_dir_namei(struct inode *root, struct inode *dir, const
 		}
 
 		/* lookup file */
-		err = inode->i_op->lookup(inode, name, name_len, &tmp);
+		err = vfs_lookup(inode, name, name_len, &tmp);
 		if (err) {
 			vfs_iput(inode);
 			return NULL;
@@ -117,7 +132,7 @@ struct inode *vfs_namei(struct inode *root, struct inode *base, const char *path
 
 	/* lookup file */
 	dir->i_ref++;
-	err = dir->i_op->lookup(dir, basename, basename_len, &inode);
+	err = vfs_lookup(dir, basename, basename_len, &inode);
 	if (err) {
 		vfs_iput(dir);
 		return NULL;
@@ -171,7 +186,7 @@ int vfs_open_namei(struct inode *root, const char *pathname, int flags, mode_t m
 
 	/* lookup inode */
 	dir->i_ref++;
-	err = dir->i_op->lookup(dir, basename, basename_len, &inode);
+	err = vfs_lookup(dir, basename, basename_len, &inode);
 
 	/* no such entry : create a new one */
 	if (err) {
@@ -181,6 +196,12 @@ int vfs_open_namei(struct inode *root, const char *pathname, int flags, mode_t m
 			return -ENOENT;
 		}
 						 
+		/* read only file system */
+		if (vfs_rdonly(dir->i_sb)) {
+			vfs_iput(dir);
+			return -EROFS;
+		}
+
 		/* create not implemented */
 		if (!dir->i_op || !dir->i_op->create) {
 			vfs_iput(dir);
@@ -201,6 +222,13 @@ int vfs_open_namei(struct inode *root, const char *pathname, int flags, mode_t m
 	if (!*res_inode)
 		return -EACCES;
 
+	/* read only file system : no write access */
+	if (vfs_rdonly((*res_inode)->i_sb) && ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC))) {
+		vfs_iput(*res_inode);
+		*res_inode = NULL;
+		return -EROFS;
+	}
+
 	/* truncate file */
 	if (flags & O_TRUNC && (*res_inode)->i_op && (*res_inode)->i_op->truncate) {
 		(*res_inode)->i_size = 0;
@@ -232,6 +260,12 @@ int vfs_create(struct inode *root, const char *pathname, mode_t mode)
 		return -ENOENT;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* create not implemented */
 	if (!dir->i_op || !dir->i_op->create) {
 		vfs_iput(dir);
@@ -272,6 +306,12 @@ int vfs_unlink(struct inode *root, const char *pathname)
 		return -ENOENT;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* unlink not implemented */
 	if (!dir->i_op || !dir->i_op->unlink) {
 		vfs_iput(dir);
@@ -303,6 +343,12 @@ int vfs_mkdir(struct inode *root, const char *pathname, mode_t mode)
 		return -ENOENT;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* mkdir not implemented */
 	if (!dir->i_op || !dir->i_op->mkdir) {
 		vfs_iput(dir);
@@ -339,6 +385,12 @@ int vfs_rmdir(struct inode *root, const char *pathname)
 		return -ENOENT;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* rmdir not implemented */
 	if (!dir->i_op || !dir->i_op->rmdir) {
 		vfs_iput(dir);
@@ -384,6 +436,13 @@ int vfs_link(struct inode *root, const char *oldpath, const char *new_path)
 		return -EPERM;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(old_inode);
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* link not implemented */
 	if (!dir->i_op || !dir->i_op->link) {
 		vfs_iput(old_inode);
@@ -423,6 +482,12 @@ int vfs_symlink(struct inode *root, const char *target, const char *linkpath)
 		return -ENOENT;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(dir->i_sb)) {
+		vfs_iput(dir);
+		return -EROFS;
+	}
+
 	/* symlink not implemented */
 	if (!dir->i_op || !dir->i_op->symlink) {
 		vfs_iput(dir);
@@ -473,6 +538,13 @@ int vfs_rename(struct inode *root, const char *oldpath, const char *newpath)
 		return -EPERM;
 	}
 
+	/* read only file system */
+	if (vfs_rdonly(old_dir->i_sb)) {
+		vfs_iput(new_dir);
+		vfs_iput(old_dir);
+		return -EROFS;
+	}
+
 	/* rename not implemented */
 	if (!old_dir->i_op || !old_dir->i_op->rename) {
 		vfs_iput(new_dir);
@@ -100,6 +100,12 @@ int vfs_chmod(struct inode *root, const char *pathname, mode_t mode)
 	if (!inode)
 		return -ENOENT;
 
+	/* read only file system */
+	if (vfs_rdonly(inode->i_sb)) {
+		vfs_iput(inode);
+		return -EROFS;
+	}
+
 	/* adjust mode */
 	if (mode == (mode_t) -1)
 		mode = inode->i_mode;
@@ -126,6 +132,12 @@ int vfs_chown(struct inode *root, const char *pathname, uid_t uid, gid_t gid)
 	if (!inode)
 		return -ENOENT;
 
+	/* read only file system */
+	if (vfs_rdonly(inode->i_sb)) {
+		vfs_iput(inode);
+		return -EROFS;
+	}
+
 	/* change uid and gid */
 	inode->i_uid = uid;
 	inode->i_gid = gid;
@@ -149,6 +161,12 @@ int vfs_utimens(struct inode *root, const char *pathname, const struct timespec
 	if (!inode)
 		return -ENOENT;
 
+	/* read only file system */
+	if (vfs_rdonly(inode->i_sb)) {
+		vfs_iput(inode);
+		return -EROFS;
+	}
+
 	/* set last access time */
 	if (times[0].tv_nsec == UTIME_NOW)
 		inode->i_atime = current_time();
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 
 #include "vfs.h"
@@ -57,6 +59,23 @@ off_t vfs_lseek(struct file *filp, off_t offset, int whence)
 		case SEEK_END:
 			new_offset = filp->f_inode->i_size + offset;
 			break;
+		case SEEK_DATA:
+		case SEEK_HOLE:
+			/* no data at or after end of file */
+			if (offset < 0 || offset >= filp->f_inode->i_size)
+				return -ENXIO;
+
+			/* file system knows holes */
+			if (filp->f_op && filp->f_op->lseek) {
+				new_offset = filp->f_op->lseek(filp, offset, whence);
+				if (new_offset < 0)
+					return new_offset;
+				break;
+			}
+
+			/* else whole file is data (end of file is a virtual hole) */
+			new_offset = whence == SEEK_DATA ? offset : filp->f_inode->i_size;
+			break;
 		default:
 			new_offset = -1;
 			break;
@@ -70,3 +89,82 @@ off_t vfs_lseek(struct file *filp, off_t offset, int whence)
 	filp->f_pos = new_offset;
 	return filp->f_pos;
 }
+
+/*
+ * Copy a range of a file to another file (file system may share data, else it is copied through read/write).
+ * File positions are not changed.
+ */
+ssize_t vfs_copy_file_range(struct file *filp_in, off_t off_in, struct file *filp_out, off_t off_out, size_t len)
+{
+	struct inode *inode_in, *inode_out;
+	off_t pos_in, pos_out;
+	ssize_t copied = 0, n, err = 0;
+	char *buf;
+
+	/* check files */
+	if (!filp_in || !filp_out || (filp_out->f_flags & O_APPEND))
+		return -EBADF;
+	if (off_in < 0 || off_out < 0)
+		return -EINVAL;
+
+	/* only regular files can be copied */
+	inode_in = filp_in->f_inode;
+	inode_out = filp_out->f_inode;
+	if (!S_ISREG(inode_in->i_mode) || !S_ISREG(inode_out->i_mode))
+		return -EINVAL;
+
+	/* copy up to end of input file */
+	if (off_in >= inode_in->i_size)
+		return 0;
+	if (len > (size_t) (inode_in->i_size - off_in))
+		len = inode_in->i_size - off_in;
+
+	/* ranges of a same file can't overlap */
+	if (inode_in == inode_out && off_in < off_out + (off_t) len && off_out < off_in + (off_t) len)
+		return -EINVAL;
+
+	/* file system copies data itself */
+	if (inode_in->i_sb == inode_out->i_sb && filp_out->f_op && filp_out->f_op->copy_file_range) {
+		err = filp_out->f_op->copy_file_range(filp_in, off_in, filp_out, off_out, len);
+		if (err != -EOPNOTSUPP)
+			return err;
+	}
+
+	/* read/write not implemented */
+	if (!filp_in->f_op || !filp_in->f_op->read || !filp_out->f_op || !filp_out->f_op->write)
+		return -EPERM;
+
+	/* allocate copy buffer */
+	buf = (char *) malloc(VFS_COPY_BUF_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	/* save file positions */
+	pos_in = filp_in->f_pos;
+	pos_out = filp_out->f_pos;
+	filp_in->f_pos = off_in;
+	filp_out->f_pos = off_out;
+
+	/* copy data (stop on a short write) */
+	while ((size_t) copied < len) {
+		n = len - copied < VFS_COPY_BUF_SIZE ? len - copied : VFS_COPY_BUF_SIZE;
+		err = n = filp_in->f_op->read(filp_in, buf, n);
+		if (n <= 0)
+			break;
+
+		err = filp_out->f_op->write(filp_out, buf, n);
+		if (err <= 0)
+			break;
+
+		copied += err;
+		if (err < n)
+			break;
+	}
+
+	/* restore file positions */
+	filp_in->f_pos = pos_in;
+	filp_out->f_pos = pos_out;
+
+	free(buf);
+	return copied ? copied : err;
+}
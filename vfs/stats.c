@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "vfs.h"
+
+/* statistics switch */
+int vfs_stats_enabled = 0;
+
+/* cumulated time/count spent in each stage */
+static uint64_t vfs_stage_ns[VFS_NR_STATS];
+static uint64_t vfs_stage_cnt[VFS_NR_STATS];
+
+/* stages names */
+static const char *vfs_stage_names[VFS_NR_STATS] = {
+	[VFS_STAT_LOOKUP]	= "lookup",
+	[VFS_STAT_BREAD]	= "bread",
+	[VFS_STAT_BWRITE]	= "bwrite",
+	[VFS_STAT_ALLOC]	= "alloc",
+	[VFS_STAT_MISS]		= "miss",
+	[VFS_STAT_IO]		= "io",
+};
+
+/* VFS hooks histograms */
+struct vfs_histogram vfs_stats[VFS_NR_STATS] = {
+	[VFS_STAT_LOOKUP]	= { .h_name = "vfs_lookup",	.h_stage = VFS_STAT_LOOKUP	},
+	[VFS_STAT_BREAD]	= { .h_name = "vfs_bread",	.h_stage = VFS_STAT_BREAD	},
+	[VFS_STAT_BWRITE]	= { .h_name = "vfs_bwrite",	.h_stage = VFS_STAT_BWRITE	},
+	[VFS_STAT_ALLOC]	= { .h_name = "vfs_alloc",	.h_stage = VFS_STAT_ALLOC	},
+	[VFS_STAT_MISS]		= { .h_name = "vfs_miss",	.h_stage = VFS_STAT_MISS	},
+	[VFS_STAT_IO]		= { .h_name = "vfs_io",		.h_stage = VFS_STAT_IO		},
+};
+
+/*
+ * Get monotonic time in nanoseconds.
+ */
+static inline uint64_t vfs_stat_now()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Get histogram bucket of a value (HDR style : 2^VFS_HIST_SUB_BITS linear sub buckets per power of 2).
+ */
+static inline int vfs_hist_bucket(uint64_t value)
+{
+	int shift;
+
+	/* small values : one bucket per value */
+	if (value < VFS_HIST_SUB_COUNT)
+		return value;
+
+	/* keep VFS_HIST_SUB_BITS bits after most significant bit */
+	shift = 63 - __builtin_clzll(value) - VFS_HIST_SUB_BITS;
+	return (shift + 1) * VFS_HIST_SUB_COUNT + ((value >> shift) - VFS_HIST_SUB_COUNT);
+}
+
+/*
+ * Get highest value of a histogram bucket.
+ */
+static inline uint64_t vfs_hist_bucket_value(int bucket)
+{
+	int shift, sub;
+
+	/* small values : one bucket per value */
+	if (bucket < VFS_HIST_SUB_COUNT)
+		return bucket;
+
+	shift = bucket / VFS_HIST_SUB_COUNT - 1;
+	sub = bucket % VFS_HIST_SUB_COUNT;
+	return ((uint64_t) (VFS_HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+/*
+ * Start a timed section.
+ */
+void vfs_stat_begin(struct vfs_stat_ctx *ctx)
+{
+	if (!vfs_stats_enabled)
+		return;
+
+	/* snapshot stages */
+	memcpy(ctx->c_stage_ns, vfs_stage_ns, sizeof(vfs_stage_ns));
+	memcpy(ctx->c_stage_cnt, vfs_stage_cnt, sizeof(vfs_stage_cnt));
+	ctx->c_start = vfs_stat_now();
+}
+
+/*
+ * End a timed section : record it in histogram and compute stages breakdown (returns elapsed time in ns).
+ */
+uint64_t vfs_stat_end(struct vfs_histogram *hist, struct vfs_stat_ctx *ctx)
+{
+	uint64_t elapsed;
+	int i;
+
+	if (!vfs_stats_enabled)
+		return 0;
+
+	/* compute elapsed time */
+	elapsed = vfs_stat_now() - ctx->c_start;
+
+	/* compute time spent in nested stages */
+	for (i = 0; i < VFS_NR_STATS; i++) {
+		ctx->c_stage_ns[i] = vfs_stage_ns[i] - ctx->c_stage_ns[i];
+		ctx->c_stage_cnt[i] = vfs_stage_cnt[i] - ctx->c_stage_cnt[i];
+	}
+
+	/* update histogram */
+	if (!hist->h_count || elapsed < hist->h_min)
+		hist->h_min = elapsed;
+	if (elapsed > hist->h_max)
+		hist->h_max = elapsed;
+	hist->h_count++;
+	hist->h_total_ns += elapsed;
+	hist->h_buckets[vfs_hist_bucket(elapsed)]++;
+	for (i = 0; i < VFS_NR_STATS; i++)
+		hist->h_stage_ns[i] += ctx->c_stage_ns[i];
+
+	/* this section is itself a stage */
+	if (hist->h_stage >= 0 && hist->h_stage < VFS_NR_STATS) {
+		vfs_stage_ns[hist->h_stage] += elapsed;
+		vfs_stage_cnt[hist->h_stage]++;
+	}
+
+	return elapsed;
+}
+
+/*
+ * Get a percentile (0 < p <= 100) of a histogram.
+ */
+uint64_t vfs_hist_percentile(struct vfs_histogram *hist, double p)
+{
+	uint64_t target, cpt = 0;
+	int i;
+
+	if (!hist->h_count)
+		return 0;
+
+	/* compute target count */
+	target = (uint64_t) (hist->h_count * p / 100.0 + 0.5);
+	if (target < 1)
+		target = 1;
+
+	/* find bucket */
+	for (i = 0; i < VFS_HIST_NR_BUCKETS; i++) {
+		cpt += hist->h_buckets[i];
+		if (cpt >= target)
+			return vfs_hist_bucket_value(i) < hist->h_max ? vfs_hist_bucket_value(i) : hist->h_max;
+	}
+
+	return hist->h_max;
+}
+
+/*
+ * Print stages breakdown of a timed section.
+ */
+void vfs_stat_print_stages(FILE *fp, struct vfs_stat_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < VFS_NR_STATS; i++)
+		if (ctx->c_stage_cnt[i])
+			fprintf(fp, " %s=%.3fms/%lu", vfs_stage_names[i], ctx->c_stage_ns[i] / 1000000.0, ctx->c_stage_cnt[i]);
+}
+
+/*
+ * Dump a histogram (one line, times in microseconds).
+ */
+void vfs_hist_dump(FILE *fp, struct vfs_histogram *hist)
+{
+	int i;
+
+	if (!hist->h_count)
+		return;
+
+	fprintf(fp, "%-16s count=%-10lu mean=%-10.1f min=%-10.1f p50=%-10.1f p90=%-10.1f p99=%-10.1f p999=%-10.1f max=%-10.1f",
+		hist->h_name, hist->h_count,
+		hist->h_total_ns / 1000.0 / hist->h_count,
+		hist->h_min / 1000.0,
+		vfs_hist_percentile(hist, 50) / 1000.0,
+		vfs_hist_percentile(hist, 90) / 1000.0,
+		vfs_hist_percentile(hist, 99) / 1000.0,
+		vfs_hist_percentile(hist, 99.9) / 1000.0,
+		hist->h_max / 1000.0);
+
+	/* print time spent in cache misses and device I/O */
+	for (i = 0; i < VFS_NR_STATS; i++)
+		if (i != hist->h_stage && hist->h_stage_ns[i])
+			fprintf(fp, " %s=%.1f", vfs_stage_names[i], hist->h_stage_ns[i] / 1000.0);
+
+	fprintf(fp, "\n");
+}
+
+/*
+ * Reset VFS hooks histograms.
+ */
+void vfs_stats_reset()
+{
+	int i;
+
+	for (i = 0; i < VFS_NR_STATS; i++) {
+		vfs_stats[i].h_count = 0;
+		vfs_stats[i].h_total_ns = 0;
+		vfs_stats[i].h_min = 0;
+		vfs_stats[i].h_max = 0;
+		memset(vfs_stats[i].h_stage_ns, 0, sizeof(vfs_stats[i].h_stage_ns));
+		memset(vfs_stats[i].h_buckets, 0, sizeof(vfs_stats[i].h_buckets));
+	}
+}
+
+/*
+ * Dump VFS hooks histograms.
+ */
+void vfs_stats_dump(FILE *fp)
+{
+	int i;
+
+	for (i = 0; i < VFS_NR_STATS; i++)
+		vfs_hist_dump(fp, &vfs_stats[i]);
+}
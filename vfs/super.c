@@ -37,6 +37,9 @@ struct super_block *vfs_mount(const char *dev, int fs_type, void *data)
 		}
 	}
 
+	/* no mount flags (file system sets them) */
+	sb->s_flags = 0;
+
 	/* open device (only for disk file systems) */
 	sb->s_fd = -1;
 	switch (fs_type) {
@@ -104,10 +107,17 @@ int vfs_umount(struct super_block *sb)
 	if (!sb)
 		return -EINVAL;
 
+	/* write dirty inodes */
+	vfs_sync_inodes(sb);
+
 	/* put super block */
 	if (sb->s_op && sb->s_op->put_super)
 		sb->s_op->put_super(sb);
 
+	/* drop cached inodes and buffers (a new super block may get the same address) */
+	vfs_ipurge(sb);
+	vfs_bpurge(sb);
+
 	/* close device */
 	if (sb->s_fd > 0)
 		close(sb->s_fd);
@@ -138,6 +148,41 @@ int vfs_statfs(struct super_block *sb, struct statfs *buf)
 	return sb->s_op->statfs(sb, buf);
 }
 
+/*
+ * Synchronize a file system (write in memory metadata on disk).
+ */
+int vfs_sync(struct super_block *sb)
+{
+	/* check super block */
+	if (!sb)
+		return -EINVAL;
+
+	/* write dirty inodes */
+	vfs_sync_inodes(sb);
+
+	/* nothing else to synchronize */
+	if (!sb->s_op || !sb->s_op->sync_fs)
+		return 0;
+
+	return sb->s_op->sync_fs(sb);
+}
+
+/*
+ * Periodic commit of a file system (write metadata pending for too long, called between operations).
+ */
+int vfs_commit(struct super_block *sb)
+{
+	/* check super block */
+	if (!sb)
+		return -EINVAL;
+
+	/* nothing to commit */
+	if (!sb->s_op || !sb->s_op->commit_fs)
+		return 0;
+
+	return sb->s_op->commit_fs(sb);
+}
+
 /*
  * Init VFS.
  */
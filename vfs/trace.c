@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "vfs.h"
+
+/* operations names */
+const char *vfs_op_names[VFS_NR_OPS] = {
+	[VFS_OP_GETATTR]	= "getattr",
+	[VFS_OP_READLINK]	= "readlink",
+	[VFS_OP_MKNOD]		= "mknod",
+	[VFS_OP_MKDIR]		= "mkdir",
+	[VFS_OP_UNLINK]		= "unlink",
+	[VFS_OP_RMDIR]		= "rmdir",
+	[VFS_OP_SYMLINK]	= "symlink",
+	[VFS_OP_RENAME]		= "rename",
+	[VFS_OP_LINK]		= "link",
+	[VFS_OP_CHMOD]		= "chmod",
+	[VFS_OP_CHOWN]		= "chown",
+	[VFS_OP_TRUNCATE]	= "truncate",
+	[VFS_OP_OPEN]		= "open",
+	[VFS_OP_READ]		= "read",
+	[VFS_OP_WRITE]		= "write",
+	[VFS_OP_STATFS]		= "statfs",
+	[VFS_OP_FLUSH]		= "flush",
+	[VFS_OP_RELEASE]	= "release",
+	[VFS_OP_FSYNC]		= "fsync",
+	[VFS_OP_SETXATTR]	= "setxattr",
+	[VFS_OP_GETXATTR]	= "getxattr",
+	[VFS_OP_LISTXATTR]	= "listxattr",
+	[VFS_OP_REMOVEXATTR]	= "removexattr",
+	[VFS_OP_READDIR]	= "readdir",
+	[VFS_OP_INIT]		= "init",
+	[VFS_OP_DESTROY]	= "destroy",
+	[VFS_OP_ACCESS]		= "access",
+	[VFS_OP_CREATE]		= "create",
+	[VFS_OP_LOCK]		= "lock",
+	[VFS_OP_UTIMENS]	= "utimens",
+	[VFS_OP_LSEEK]		= "lseek",
+	[VFS_OP_COPY_FILE_RANGE]	= "copy_file_range",
+};
+
+/*
+ * Map a trace file.
+ */
+static struct vfs_trace *vfs_trace_map(int fd, size_t size)
+{
+	struct vfs_trace *trace;
+	void *addr;
+
+	/* map trace file */
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	/* allocate trace */
+	trace = (struct vfs_trace *) malloc(sizeof(struct vfs_trace));
+	if (!trace) {
+		munmap(addr, size);
+		return NULL;
+	}
+
+	/* set trace */
+	trace->t_fd = fd;
+	trace->t_size = size;
+	trace->t_header = (struct vfs_trace_header *) addr;
+	trace->t_records = (struct vfs_trace_record *) ((char *) addr + VFS_TRACE_RECORD_SIZE);
+
+	return trace;
+}
+
+/*
+ * Create a trace file (header uses first record slot).
+ */
+struct vfs_trace *vfs_trace_create(const char *path, uint32_t nr_records)
+{
+	struct vfs_trace *trace;
+	struct timespec now;
+	size_t size;
+	int fd;
+
+	/* ring needs at least one record */
+	if (!nr_records)
+		return NULL;
+
+	/* create trace file */
+	fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	/* set trace file size */
+	size = (size_t) (nr_records + 1) * VFS_TRACE_RECORD_SIZE;
+	if (ftruncate(fd, size))
+		goto err;
+
+	/* map trace file */
+	trace = vfs_trace_map(fd, size);
+	if (!trace)
+		goto err;
+
+	/* set header */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	trace->t_header->t_magic = VFS_TRACE_MAGIC;
+	trace->t_header->t_version = VFS_TRACE_VERSION;
+	trace->t_header->t_record_size = VFS_TRACE_RECORD_SIZE;
+	trace->t_header->t_nr_records = nr_records;
+	trace->t_header->t_head = 0;
+	trace->t_header->t_start = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	return trace;
+err:
+	close(fd);
+	unlink(path);
+	return NULL;
+}
+
+/*
+ * Open an existing trace file.
+ */
+struct vfs_trace *vfs_trace_open(const char *path)
+{
+	struct vfs_trace_header header;
+	struct vfs_trace *trace;
+	struct stat statbuf;
+	int fd;
+
+	/* open trace file */
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return NULL;
+
+	/* read and check header */
+	if (read(fd, &header, sizeof(struct vfs_trace_header)) != sizeof(struct vfs_trace_header)
+	    || header.t_magic != VFS_TRACE_MAGIC
+	    || header.t_version != VFS_TRACE_VERSION
+	    || header.t_record_size != VFS_TRACE_RECORD_SIZE
+	    || header.t_nr_records == 0)
+		goto err;
+
+	/* check file size */
+	if (fstat(fd, &statbuf) || (size_t) statbuf.st_size < (size_t) (header.t_nr_records + 1) * VFS_TRACE_RECORD_SIZE)
+		goto err;
+
+	/* map trace file */
+	trace = vfs_trace_map(fd, (size_t) (header.t_nr_records + 1) * VFS_TRACE_RECORD_SIZE);
+	if (!trace)
+		goto err;
+
+	return trace;
+err:
+	close(fd);
+	return NULL;
+}
+
+/*
+ * Close a trace file.
+ */
+void vfs_trace_close(struct vfs_trace *trace)
+{
+	if (!trace)
+		return;
+
+	msync(trace->t_header, trace->t_size, MS_SYNC);
+	munmap(trace->t_header, trace->t_size);
+	close(trace->t_fd);
+	free(trace);
+}
+
+/*
+ * Add an operation to a trace (oldest record is overwritten when the ring is full).
+ */
+void vfs_trace_add(struct vfs_trace *trace, int op, uint64_t start, uint64_t duration, struct vfs_trace_args *args)
+{
+	struct vfs_trace_record *rec;
+	size_t len, len2 = 0;
+
+	if (!trace)
+		return;
+
+	/* get next record */
+	rec = &trace->t_records[trace->t_header->t_head % trace->t_header->t_nr_records];
+
+	/* set record */
+	rec->r_time = start - trace->t_header->t_start;
+	rec->r_duration = duration > UINT32_MAX ? UINT32_MAX : duration;
+	rec->r_offset = args->offset;
+	rec->r_offset2 = args->offset2;
+	rec->r_fh = args->fh;
+	rec->r_length = args->length;
+	rec->r_mode = args->mode;
+	rec->r_result = args->result;
+	rec->r_op = op;
+
+	/* copy paths (truncated if too long) */
+	len = args->path ? strnlen(args->path, UINT8_MAX) : 0;
+	if (len > VFS_TRACE_PATH_LEN)
+		len = VFS_TRACE_PATH_LEN;
+	if (args->path2) {
+		len2 = strnlen(args->path2, UINT8_MAX);
+		if (len + len2 > VFS_TRACE_PATH_LEN)
+			len2 = VFS_TRACE_PATH_LEN - len;
+	}
+	rec->r_path_len = len;
+	rec->r_path2_len = len2;
+	if (len)
+		memcpy(rec->r_path, args->path, len);
+	if (len2)
+		memcpy(rec->r_path + len, args->path2, len2);
+
+	/* commit record */
+	trace->t_header->t_head++;
+}
+
+/*
+ * Get first available record index (older records have been overwritten).
+ */
+uint64_t vfs_trace_first(struct vfs_trace *trace)
+{
+	if (trace->t_header->t_head <= trace->t_header->t_nr_records)
+		return 0;
+
+	return trace->t_header->t_head - trace->t_header->t_nr_records;
+}
+
+/*
+ * Get a record.
+ */
+struct vfs_trace_record *vfs_trace_get(struct vfs_trace *trace, uint64_t i)
+{
+	if (i < vfs_trace_first(trace) || i >= trace->t_header->t_head)
+		return NULL;
+
+	return &trace->t_records[i % trace->t_header->t_nr_records];
+}
+
+/*
+ * Encode a timestamp in a trace record (nanoseconds, UTIME_NOW and UTIME_OMIT are kept).
+ */
+uint64_t vfs_trace_time(const struct timespec *ts)
+{
+	if (ts->tv_nsec == UTIME_NOW)
+		return VFS_TRACE_UTIME_NOW;
+	if (ts->tv_nsec == UTIME_OMIT)
+		return VFS_TRACE_UTIME_OMIT;
+
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/*
+ * Decode a timestamp of a trace record.
+ */
+void vfs_trace_timespec(uint64_t time, struct timespec *ts)
+{
+	ts->tv_sec = 0;
+	if (time == VFS_TRACE_UTIME_NOW) {
+		ts->tv_nsec = UTIME_NOW;
+	} else if (time == VFS_TRACE_UTIME_OMIT) {
+		ts->tv_nsec = UTIME_OMIT;
+	} else {
+		ts->tv_sec = time / 1000000000ULL;
+		ts->tv_nsec = time % 1000000000ULL;
+	}
+}
@@ -14,6 +14,12 @@ int vfs_truncate(struct inode *root, const char *pathname, off_t length)
 	if (!inode)
 		return -ENOENT;
 
+	/* read only file system */
+	if (vfs_rdonly(inode->i_sb)) {
+		vfs_iput(inode);
+		return -EROFS;
+	}
+
 	/* set new size */
 	inode->i_size = length;
 
@@ -23,10 +23,69 @@
 
 #define VFS_BUFFER_HTABLE_BITS				12
 #define VFS_NR_BUFFER					(1 << VFS_BUFFER_HTABLE_BITS)
+#define VFS_READAHEAD_MAX				32
 
 #define VFS_INODE_HTABLE_BITS				12
 #define VFS_NR_INODE					(1 << VFS_INODE_HTABLE_BITS)
 
+#define VFS_COPY_BUF_SIZE				65536
+
+#define VFS_SB_RDONLY					0x01		/* read only file system */
+
+#define VFS_STAT_LOOKUP					0
+#define VFS_STAT_BREAD					1
+#define VFS_STAT_BWRITE					2
+#define VFS_STAT_ALLOC					3
+#define VFS_STAT_MISS					4
+#define VFS_STAT_IO					5
+#define VFS_NR_STATS					6
+
+#define VFS_OP_GETATTR					0
+#define VFS_OP_READLINK					1
+#define VFS_OP_MKNOD					2
+#define VFS_OP_MKDIR					3
+#define VFS_OP_UNLINK					4
+#define VFS_OP_RMDIR					5
+#define VFS_OP_SYMLINK					6
+#define VFS_OP_RENAME					7
+#define VFS_OP_LINK					8
+#define VFS_OP_CHMOD					9
+#define VFS_OP_CHOWN					10
+#define VFS_OP_TRUNCATE					11
+#define VFS_OP_OPEN					12
+#define VFS_OP_READ					13
+#define VFS_OP_WRITE					14
+#define VFS_OP_STATFS					15
+#define VFS_OP_FLUSH					16
+#define VFS_OP_RELEASE					17
+#define VFS_OP_FSYNC					18
+#define VFS_OP_SETXATTR					19
+#define VFS_OP_GETXATTR					20
+#define VFS_OP_LISTXATTR				21
+#define VFS_OP_REMOVEXATTR				22
+#define VFS_OP_READDIR					23
+#define VFS_OP_INIT					24
+#define VFS_OP_DESTROY					25
+#define VFS_OP_ACCESS					26
+#define VFS_OP_CREATE					27
+#define VFS_OP_LOCK					28
+#define VFS_OP_UTIMENS					29
+#define VFS_OP_LSEEK					30
+#define VFS_OP_COPY_FILE_RANGE				31
+#define VFS_NR_OPS					32
+
+#define VFS_TRACE_MAGIC					0x43525456	/* "VTRC" */
+#define VFS_TRACE_VERSION				3
+#define VFS_TRACE_RECORD_SIZE				256
+#define VFS_TRACE_PATH_LEN				(VFS_TRACE_RECORD_SIZE - 56)
+#define VFS_TRACE_DEFAULT_RECORDS			65536
+#define VFS_TRACE_UTIME_NOW				UINT64_MAX		/* traced UTIME_NOW timestamp */
+#define VFS_TRACE_UTIME_OMIT				(UINT64_MAX - 1)	/* traced UTIME_OMIT timestamp */
+
+#define VFS_HIST_SUB_BITS				3
+#define VFS_HIST_SUB_COUNT				(1 << VFS_HIST_SUB_BITS)
+#define VFS_HIST_NR_BUCKETS				((64 - VFS_HIST_SUB_BITS + 1) * VFS_HIST_SUB_COUNT)
+
 #define container_of(ptr, type, member)			({void *__mptr = (void *)(ptr);				\
 							((type *)(__mptr - offsetof(type, member))); })
 
@@ -59,6 +118,7 @@ struct super_block {
 	uint16_t				s_blocksize;		/* block size in byte */
 	uint8_t					s_blocksize_bits;	/* block size in bit (log2) */
 	uint16_t				s_magic;		/* magic number */
+	int					s_flags;		/* mount flags */
 	void *					s_fs_info;		/* specific file system informations */
 	struct inode *				s_root_inode;		/* root inode */
 	struct super_operations *		s_op;			/* super block operations */
@@ -109,6 +169,95 @@ struct file {
 	struct file_operations *		f_op;			/* file operations */
 };
 
+/*
+ * Latency histogram (HDR style : log2 buckets split in linear sub buckets).
+ */
+struct vfs_histogram {
+	const char *				h_name;			/* histogram name */
+	int					h_stage;		/* stage measured by this histogram (or -1) */
+	uint64_t				h_count;		/* number of samples */
+	uint64_t				h_total_ns;		/* total time */
+	uint64_t				h_min;			/* minimum sample */
+	uint64_t				h_max;			/* maximum sample */
+	uint64_t				h_stage_ns[VFS_NR_STATS];	/* time spent in nested stages */
+	uint64_t				h_buckets[VFS_HIST_NR_BUCKETS];	/* samples buckets */
+};
+
+/*
+ * Timed section context.
+ */
+struct vfs_stat_ctx {
+	uint64_t				c_start;		/* start time */
+	uint64_t				c_stage_ns[VFS_NR_STATS];	/* time spent in nested stages */
+	uint64_t				c_stage_cnt[VFS_NR_STATS];	/* number of nested stages */
+};
+
+/*
+ * Operations trace file header (followed by a ring of records).
+ */
+struct vfs_trace_header {
+	uint32_t				t_magic;		/* magic number */
+	uint32_t				t_version;		/* trace format version */
+	uint32_t				t_record_size;		/* size of a record */
+	uint32_t				t_nr_records;		/* number of records in the ring */
+	uint64_t				t_head;			/* number of records written */
+	uint64_t				t_start;		/* trace start time */
+};
+
+/*
+ * Operation trace record.
+ */
+struct vfs_trace_record {
+	uint64_t				r_time;			/* start time (relative to trace start) */
+	uint64_t				r_offset;		/* offset (read/write/truncate) or access time (utimens) */
+	uint64_t				r_offset2;		/* second offset (copy_file_range output) or modification time (utimens) */
+	uint64_t				r_fh;			/* file handle */
+	uint32_t				r_duration;		/* duration in ns */
+	uint32_t				r_length;		/* length (read/write/readlink) */
+	uint32_t				r_mode;			/* mode or open flags */
+	int32_t					r_result;		/* result */
+	uint8_t					r_op;			/* operation */
+	uint8_t					r_path_len;		/* path length */
+	uint8_t					r_path2_len;		/* second path length (rename/link/symlink) */
+	uint8_t					r_pad[4];		/* padding */
+	char					r_path[VFS_TRACE_PATH_LEN];	/* paths */
+};
+
+/*
+ * Operation arguments to trace.
+ */
+struct vfs_trace_args {
+	const char *				path;			/* path */
+	const char *				path2;			/* second path */
+	uint64_t				offset;			/* offset */
+	uint64_t				offset2;		/* second offset */
+	uint32_t				length;			/* length */
+	uint32_t				mode;			/* mode or open flags */
+	uint64_t				fh;			/* file handle */
+	int					result;			/* result */
+};
+
+/*
+ * Operations trace (memory mapped ring file).
+ */
+struct vfs_trace {
+	int					t_fd;			/* trace file descriptor */
+	size_t					t_size;			/* trace file size */
+	struct vfs_trace_header *		t_header;		/* mapped header */
+	struct vfs_trace_record *		t_records;		/* mapped records */
+};
+
+/*
+ * File defragmentation request (rate, check) and result.
+ */
+struct vfs_defrag {
+	uint64_t				rate;			/* copy throughput limit in bytes per second (0 = unlimited) */
+	int					check;			/* only count runs (don't move blocks) */
+	uint32_t				nr_blocks;		/* data blocks of file */
+	uint32_t				nr_extents;		/* contiguous runs before defragmentation */
+	uint32_t				nr_extents_new;		/* contiguous runs after defragmentation (unchanged if file was not moved) */
+};
+
 /*
  * Super block operations.
  */
@@ -120,6 +269,9 @@ struct super_operations {
 	int (*write_inode)(struct inode *);
 	void (*put_super)(struct super_block *);
 	int (*statfs)(struct super_block *, struct statfs *);
+	int (*sync_fs)(struct super_block *);
+	int (*commit_fs)(struct super_block *);
+	int (*write_buffer)(struct buffer_head *);
 };
 
 /*
@@ -138,6 +290,7 @@ struct inode_operations {
 	int (*rmdir)(struct inode *, const char *, size_t);
 	int (*rename)(struct inode *, const char *, size_t, struct inode *, const char *, size_t);
 	void (*truncate)(struct inode *);
+	int (*defrag)(struct inode *, struct vfs_defrag *);
 };
 
 /*
@@ -149,17 +302,46 @@ struct file_operations {
 	int (*read)(struct file *, char *, int);
 	int (*write)(struct file *, const char *, int);
 	int (*getdents64)(struct file *, void *, size_t);
+	off_t (*lseek)(struct file *, off_t, int);
+	ssize_t (*copy_file_range)(struct file *, off_t, struct file *, off_t, size_t);
 };
 
 /* VFS block buffer protoypes */
+struct buffer_head *getblk(struct super_block *sb, uint32_t block);
 struct buffer_head *sb_bread(struct super_block *sb, uint32_t block);
+void sb_breadahead(struct super_block *sb, uint32_t *blocks, int nr_blocks);
 int bwrite(struct buffer_head *bh);
 void brelse(struct buffer_head *bh);
+void vfs_bpurge(struct super_block *sb);
+
+/* VFS statistics prototypes */
+extern int vfs_stats_enabled;
+extern struct vfs_histogram vfs_stats[VFS_NR_STATS];
+void vfs_stat_begin(struct vfs_stat_ctx *ctx);
+uint64_t vfs_stat_end(struct vfs_histogram *hist, struct vfs_stat_ctx *ctx);
+uint64_t vfs_hist_percentile(struct vfs_histogram *hist, double p);
+void vfs_stat_print_stages(FILE *fp, struct vfs_stat_ctx *ctx);
+void vfs_hist_dump(FILE *fp, struct vfs_histogram *hist);
+void vfs_stats_dump(FILE *fp);
+void vfs_stats_reset();
+
+/* VFS trace prototypes */
+extern const char *vfs_op_names[VFS_NR_OPS];
+struct vfs_trace *vfs_trace_create(const char *path, uint32_t nr_records);
+struct vfs_trace *vfs_trace_open(const char *path);
+void vfs_trace_close(struct vfs_trace *trace);
+void vfs_trace_add(struct vfs_trace *trace, int op, uint64_t start, uint64_t duration, struct vfs_trace_args *args);
+struct vfs_trace_record *vfs_trace_get(struct vfs_trace *trace, uint64_t i);
+uint64_t vfs_trace_first(struct vfs_trace *trace);
+uint64_t vfs_trace_time(const struct timespec *ts);
+void vfs_trace_timespec(uint64_t time, struct timespec *ts);
 
 /* VFS inode prototypes */
 struct inode *vfs_get_empty_inode(struct super_block *sb);
 struct inode *vfs_iget(struct super_block *sb, ino_t ino);
 void vfs_iput(struct inode *inode);
+void vfs_sync_inodes(struct super_block *sb);
+void vfs_ipurge(struct super_block *sb);
 void vfs_ihash(struct inode *inode);
 
 /* VFS name resolution prototypes */
@@ -173,6 +355,8 @@ int vfs_iinit();
 struct super_block *vfs_mount(const char *dev, int fs_type, void *data);
 int vfs_umount(struct super_block *sb);
 int vfs_statfs(struct super_block *sb, struct statfs *buf);
+int vfs_sync(struct super_block *sb);
+int vfs_commit(struct super_block *sb);
 int vfs_create(struct inode *root, const char *pathname, mode_t mode);
 int vfs_unlink(struct inode *root, const char *pathname);
 int vfs_mkdir(struct inode *root, const char *pathname, mode_t mode);
@@ -191,8 +375,18 @@ int vfs_close(struct file *filp);
 ssize_t vfs_read(struct file *filp, char *buf, int count);
 ssize_t vfs_write(struct file *filp, const char *buf, int count);
 off_t vfs_lseek(struct file *filp, off_t offset, int whence);
+ssize_t vfs_copy_file_range(struct file *filp_in, off_t off_in, struct file *filp_out, off_t off_out, size_t len);
 int vfs_getdents64(struct file *filp, void *dirp, size_t count);
 int vfs_truncate(struct inode *root, const char *pathname, off_t length);
+int vfs_defrag(struct inode *root, const char *pathname, struct vfs_defrag *defrag);
+
+/*
+ * Is a file system mounted read only ?
+ */
+static inline int vfs_rdonly(struct super_block *sb)
+{
+	return sb->s_flags & VFS_SB_RDONLY;
+}
 
 /*
  * Get current time.
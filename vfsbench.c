@@ -0,0 +1,976 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "vfs/vfs.h"
+#include "tarfs/tarfs.h"
+
+#define DIR_BUF_SIZE			4096
+#define PATH_LEN			1024
+
+#define DEFAULT_FILE_SIZE		(64 * 1024 * 1024)
+#define DEFAULT_BLOCK_SIZE		(128 * 1024)
+#define DEFAULT_NR_FILES		1000
+#define DEFAULT_DEPTH			16
+#define DEFAULT_WORKLOADS		"seqwrite,seqread,randwrite,randread,create,stat,readdir,unlink,lookup,untar,walk"
+#define DEFAULT_RO_WORKLOADS		"seqread,randread,walk"
+
+#define BENCH_FILE			"/vfsbench.data"
+#define BENCH_META_DIR			"/vfsbench.meta"
+#define BENCH_DEEP_DIR			"/vfsbench.deep"
+#define BENCH_UNTAR_DIR			"/vfsbench.untar"
+#define BENCH_FLAT_PREFIX		"/vbm"				/* metadata files prefix on flat file systems (short names) */
+
+/*
+ * Benchmark context.
+ */
+struct bench {
+	char *				dev;				/* device path */
+	char *				fs_name;			/* file system name */
+	int				fs_type;			/* file system type */
+	struct super_block *		sb;				/* mounted super block */
+	size_t				file_size;			/* data file size */
+	size_t				block_size;			/* I/O size */
+	int				nr_files;			/* number of files for metadata workloads */
+	int				depth;				/* directories depth for lookup workload */
+	char *				file_path;			/* existing file to read (instead of data file) */
+	char *				tar_path;			/* TAR archive to extract */
+	char *				workloads;			/* workloads list */
+	unsigned int			seed;				/* random seed */
+	int				dump_hooks;			/* dump VFS hooks histograms */
+	int				flat;				/* file system has no directories (metadata files in root) */
+	char *				buf;				/* I/O buffer */
+};
+
+/*
+ * Benchmark result.
+ */
+struct bench_result {
+	uint64_t			ops;				/* number of operations */
+	uint64_t			bytes;				/* number of bytes read/written */
+	uint64_t			elapsed_ns;			/* elapsed time */
+	struct vfs_histogram		hist;				/* operations latency */
+};
+
+/*
+ * Benchmark workload.
+ */
+struct workload {
+	const char *			name;				/* workload name */
+	int				(*run)(struct bench *, struct bench_result *);
+	int				write;				/* workload needs a writable file system */
+};
+
+/*
+ * Get monotonic time in nanoseconds.
+ */
+static uint64_t now_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * Get data file path.
+ */
+static const char *data_path(struct bench *bench)
+{
+	return bench->file_path ? bench->file_path : BENCH_FILE;
+}
+
+/*
+ * Create data file if needed (not timed).
+ */
+static int prepare_data_file(struct bench *bench)
+{
+	struct stat statbuf;
+	struct file *filp;
+	size_t done;
+	int n;
+
+	/* file already exists */
+	if (vfs_stat(bench->sb->s_root_inode, data_path(bench), &statbuf) == 0 && statbuf.st_size >= bench->block_size)
+		return 0;
+
+	/* existing file must not be created */
+	if (bench->file_path) {
+		fprintf(stderr, "vfsbench: can't stat %s\n", bench->file_path);
+		return -ENOENT;
+	}
+
+	/* create data file */
+	filp = vfs_open(bench->sb->s_root_inode, BENCH_FILE, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (!filp)
+		return -ENOSPC;
+
+	/* fill it */
+	for (done = 0; done < bench->file_size; done += n) {
+		n = vfs_write(filp, bench->buf, bench->block_size);
+		if (n <= 0)
+			break;
+	}
+
+	vfs_close(filp);
+	return 0;
+}
+
+/*
+ * Create a benchmark directory (file systems without directories, like BFS, are flagged flat).
+ */
+static void bench_mkdir(struct bench *bench, const char *path)
+{
+	int err;
+
+	err = vfs_mkdir(bench->sb->s_root_inode, path, 0755);
+	if (err == -EPERM || err == -ENOSYS)
+		bench->flat = 1;
+}
+
+/*
+ * Get path of a metadata file (in root directory on flat file systems).
+ */
+static void meta_path(struct bench *bench, char *path, int i)
+{
+	if (bench->flat)
+		snprintf(path, PATH_LEN, "%s%d", BENCH_FLAT_PREFIX, i);
+	else
+		snprintf(path, PATH_LEN, "%s/f%d", BENCH_META_DIR, i);
+}
+
+/*
+ * Create metadata files if needed (not timed).
+ */
+static int prepare_meta_files(struct bench *bench)
+{
+	char path[PATH_LEN];
+	struct stat statbuf;
+	int i;
+
+	/* create directory */
+	bench_mkdir(bench, BENCH_META_DIR);
+
+	/* files already exist */
+	meta_path(bench, path, bench->nr_files - 1);
+	if (vfs_stat(bench->sb->s_root_inode, path, &statbuf) == 0)
+		return 0;
+
+	/* create files */
+	for (i = 0; i < bench->nr_files; i++) {
+		meta_path(bench, path, i);
+		vfs_create(bench->sb->s_root_inode, path, 0644);
+	}
+
+	return 0;
+}
+
+/*
+ * Sequential or random I/O on data file.
+ */
+static int run_io(struct bench *bench, struct bench_result *res, int write, int random)
+{
+	size_t nr_blocks, i;
+	struct vfs_stat_ctx ctx;
+	struct file *filp;
+	struct stat statbuf;
+	off_t offset, pos;
+	int n, err;
+
+	/* sequential write creates data file, others need it */
+	if (random || !write) {
+		err = prepare_data_file(bench);
+		if (err)
+			return err;
+	}
+
+	/* get number of blocks */
+	nr_blocks = bench->file_size / bench->block_size;
+	if (!(write && !random)) {
+		err = vfs_stat(bench->sb->s_root_inode, data_path(bench), &statbuf);
+		if (err)
+			return err;
+		nr_blocks = statbuf.st_size / bench->block_size;
+	}
+
+	/* nothing to do */
+	if (!nr_blocks)
+		return 0;
+
+	/* open data file */
+	filp = vfs_open(bench->sb->s_root_inode, data_path(bench), write ? (random ? O_RDWR : O_CREAT | O_RDWR | O_TRUNC) : O_RDONLY, 0644);
+	if (!filp) {
+		fprintf(stderr, "vfsbench: can't open %s\n", data_path(bench));
+		return -ENOENT;
+	}
+
+	/* read/write block by block */
+	for (i = 0; i < nr_blocks; i++) {
+		offset = (random ? rand_r(&bench->seed) % nr_blocks : i) * bench->block_size;
+
+		vfs_stat_begin(&ctx);
+		pos = vfs_lseek(filp, offset, SEEK_SET);
+		if (pos < 0) {
+			vfs_close(filp);
+			return pos;
+		}
+		n = write ? vfs_write(filp, bench->buf, bench->block_size) : vfs_read(filp, bench->buf, bench->block_size);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (n <= 0)
+			break;
+
+		res->ops++;
+		res->bytes += n;
+	}
+
+	vfs_close(filp);
+	return 0;
+}
+
+/*
+ * Sequential write workload.
+ */
+static int run_seqwrite(struct bench *bench, struct bench_result *res)
+{
+	return run_io(bench, res, 1, 0);
+}
+
+/*
+ * Sequential read workload.
+ */
+static int run_seqread(struct bench *bench, struct bench_result *res)
+{
+	return run_io(bench, res, 0, 0);
+}
+
+/*
+ * Random write workload.
+ */
+static int run_randwrite(struct bench *bench, struct bench_result *res)
+{
+	return run_io(bench, res, 1, 1);
+}
+
+/*
+ * Random read workload.
+ */
+static int run_randread(struct bench *bench, struct bench_result *res)
+{
+	return run_io(bench, res, 0, 1);
+}
+
+/*
+ * Create files storm.
+ */
+static int run_create(struct bench *bench, struct bench_result *res)
+{
+	struct vfs_stat_ctx ctx;
+	char path[PATH_LEN];
+	int i, err;
+
+	/* create directory */
+	bench_mkdir(bench, BENCH_META_DIR);
+
+	/* create files */
+	for (i = 0; i < bench->nr_files; i++) {
+		meta_path(bench, path, i);
+
+		vfs_stat_begin(&ctx);
+		err = vfs_create(bench->sb->s_root_inode, path, 0644);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (err)
+			return err;
+
+		res->ops++;
+	}
+
+	return 0;
+}
+
+/*
+ * Stat files storm.
+ */
+static int run_stat(struct bench *bench, struct bench_result *res)
+{
+	struct vfs_stat_ctx ctx;
+	struct stat statbuf;
+	char path[PATH_LEN];
+	int i, err;
+
+	/* create files if needed */
+	err = prepare_meta_files(bench);
+	if (err)
+		return err;
+
+	/* stat files */
+	for (i = 0; i < bench->nr_files; i++) {
+		meta_path(bench, path, i);
+
+		vfs_stat_begin(&ctx);
+		err = vfs_stat(bench->sb->s_root_inode, path, &statbuf);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (err)
+			return err;
+
+		res->ops++;
+	}
+
+	return 0;
+}
+
+/*
+ * Read a directory.
+ */
+static int read_dir(struct bench *bench, const char *path, struct bench_result *res)
+{
+	char dir_buf[DIR_BUF_SIZE];
+	struct vfs_stat_ctx ctx;
+	struct file *filp;
+	int n;
+
+	/* open directory */
+	filp = vfs_open(bench->sb->s_root_inode, path, 0, 0);
+	if (!filp)
+		return -ENOENT;
+
+	/* read entries */
+	for (;;) {
+		vfs_stat_begin(&ctx);
+		n = vfs_getdents64(filp, dir_buf, DIR_BUF_SIZE);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (n <= 0)
+			break;
+
+		res->ops++;
+		res->bytes += n;
+	}
+
+	vfs_close(filp);
+	return n < 0 ? n : 0;
+}
+
+/*
+ * Large directory read.
+ */
+static int run_readdir(struct bench *bench, struct bench_result *res)
+{
+	int err;
+
+	/* create files if needed */
+	err = prepare_meta_files(bench);
+	if (err)
+		return err;
+
+	return read_dir(bench, bench->flat ? "/" : BENCH_META_DIR, res);
+}
+
+/*
+ * Unlink files storm.
+ */
+static int run_unlink(struct bench *bench, struct bench_result *res)
+{
+	struct vfs_stat_ctx ctx;
+	char path[PATH_LEN];
+	int i, err;
+
+	/* create files if needed */
+	err = prepare_meta_files(bench);
+	if (err)
+		return err;
+
+	/* unlink files */
+	for (i = 0; i < bench->nr_files; i++) {
+		meta_path(bench, path, i);
+
+		vfs_stat_begin(&ctx);
+		err = vfs_unlink(bench->sb->s_root_inode, path);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (err)
+			return err;
+
+		res->ops++;
+	}
+
+	/* remove directory */
+	return bench->flat ? 0 : vfs_rmdir(bench->sb->s_root_inode, BENCH_META_DIR);
+}
+
+/*
+ * Deep path lookups.
+ */
+static int run_lookup(struct bench *bench, struct bench_result *res)
+{
+	struct vfs_stat_ctx ctx;
+	struct stat statbuf;
+	char path[PATH_LEN];
+	size_t len;
+	int i, err;
+
+	/* create directories chain (not timed, flat file systems resolve a root file) */
+	len = snprintf(path, PATH_LEN, "%s", BENCH_DEEP_DIR);
+	bench_mkdir(bench, path);
+	if (bench->flat)
+		vfs_create(bench->sb->s_root_inode, path, 0644);
+	for (i = 0; i < bench->depth && !bench->flat && len < PATH_LEN - 16; i++) {
+		len += snprintf(path + len, PATH_LEN - len, "/d%d", i);
+		vfs_mkdir(bench->sb->s_root_inode, path, 0755);
+	}
+
+	/* resolve deepest directory */
+	for (i = 0; i < bench->nr_files; i++) {
+		vfs_stat_begin(&ctx);
+		err = vfs_stat(bench->sb->s_root_inode, path, &statbuf);
+		vfs_stat_end(&res->hist, &ctx);
+
+		if (err)
+			return err;
+
+		res->ops++;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse an octal TAR field.
+ */
+static size_t tar_octal(const char *field, size_t len)
+{
+	size_t ret = 0;
+
+	for (; len > 0 && (*field == ' ' || *field == '0'); field++, len--);
+	for (; len > 0 && *field >= '0' && *field <= '7'; field++, len--)
+		ret = (ret << 3) + (*field - '0');
+
+	return ret;
+}
+
+/*
+ * Read a TAR entry name (long names are stored in a previous 'L' entry).
+ */
+static void tar_entry_name(char *name, size_t len, const char *field, size_t field_len, char *long_name)
+{
+	/* long name */
+	if (*long_name) {
+		snprintf(name, len, "%s", long_name);
+		*long_name = 0;
+		return;
+	}
+
+	/* short name */
+	snprintf(name, len, "%.*s", (int) field_len, field);
+}
+
+/*
+ * Extract a TAR archive.
+ */
+static int run_untar(struct bench *bench, struct bench_result *res)
+{
+	char path[PATH_LEN * 2], target[PATH_LEN * 2], name[PATH_LEN], long_name[PATH_LEN] = "";
+	struct tar_header header;
+	struct vfs_stat_ctx ctx;
+	size_t size, done, n;
+	struct file *filp;
+	int err = 0;
+	FILE *fp;
+
+	/* no TAR archive */
+	if (!bench->tar_path) {
+		fprintf(stderr, "vfsbench: untar needs a TAR archive (-T)\n");
+		return -EINVAL;
+	}
+
+	/* open TAR archive */
+	fp = fopen(bench->tar_path, "r");
+	if (!fp) {
+		fprintf(stderr, "vfsbench: can't open %s\n", bench->tar_path);
+		return -ENOENT;
+	}
+
+	/* create root directory */
+	vfs_mkdir(bench->sb->s_root_inode, BENCH_UNTAR_DIR, 0755);
+
+	/* extract entries */
+	while (fread(&header, sizeof(struct tar_header), 1, fp) == 1) {
+		/* end of archive */
+		if (!header.name[0])
+			break;
+
+		/* skip header padding */
+		fseek(fp, TARFS_BLOCK_SIZE - sizeof(struct tar_header), SEEK_CUR);
+		size = tar_octal(header.size, sizeof(header.size));
+		done = 0;
+
+		/* long name : applies to next entry */
+		if (header.typeflag == TAR_LONGNAME) {
+			n = size < PATH_LEN - 1 ? size : PATH_LEN - 1;
+			if (fread(long_name, 1, n, fp) != n)
+				break;
+			long_name[n] = 0;
+			done = n;
+			goto next;
+		}
+
+		/* build full path */
+		tar_entry_name(name, PATH_LEN, header.name, sizeof(header.name), long_name);
+		snprintf(path, sizeof(path), "%s/%s", BENCH_UNTAR_DIR, name);
+		if (path[strlen(path) - 1] == '/')
+			path[strlen(path) - 1] = 0;
+
+		vfs_stat_begin(&ctx);
+		switch (header.typeflag) {
+			case TAR_DIRTYPE:
+				vfs_mkdir(bench->sb->s_root_inode, path, tar_octal(header.mode, sizeof(header.mode)) & 0777);
+				break;
+			case TAR_SYMTYPE:
+				snprintf(target, sizeof(target), "%.*s", (int) sizeof(header.linkname), header.linkname);
+				vfs_symlink(bench->sb->s_root_inode, target, path);
+				break;
+			case TAR_LNKTYPE:
+				snprintf(target, sizeof(target), "%s/%.*s", BENCH_UNTAR_DIR, (int) sizeof(header.linkname), header.linkname);
+				vfs_link(bench->sb->s_root_inode, target, path);
+				break;
+			case TAR_REGTYPE:
+			case TAR_AREGTYPE:
+				filp = vfs_open(bench->sb->s_root_inode, path, O_CREAT | O_WRONLY | O_TRUNC, tar_octal(header.mode, sizeof(header.mode)) & 0777);
+				for (; done < size; done += n) {
+					n = size - done < bench->block_size ? size - done : bench->block_size;
+					if (fread(bench->buf, 1, n, fp) != n) {
+						err = -EIO;
+						break;
+					}
+
+					if (filp)
+						vfs_write(filp, bench->buf, n);
+					res->bytes += n;
+				}
+				vfs_close(filp);
+				break;
+			default:
+				break;
+		}
+		vfs_stat_end(&res->hist, &ctx);
+		res->ops++;
+
+		if (err)
+			break;
+next:
+		/* skip remaining data and padding */
+		fseek(fp, ALIGN_UP(size, TARFS_BLOCK_SIZE) - done, SEEK_CUR);
+	}
+
+	fclose(fp);
+	return err;
+}
+
+/*
+ * Walk a directory tree (readdir + stat of each entry, like ls -lR).
+ */
+static int walk_dir(struct bench *bench, const char *path, struct bench_result *res)
+{
+	char dir_buf[DIR_BUF_SIZE], child[PATH_LEN];
+	struct dirent64 *dir_entry;
+	struct vfs_stat_ctx ctx;
+	struct stat statbuf;
+	struct file *filp;
+	int n, i, err;
+
+	/* open directory */
+	filp = vfs_open(bench->sb->s_root_inode, path, 0, 0);
+	if (!filp)
+		return -ENOENT;
+
+	for (;;) {
+		/* read next entries */
+		vfs_stat_begin(&ctx);
+		n = vfs_getdents64(filp, dir_buf, DIR_BUF_SIZE);
+		vfs_stat_end(&res->hist, &ctx);
+		if (n <= 0)
+			break;
+
+		/* stat each entry */
+		for (i = 0; i < n; i += dir_entry->d_reclen) {
+			dir_entry = (struct dirent64 *) (dir_buf + i);
+			if (strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0)
+				continue;
+
+			snprintf(child, PATH_LEN, "%s/%s", strcmp(path, "/") ? path : "", dir_entry->d_name);
+
+			vfs_stat_begin(&ctx);
+			err = vfs_stat(bench->sb->s_root_inode, child, &statbuf);
+			vfs_stat_end(&res->hist, &ctx);
+			res->ops++;
+
+			/* recurse into directories */
+			if (!err && S_ISDIR(statbuf.st_mode))
+				walk_dir(bench, child, res);
+		}
+	}
+
+	vfs_close(filp);
+	return n < 0 ? n : 0;
+}
+
+/*
+ * Tree walk workload.
+ */
+static int run_walk(struct bench *bench, struct bench_result *res)
+{
+	return walk_dir(bench, "/", res);
+}
+
+/*
+ * Workloads.
+ */
+static const struct workload workloads[] = {
+	{ "seqwrite",		run_seqwrite,		1 },
+	{ "seqread",		run_seqread,		0 },
+	{ "randwrite",		run_randwrite,		1 },
+	{ "randread",		run_randread,		0 },
+	{ "create",		run_create,		1 },
+	{ "stat",		run_stat,		0 },
+	{ "readdir",		run_readdir,		0 },
+	{ "unlink",		run_unlink,		1 },
+	{ "lookup",		run_lookup,		0 },
+	{ "untar",		run_untar,		1 },
+	{ "walk",		run_walk,		0 },
+	{ NULL,			NULL,			0 },
+};
+
+/*
+ * Print a result as a JSON line.
+ */
+static void print_result(struct bench *bench, const char *name, struct bench_result *res, int err)
+{
+	struct vfs_histogram *hist = &res->hist;
+	double secs = res->elapsed_ns / 1000000000.0;
+
+	printf("{\"fs\":\"%s\",\"workload\":\"%s\",\"status\":%d,\"ops\":%lu,\"bytes\":%lu,\"elapsed_ms\":%.3f,"
+		"\"ops_per_sec\":%.1f,\"mb_per_sec\":%.2f,"
+		"\"lat_mean_us\":%.2f,\"lat_p50_us\":%.2f,\"lat_p99_us\":%.2f,\"lat_max_us\":%.2f,"
+		"\"miss_ms\":%.3f,\"io_ms\":%.3f}\n",
+		bench->fs_name, name, err, res->ops, res->bytes, res->elapsed_ns / 1000000.0,
+		secs > 0 ? res->ops / secs : 0, secs > 0 ? res->bytes / secs / (1024 * 1024) : 0,
+		hist->h_count ? hist->h_total_ns / 1000.0 / hist->h_count : 0,
+		vfs_hist_percentile(hist, 50) / 1000.0, vfs_hist_percentile(hist, 99) / 1000.0, hist->h_max / 1000.0,
+		hist->h_stage_ns[VFS_STAT_MISS] / 1000000.0, hist->h_stage_ns[VFS_STAT_IO] / 1000000.0);
+	fflush(stdout);
+}
+
+/*
+ * Fit number of metadata files in free inodes (BFS has a few hundred inodes), other benchmark files are kept.
+ */
+static void fit_nr_files(struct bench *bench)
+{
+	struct statfs statbuf;
+	int reserved;
+
+	/* inodes are not limited */
+	if (vfs_statfs(bench->sb, &statbuf) || !statbuf.f_files)
+		return;
+
+	/* keep inodes for data file, metadata directory and lookup directories chain */
+	reserved = bench->depth + 3;
+	if ((uint64_t) bench->nr_files + reserved <= statbuf.f_ffree)
+		return;
+
+	bench->nr_files = statbuf.f_ffree > reserved ? statbuf.f_ffree - reserved : 1;
+	fprintf(stderr, "vfsbench: only %lu free inodes, metadata workloads use %d files\n", (unsigned long) statbuf.f_ffree, bench->nr_files);
+}
+
+/*
+ * Run a workload (file system is mounted for each workload : unmount drops its cached buffers and inodes,
+ * so caches are cold).
+ */
+static int run_workload(struct bench *bench, const struct workload *workload)
+{
+	struct bench_result res;
+	uint64_t start;
+	int err;
+
+	/* reset result */
+	memset(&res, 0, sizeof(struct bench_result));
+	res.hist.h_name = workload->name;
+	res.hist.h_stage = -1;
+
+	/* mount file system */
+	if (!bench->sb)
+		bench->sb = vfs_mount(bench->dev, bench->fs_type, NULL);
+	if (!bench->sb) {
+		fprintf(stderr, "vfsbench: can't mount %s\n", bench->dev ? bench->dev : bench->fs_name);
+		return -EINVAL;
+	}
+
+	/* reset VFS hooks histograms */
+	vfs_stats_reset();
+
+	/* run workload */
+	start = now_ns();
+	err = workload->run(bench, &res);
+	res.elapsed_ns = now_ns() - start;
+
+	/* unmount file system (memfs content is lost, so keep it mounted) */
+	if (bench->fs_type != VFS_MEMFS_TYPE) {
+		vfs_umount(bench->sb);
+		bench->sb = NULL;
+	}
+
+	/* print result */
+	print_result(bench, workload->name, &res, err);
+	if (bench->dump_hooks)
+		vfs_stats_dump(stderr);
+
+	return err;
+}
+
+/*
+ * Parse a size (with optional k/m/g suffix).
+ */
+static size_t parse_size(const char *str)
+{
+	char *end;
+	size_t ret;
+
+	ret = strtoull(str, &end, 10);
+	switch (*end) {
+		case 'k':
+		case 'K':
+			return ret << 10;
+		case 'm':
+		case 'M':
+			return ret << 20;
+		case 'g':
+		case 'G':
+			return ret << 30;
+		default:
+			return ret;
+	}
+}
+
+/* Options */
+static const char *sopt = "t:w:s:b:n:d:f:T:r:vh";
+static const struct option lopt[] = {
+		{ "type",	required_argument,	NULL,	't'	},
+		{ "workloads",	required_argument,	NULL,	'w'	},
+		{ "size",	required_argument,	NULL,	's'	},
+		{ "bs",		required_argument,	NULL,	'b'	},
+		{ "nr-files",	required_argument,	NULL,	'n'	},
+		{ "depth",	required_argument,	NULL,	'd'	},
+		{ "file",	required_argument,	NULL,	'f'	},
+		{ "tar",	required_argument,	NULL,	'T'	},
+		{ "seed",	required_argument,	NULL,	'r'	},
+		{ "verbose",	no_argument,		NULL,	'v'	},
+		{ "help",	no_argument,		NULL,	'h'	},
+		{ NULL,		0,			NULL,	0 	}
+};
+
+/*
+ * Usage function.
+ */
+static void usage(char *prog_name)
+{
+	printf("%s -t fstype [options] [image_file]\n", prog_name);
+	printf("\n");
+	printf("Options :\n");
+	printf(" -h	print help\n");
+	printf(" -t	file system type (minix,bfs,ext2,isofs,memfs,tarfs)\n");
+	printf(" -w	comma separated workloads (default : %s)\n", DEFAULT_WORKLOADS);
+	printf(" -s	data file size (default : 64m)\n");
+	printf(" -b	I/O size (default : 128k)\n");
+	printf(" -n	number of files/lookups for metadata workloads (default : %d)\n", DEFAULT_NR_FILES);
+	printf(" -d	directories depth for lookup workload (default : %d)\n", DEFAULT_DEPTH);
+	printf("	(on file systems without directories, like bfs, metadata workloads use root directory and lookup resolves a root file)\n");
+	printf(" -f	existing file to use for read workloads\n");
+	printf(" -T	TAR archive to extract for untar workload\n");
+	printf(" -r	random seed\n");
+	printf(" -v	dump VFS hooks histograms on stderr after each workload\n");
+	printf("\n");
+	printf("Each workload result is printed on stdout as a JSON line.\n");
+}
+
+/*
+ * Parse options.
+ */
+static int parse_options(int argc, char **argv, struct bench *bench)
+{
+	int c;
+
+	/* set default options */
+	memset(bench, 0, sizeof(struct bench));
+	bench->file_size = DEFAULT_FILE_SIZE;
+	bench->block_size = DEFAULT_BLOCK_SIZE;
+	bench->nr_files = DEFAULT_NR_FILES;
+	bench->depth = DEFAULT_DEPTH;
+	bench->seed = 1;
+
+	/* parse options */
+	while ((c = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+		switch (c) {
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+				break;
+			case 't':
+				bench->fs_name = optarg;
+				break;
+			case 'w':
+				bench->workloads = optarg;
+				break;
+			case 's':
+				bench->file_size = parse_size(optarg);
+				break;
+			case 'b':
+				bench->block_size = parse_size(optarg);
+				break;
+			case 'n':
+				bench->nr_files = atoi(optarg);
+				break;
+			case 'd':
+				bench->depth = atoi(optarg);
+				break;
+			case 'f':
+				bench->file_path = optarg;
+				break;
+			case 'T':
+				bench->tar_path = optarg;
+				break;
+			case 'r':
+				bench->seed = atoi(optarg);
+				break;
+			case 'v':
+				bench->dump_hooks = 1;
+				break;
+			default:
+				break;
+		}
+	}
+
+	/* missing file system type */
+	if (!bench->fs_name || !bench->block_size || bench->nr_files <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	/* get image file */
+	if (optind < argc)
+		bench->dev = argv[optind];
+
+	/* choose file system type */
+	if (strcmp(bench->fs_name, "minix") == 0) {
+		bench->fs_type = VFS_MINIX_TYPE;
+	} else if (strcmp(bench->fs_name, "bfs") == 0) {
+		bench->fs_type = VFS_BFS_TYPE;
+	} else if (strcmp(bench->fs_name, "ext2") == 0) {
+		bench->fs_type = VFS_EXT2_TYPE;
+	} else if (strcmp(bench->fs_name, "isofs") == 0) {
+		bench->fs_type = VFS_ISOFS_TYPE;
+	} else if (strcmp(bench->fs_name, "memfs") == 0) {
+		bench->fs_type = VFS_MEMFS_TYPE;
+	} else if (strcmp(bench->fs_name, "tarfs") == 0) {
+		bench->fs_type = VFS_TARFS_TYPE;
+	} else {
+		fprintf(stderr, "vfsbench: unknown file system type '%s'\n", bench->fs_name);
+		return -1;
+	}
+
+	/* disk file systems need an image */
+	if (!bench->dev && bench->fs_type != VFS_MEMFS_TYPE) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	/* default workloads */
+	if (!bench->workloads) {
+		if (bench->fs_type == VFS_ISOFS_TYPE || bench->fs_type == VFS_TARFS_TYPE)
+			bench->workloads = DEFAULT_RO_WORKLOADS;
+		else
+			bench->workloads = DEFAULT_WORKLOADS;
+	}
+
+	return 0;
+}
+
+/*
+ * Main.
+ */
+int main(int argc, char **argv)
+{
+	const struct workload *workload;
+	struct bench bench;
+	char *name, *list;
+	int err, ret = 0;
+
+	/* init VFS block buffers and inodes */
+	err = vfs_init();
+	if (err) {
+		fprintf(stderr, "vfsbench: can't init block buffers map or inodes map\n");
+		exit(err);
+	}
+
+	/* parse options */
+	err = parse_options(argc, argv, &bench);
+	if (err)
+		exit(err);
+
+	/* allocate I/O buffer */
+	bench.buf = (char *) malloc(bench.block_size);
+	if (!bench.buf)
+		exit(ENOMEM);
+	memset(bench.buf, 'x', bench.block_size);
+
+	/* enable latency histograms */
+	vfs_stats_enabled = 1;
+
+	/* mount file system and fit metadata workloads in free inodes (first workload keeps it mounted) */
+	bench.sb = vfs_mount(bench.dev, bench.fs_type, NULL);
+	if (bench.sb)
+		fit_nr_files(&bench);
+
+	/* run workloads */
+	list = strdup(bench.workloads);
+	for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+		/* find workload */
+		for (workload = workloads; workload->name; workload++)
+			if (strcmp(workload->name, name) == 0)
+				break;
+
+		/* unknown workload */
+		if (!workload->name) {
+			fprintf(stderr, "vfsbench: unknown workload '%s'\n", name);
+			ret = -1;
+			continue;
+		}
+
+		/* skip untar if no archive is given with default workloads */
+		if (workload->run == run_untar && !bench.tar_path && strcmp(bench.workloads, DEFAULT_WORKLOADS) == 0)
+			continue;
+
+		/* read only file system */
+		if (workload->write && (bench.fs_type == VFS_ISOFS_TYPE || bench.fs_type == VFS_TARFS_TYPE)) {
+			fprintf(stderr, "vfsbench: workload '%s' needs a writable file system\n", name);
+			ret = -1;
+			continue;
+		}
+
+		/* run workload */
+		if (run_workload(&bench, workload))
+			ret = -1;
+	}
+
+	/* unmount memory file system */
+	if (bench.sb)
+		vfs_umount(bench.sb);
+
+	free(list);
+	free(bench.buf);
+	return ret;
+}
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vfs/vfs.h"
+
+#define DIR_BUF_SIZE			4096
+#define PATH_LEN			1024
+
+/*
+ * Defragmentation context.
+ */
+struct defrag {
+	char *				dev;				/* image file */
+	char *				opts;				/* mount options */
+	int				fs_type;			/* file system type */
+	struct super_block *		sb;				/* mounted super block */
+	uint64_t			rate;				/* copy throughput limit in bytes per second */
+	int				check;				/* report only */
+	int				verbose;			/* print each file */
+	uint64_t			nr_files;			/* number of scanned files */
+	uint64_t			nr_fragmented;			/* number of fragmented files */
+	uint64_t			nr_moved;			/* number of defragmented files */
+	uint64_t			nr_blocks;			/* number of data blocks */
+	uint64_t			nr_extents;			/* number of runs before defragmentation */
+	uint64_t			nr_extents_new;			/* number of runs after defragmentation */
+	uint64_t			nr_errors;			/* number of failed files */
+};
+
+/*
+ * Defragment a file.
+ */
+static void defrag_file(struct defrag *defrag, const char *path)
+{
+	struct vfs_defrag req;
+	int err;
+
+	/* defragment file */
+	memset(&req, 0, sizeof(struct vfs_defrag));
+	req.rate = defrag->rate;
+	req.check = defrag->check;
+	err = vfs_defrag(defrag->sb->s_root_inode, path, &req);
+	if (err) {
+		fprintf(stderr, "vfsdefrag: can't defragment %s (%s)\n", path, strerror(-err));
+		defrag->nr_errors++;
+		return;
+	}
+
+	/* update statistics */
+	defrag->nr_files++;
+	defrag->nr_blocks += req.nr_blocks;
+	defrag->nr_extents += req.nr_extents;
+	defrag->nr_extents_new += req.nr_extents_new;
+	if (req.nr_extents > 1)
+		defrag->nr_fragmented++;
+	if (req.nr_extents_new < req.nr_extents)
+		defrag->nr_moved++;
+
+	if (defrag->verbose)
+		printf("%s : %u blocks, %u -> %u extents\n", path, req.nr_blocks, req.nr_extents, req.nr_extents_new);
+}
+
+/*
+ * Defragment all regular files of a directory tree.
+ */
+static int defrag_dir(struct defrag *defrag, const char *path)
+{
+	char dir_buf[DIR_BUF_SIZE], child[PATH_LEN];
+	struct dirent64 *dir_entry;
+	struct stat statbuf;
+	struct file *filp;
+	int n, i, err;
+
+	/* open directory */
+	filp = vfs_open(defrag->sb->s_root_inode, path, 0, 0);
+	if (!filp)
+		return -ENOENT;
+
+	for (;;) {
+		/* read next entries */
+		n = vfs_getdents64(filp, dir_buf, DIR_BUF_SIZE);
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n; i += dir_entry->d_reclen) {
+			dir_entry = (struct dirent64 *) (dir_buf + i);
+			if (strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0)
+				continue;
+
+			snprintf(child, PATH_LEN, "%s/%s", strcmp(path, "/") ? path : "", dir_entry->d_name);
+
+			err = vfs_stat(defrag->sb->s_root_inode, child, &statbuf);
+			if (err)
+				continue;
+
+			/* recurse into directories, defragment regular files */
+			if (S_ISDIR(statbuf.st_mode))
+				defrag_dir(defrag, child);
+			else if (S_ISREG(statbuf.st_mode))
+				defrag_file(defrag, child);
+		}
+	}
+
+	vfs_close(filp);
+	return n < 0 ? n : 0;
+}
+
+/*
+ * Usage function.
+ */
+static void usage(char *prog_name)
+{
+	printf("%s -t fstype [-o options] [-r rate] [-c] [-v] <image_file> [path]\n", prog_name);
+	printf("\n");
+	printf("Options :\n");
+	printf(" -h	print help\n");
+	printf(" -t	file system type (ext2)\n");
+	printf(" -o	mount options\n");
+	printf(" -r	copy throughput limit in MB/s (default unlimited)\n");
+	printf(" -c	report fragmentation only\n");
+	printf(" -v	print each file\n");
+}
+
+/* options */
+static const char *sopt = "t:o:r:cvh";
+static const struct option lopt[] = {
+		{ "type",	required_argument,	NULL,	't'	},
+		{ "options",	required_argument,	NULL,	'o'	},
+		{ "rate",	required_argument,	NULL,	'r'	},
+		{ "check",	no_argument,		NULL,	'c'	},
+		{ "verbose",	no_argument,		NULL,	'v'	},
+		{ "help",	no_argument,		NULL,	'h'	},
+		{ NULL,		0,			NULL,	0 	}
+};
+
+/*
+ * Main.
+ */
+int main(int argc, char **argv)
+{
+	struct defrag defrag;
+	char *fs_type = NULL, *path;
+	struct stat statbuf;
+	int c, err;
+
+	/* reset defrag */
+	memset(&defrag, 0, sizeof(struct defrag));
+
+	/* parse options */
+	while ((c = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+		switch (c) {
+			case 't':
+				fs_type = optarg;
+				break;
+			case 'o':
+				defrag.opts = optarg;
+				break;
+			case 'r':
+				defrag.rate = strtoull(optarg, NULL, 10) * 1024 * 1024;
+				break;
+			case 'c':
+				defrag.check = 1;
+				break;
+			case 'v':
+				defrag.verbose = 1;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	/* get image file and path */
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+	defrag.dev = argv[optind];
+	path = optind + 1 < argc ? argv[optind + 1] : "/";
+
+	/* choose file system type */
+	if (!fs_type) {
+		usage(argv[0]);
+		exit(1);
+	} else if (strcmp(fs_type, "ext2") == 0) {
+		defrag.fs_type = VFS_EXT2_TYPE;
+	} else {
+		fprintf(stderr, "vfsdefrag: unsupported file system type '%s'\n", fs_type);
+		exit(1);
+	}
+
+	/* init VFS and mount file system */
+	if (vfs_init()) {
+		fprintf(stderr, "vfsdefrag: can't init VFS\n");
+		exit(1);
+	}
+	defrag.sb = vfs_mount(defrag.dev, defrag.fs_type, defrag.opts);
+	if (!defrag.sb) {
+		fprintf(stderr, "vfsdefrag: can't mount %s\n", defrag.dev);
+		exit(1);
+	}
+
+	/* defragment a file or a directory tree */
+	err = vfs_stat(defrag.sb->s_root_inode, path, &statbuf);
+	if (err)
+		fprintf(stderr, "vfsdefrag: can't stat %s (%s)\n", path, strerror(-err));
+	else if (S_ISDIR(statbuf.st_mode))
+		err = defrag_dir(&defrag, path);
+	else
+		defrag_file(&defrag, path);
+
+	/* unmount file system */
+	vfs_umount(defrag.sb);
+
+	/* print statistics */
+	printf("%lu files (%lu fragmented, %lu defragmented, %lu errors), %lu blocks, %lu -> %lu extents\n",
+	       defrag.nr_files, defrag.nr_fragmented, defrag.nr_moved, defrag.nr_errors,
+	       defrag.nr_blocks, defrag.nr_extents, defrag.nr_extents_new);
+
+	return err || defrag.nr_errors ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+
+#include "vfs/vfs.h"
+
+#define DIR_BUF_SIZE			4096
+#define IO_BUF_SIZE			(1024 * 1024)
+#define REPLAY_NR_FILES			1024
+
+/*
+ * Replayed opened file (trace file handle -> VFS file).
+ */
+struct replay_file {
+	uint64_t			fh;				/* traced file handle */
+	struct file *			filp;				/* replayed file */
+};
+
+/*
+ * Replay context.
+ */
+struct replay {
+	char *				trace_path;			/* trace file */
+	char *				dev;				/* image file */
+	char *				copy;				/* image copy */
+	int				fs_type;			/* file system type */
+	int				in_place;			/* replay on image itself */
+	int				dump;				/* dump trace only */
+	struct vfs_trace *		trace;				/* trace */
+	struct super_block *		sb;				/* mounted super block */
+	struct replay_file		files[REPLAY_NR_FILES];		/* opened files */
+	char *				buf;				/* I/O buffer */
+	uint64_t			nr_ops;				/* number of replayed operations */
+	uint64_t			nr_errors;			/* number of results different from trace */
+};
+
+/*
+ * Replay operations latency histograms.
+ */
+static struct vfs_histogram replay_stats[VFS_NR_OPS];
+
+/*
+ * Get an opened file.
+ */
+static struct replay_file *replay_get_file(struct replay *replay, uint64_t fh)
+{
+	int i;
+
+	if (!fh)
+		return NULL;
+
+	for (i = 0; i < REPLAY_NR_FILES; i++)
+		if (replay->files[i].fh == fh)
+			return &replay->files[i];
+
+	return NULL;
+}
+
+/*
+ * Get a record file (open it by path if it was opened before the first traced record).
+ */
+static struct file *replay_file(struct replay *replay, struct vfs_trace_record *rec, const char *path, int flags)
+{
+	struct replay_file *rfile;
+
+	/* already opened */
+	rfile = replay_get_file(replay, rec->r_fh);
+	if (rfile)
+		return rfile->filp;
+
+	/* find a free slot and open file */
+	for (rfile = replay->files; rfile < replay->files + REPLAY_NR_FILES && rfile->fh; rfile++);
+	if (rfile == replay->files + REPLAY_NR_FILES)
+		return NULL;
+
+	rfile->filp = vfs_open(replay->sb->s_root_inode, path, flags, 0);
+	if (!rfile->filp)
+		return NULL;
+
+	rfile->fh = rec->r_fh ? rec->r_fh : (uint64_t) rfile->filp;
+	return rfile->filp;
+}
+
+/*
+ * Release a file.
+ */
+static int replay_release(struct replay *replay, uint64_t fh)
+{
+	struct replay_file *rfile;
+	int err;
+
+	rfile = replay_get_file(replay, fh);
+	if (!rfile)
+		return 0;
+
+	err = vfs_close(rfile->filp);
+	rfile->fh = 0;
+	rfile->filp = NULL;
+
+	return err;
+}
+
+/*
+ * Replay a record.
+ */
+static int replay_record(struct replay *replay, struct vfs_trace_record *rec, const char *path, const char *path2)
+{
+	struct inode *root = replay->sb->s_root_inode;
+	struct timespec times[2];
+	struct statfs statfsbuf;
+	struct stat statbuf;
+	struct file *filp, *filp_out;
+	size_t length;
+	ssize_t count;
+	off_t pos;
+	int err;
+
+	switch (rec->r_op) {
+		case VFS_OP_GETATTR:
+			return vfs_stat(root, path, &statbuf);
+		case VFS_OP_READLINK:
+			err = vfs_readlink(root, path, replay->buf, rec->r_length < IO_BUF_SIZE ? rec->r_length : IO_BUF_SIZE);
+			return err < 0 ? err : 0;
+		case VFS_OP_MKDIR:
+			return vfs_mkdir(root, path, rec->r_mode);
+		case VFS_OP_UNLINK:
+			return vfs_unlink(root, path);
+		case VFS_OP_RMDIR:
+			return vfs_rmdir(root, path);
+		case VFS_OP_SYMLINK:
+			return vfs_symlink(root, path2, path);
+		case VFS_OP_RENAME:
+			return vfs_rename(root, path, path2);
+		case VFS_OP_LINK:
+			return vfs_link(root, path2, path);
+		case VFS_OP_CHMOD:
+			return vfs_chmod(root, path, rec->r_mode);
+		case VFS_OP_CHOWN:
+			return vfs_chown(root, path, rec->r_offset, rec->r_length);
+		case VFS_OP_TRUNCATE:
+			return vfs_truncate(root, path, rec->r_offset);
+		case VFS_OP_OPEN:
+			if (rec->r_result)
+				return vfs_stat(root, path, &statbuf) ? -ENOENT : 0;
+			replay_release(replay, rec->r_fh);
+			return replay_file(replay, rec, path, rec->r_mode) ? 0 : -ENOENT;
+		case VFS_OP_READ:
+		case VFS_OP_WRITE:
+			/* get file */
+			filp = replay_file(replay, rec, path, rec->r_op == VFS_OP_READ ? O_RDONLY : O_WRONLY);
+			if (!filp)
+				return -1;
+
+			/* seek and read/write (written data is not traced) */
+			length = rec->r_length < IO_BUF_SIZE ? rec->r_length : IO_BUF_SIZE;
+			pos = vfs_lseek(filp, rec->r_offset, SEEK_SET);
+			if (pos < 0)
+				return pos;
+			if (rec->r_op == VFS_OP_READ)
+				return vfs_read(filp, replay->buf, length);
+			return vfs_write(filp, replay->buf, length);
+		case VFS_OP_LSEEK:
+			/* get file */
+			filp = replay_file(replay, rec, path, O_RDONLY);
+			if (!filp)
+				return -1;
+
+			return vfs_lseek(filp, rec->r_offset, rec->r_mode) < 0 ? -1 : 0;
+		case VFS_OP_COPY_FILE_RANGE:
+			/* get input file and open output file (only input file handle is traced) */
+			filp = replay_file(replay, rec, path, O_RDONLY);
+			if (!filp)
+				return -ENOENT;
+			filp_out = vfs_open(root, path2, O_WRONLY, 0);
+			if (!filp_out)
+				return -ENOENT;
+
+			/* copy */
+			count = vfs_copy_file_range(filp, rec->r_offset, filp_out, rec->r_offset2, rec->r_length);
+			vfs_close(filp_out);
+			return count < 0 ? count : 0;
+		case VFS_OP_STATFS:
+			return vfs_statfs(replay->sb, &statfsbuf);
+		case VFS_OP_FSYNC:
+			return vfs_sync(replay->sb);
+		case VFS_OP_RELEASE:
+			return replay_release(replay, rec->r_fh);
+		case VFS_OP_READDIR:
+			/* get directory */
+			filp = replay_file(replay, rec, path, O_RDONLY);
+			if (!filp)
+				return -ENOENT;
+
+			/* read all entries */
+			while ((err = vfs_getdents64(filp, replay->buf, DIR_BUF_SIZE)) > 0);
+			return err;
+		case VFS_OP_ACCESS:
+			return vfs_access(root, path, 0);
+		case VFS_OP_CREATE:
+			return vfs_create(root, path, rec->r_mode);
+		case VFS_OP_UTIMENS:
+			vfs_trace_timespec(rec->r_offset, &times[0]);
+			vfs_trace_timespec(rec->r_offset2, &times[1]);
+			return vfs_utimens(root, path, times, 0);
+		default:
+			/* mount/umount are done by replay, other operations are not implemented */
+			return rec->r_result;
+	}
+}
+
+/*
+ * Dump a record.
+ */
+static void dump_record(uint64_t i, struct vfs_trace_record *rec, const char *path, const char *path2)
+{
+	printf("%-8lu %14.6f %-12s %-40s", i, rec->r_time / 1000000000.0, vfs_op_names[rec->r_op], path);
+	if (rec->r_path2_len)
+		printf(" -> %s", path2);
+	if (rec->r_op == VFS_OP_READ || rec->r_op == VFS_OP_WRITE)
+		printf(" off=%lu len=%u", rec->r_offset, rec->r_length);
+	if (rec->r_op == VFS_OP_UTIMENS)
+		printf(" atime=%lu mtime=%lu", rec->r_offset, rec->r_offset2);
+	if (rec->r_op == VFS_OP_COPY_FILE_RANGE)
+		printf(" off=%lu off_out=%lu len=%u", rec->r_offset, rec->r_offset2, rec->r_length);
+	printf(" res=%d %.3fus\n", rec->r_result, rec->r_duration / 1000.0);
+}
+
+/*
+ * Copy image file.
+ */
+static int copy_image(const char *src, const char *dst)
+{
+	FILE *fp_src, *fp_dst;
+	char buf[BUFSIZ];
+	size_t n;
+	int err = 0;
+
+	/* open source and destination */
+	fp_src = fopen(src, "r");
+	if (!fp_src)
+		return -ENOENT;
+	fp_dst = fopen(dst, "w");
+	if (!fp_dst) {
+		fclose(fp_src);
+		return -EACCES;
+	}
+
+	/* copy */
+	while ((n = fread(buf, 1, BUFSIZ, fp_src)) > 0) {
+		if (fwrite(buf, 1, n, fp_dst) != n) {
+			err = -ENOSPC;
+			break;
+		}
+	}
+
+	fclose(fp_src);
+	fclose(fp_dst);
+	return err;
+}
+
+/*
+ * Replay (or dump) a trace.
+ */
+static int replay_trace(struct replay *replay)
+{
+	char path[VFS_TRACE_PATH_LEN + 1], path2[VFS_TRACE_PATH_LEN + 1];
+	struct vfs_trace_record *rec;
+	struct vfs_stat_ctx ctx;
+	uint64_t i, first;
+	int ret, op;
+
+	/* warn about lost records */
+	first = vfs_trace_first(replay->trace);
+	if (first)
+		fprintf(stderr, "vfsreplay: %lu oldest records have been overwritten\n", first);
+
+	for (i = first; i < replay->trace->t_header->t_head; i++) {
+		/* get record */
+		rec = vfs_trace_get(replay->trace, i);
+		if (!rec || rec->r_op >= VFS_NR_OPS)
+			continue;
+
+		/* get paths */
+		memcpy(path, rec->r_path, rec->r_path_len);
+		path[rec->r_path_len] = 0;
+		memcpy(path2, rec->r_path + rec->r_path_len, rec->r_path2_len);
+		path2[rec->r_path2_len] = 0;
+
+		/* dump only */
+		if (replay->dump) {
+			dump_record(i, rec, path, path2);
+			continue;
+		}
+
+		/* replay operation */
+		op = rec->r_op;
+		vfs_stat_begin(&ctx);
+		ret = replay_record(replay, rec, path, path2);
+		vfs_stat_end(&replay_stats[op], &ctx);
+
+		/* check result */
+		if ((ret < 0) != (rec->r_result < 0))
+			replay->nr_errors++;
+		replay->nr_ops++;
+	}
+
+	return 0;
+}
+
+/*
+ * Usage function.
+ */
+static void usage(char *prog_name)
+{
+	printf("%s -t fstype [-o image_copy] [-i] [-d] <trace_file> [image_file]\n", prog_name);
+	printf("\n");
+	printf("Options :\n");
+	printf(" -h	print help\n");
+	printf(" -t	file system type (minix,bfs,ext2,isofs,memfs,tarfs)\n");
+	printf(" -o	image copy to replay on (default <image_file>.replay)\n");
+	printf(" -i	replay on image file itself (no copy)\n");
+	printf(" -d	dump trace only\n");
+}
+
+/* options */
+static const char *sopt = "t:o:idh";
+static const struct option lopt[] = {
+		{ "type",	required_argument,	NULL,	't'	},
+		{ "output",	required_argument,	NULL,	'o'	},
+		{ "in-place",	no_argument,		NULL,	'i'	},
+		{ "dump",	no_argument,		NULL,	'd'	},
+		{ "help",	no_argument,		NULL,	'h'	},
+		{ NULL,		0,			NULL,	0 	}
+};
+
+/*
+ * Main.
+ */
+int main(int argc, char **argv)
+{
+	struct replay replay;
+	char *fs_type = NULL;
+	int c, i, err;
+
+	/* reset replay */
+	memset(&replay, 0, sizeof(struct replay));
+
+	/* parse options */
+	while ((c = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+		switch (c) {
+			case 't':
+				fs_type = optarg;
+				break;
+			case 'o':
+				replay.copy = strdup(optarg);
+				break;
+			case 'i':
+				replay.in_place = 1;
+				break;
+			case 'd':
+				replay.dump = 1;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	/* get trace and image files */
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+	replay.trace_path = argv[optind];
+	replay.dev = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	/* open trace */
+	replay.trace = vfs_trace_open(replay.trace_path);
+	if (!replay.trace) {
+		fprintf(stderr, "vfsreplay: can't open trace %s\n", replay.trace_path);
+		exit(1);
+	}
+
+	/* dump trace */
+	if (replay.dump) {
+		replay_trace(&replay);
+		vfs_trace_close(replay.trace);
+		exit(0);
+	}
+
+	/* choose file system type */
+	if (!fs_type) {
+		usage(argv[0]);
+		exit(1);
+	} else if (strcmp(fs_type, "minix") == 0) {
+		replay.fs_type = VFS_MINIX_TYPE;
+	} else if (strcmp(fs_type, "bfs") == 0) {
+		replay.fs_type = VFS_BFS_TYPE;
+	} else if (strcmp(fs_type, "ext2") == 0) {
+		replay.fs_type = VFS_EXT2_TYPE;
+	} else if (strcmp(fs_type, "isofs") == 0) {
+		replay.fs_type = VFS_ISOFS_TYPE;
+	} else if (strcmp(fs_type, "memfs") == 0) {
+		replay.fs_type = VFS_MEMFS_TYPE;
+	} else if (strcmp(fs_type, "tarfs") == 0) {
+		replay.fs_type = VFS_TARFS_TYPE;
+	} else {
+		fprintf(stderr, "vfsreplay: unknown file system type '%s'\n", fs_type);
+		exit(1);
+	}
+
+	/* copy image */
+	if (replay.dev && !replay.in_place) {
+		if (!replay.copy) {
+			replay.copy = (char *) malloc(strlen(replay.dev) + strlen(".replay") + 1);
+			if (!replay.copy)
+				exit(1);
+			sprintf(replay.copy, "%s.replay", replay.dev);
+		}
+
+		err = copy_image(replay.dev, replay.copy);
+		if (err) {
+			fprintf(stderr, "vfsreplay: can't copy %s to %s\n", replay.dev, replay.copy);
+			exit(1);
+		}
+
+		replay.dev = replay.copy;
+	}
+
+	/* allocate I/O buffer */
+	replay.buf = (char *) calloc(1, IO_BUF_SIZE);
+	if (!replay.buf)
+		exit(1);
+
+	/* init histograms */
+	for (i = 0; i < VFS_NR_OPS; i++) {
+		replay_stats[i].h_name = vfs_op_names[i];
+		replay_stats[i].h_stage = -1;
+	}
+
+	/* init VFS and mount file system */
+	vfs_stats_enabled = 1;
+	if (vfs_init()) {
+		fprintf(stderr, "vfsreplay: can't init VFS\n");
+		exit(1);
+	}
+	replay.sb = vfs_mount(replay.dev, replay.fs_type, NULL);
+	if (!replay.sb) {
+		fprintf(stderr, "vfsreplay: can't mount %s\n", replay.dev ? replay.dev : fs_type);
+		exit(1);
+	}
+
+	/* replay trace */
+	replay_trace(&replay);
+
+	/* close remaining files */
+	for (i = 0; i < REPLAY_NR_FILES; i++)
+		if (replay.files[i].fh)
+			vfs_close(replay.files[i].filp);
+
+	/* unmount file system */
+	vfs_umount(replay.sb);
+
+	/* print statistics */
+	printf("replayed %lu operations (%lu results differ from trace)\n", replay.nr_ops, replay.nr_errors);
+	for (i = 0; i < VFS_NR_OPS; i++)
+		vfs_hist_dump(stdout, &replay_stats[i]);
+	vfs_stats_dump(stdout);
+
+	vfs_trace_close(replay.trace);
+	free(replay.buf);
+	free(replay.copy);
+	return 0;
+}